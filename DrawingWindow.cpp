@@ -29,9 +29,48 @@
 
 #include "DrawingWindow.h"
 #include <QApplication>
+#include <QFile>
+#include <QMutexLocker>
 #include <QPaintEvent>
+#include <QPointer>
+#include <QRunnable>
+#include <QTemporaryFile>
 #include <QThread>
+#include <QThreadPool>
 #include <QTimerEvent>
+#include <QWheelEvent>
+#include <QtConcurrentRun>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+#ifdef DRAWINGWINDOW_OPENGL
+#  include <QGLWidget>
+#endif
+
+#if defined(DRAWINGWINDOW_XSHM) && defined(Q_WS_X11)
+#  define DRAWINGWINDOW_USE_XSHM
+#  include <QX11Info>
+#  include <X11/Xlib.h>
+#  include <X11/Xutil.h>
+#  include <X11/extensions/XShm.h>
+#  include <sys/ipc.h>
+#  include <sys/shm.h>
+#endif
+
+#if defined(DRAWINGWINDOW_SHM) && defined(Q_OS_UNIX)
+#  define DRAWINGWINDOW_USE_SHM
+#  include <cerrno>
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
 
 /*! \class DrawingWindow
  *  \brief Fenêtre de dessin.
@@ -63,10 +102,57 @@
  * Comme pour la plupart des applications, il est également possible
  * de fermer la fenêtre via le gestionnaire de fenêtres.
  *
+ * Le dessin peut être réparti sur plusieurs couches (voir setLayer).
+ * La couche 0 est le fond, opaque.  Les couches supérieures sont
+ * initialement transparentes et sont superposées au fond lors du
+ * rendu.  Elles permettent par exemple d'animer un objet sans abîmer
+ * le décor dessiné en dessous.
+ *
+ * À la fermeture de la fenêtre, la fonction de dessin est arrêtée lors
+ * de son prochain appel à une méthode de DrawingWindow (les méthodes
+ * d'attente comme waitMousePress retournent aussitôt false), par une
+ * exception interne qui ne doit pas être rattrapée : un bloc
+ * catch (...) de la fonction de dessin doit la relancer (throw;).  Une
+ * fonction qui calcule longtemps sans rien dessiner ne s'arrête donc
+ * qu'à la fin de son calcul ; si elle ne s'est pas arrêtée stopTimeout
+ * ms après la fermeture, à la destruction de la fenêtre, son thread
+ * est tué (sauf en mode partagé, où il est attendu).
+ *
+ * Les méthodes dont le nom contient "World" acceptent des coordonnées
+ * réelles, dans un repère choisi par setWorld, dont l'axe des
+ * ordonnées est orienté vers le haut.
+ *
+ * Pour un dessin lissé, il est possible de dessiner dans une image
+ * plus grande que la fenêtre, réduite au moment du rendu (voir
+ * setSupersampling).
+ *
+ * Pour explorer un dessin, la molette de la souris agrandit la vue
+ * autour du pointeur, et un glissement avec &lt;Ctrl&gt; la déplace ;
+ * la touche &lt;Home&gt; revient à la vue d'origine.  Seul l'affichage
+ * change : la fonction de dessin n'est ni sollicitée, ni bloquée, et
+ * les coordonnées des clics restent celles de l'image.
+ *
+ * L'affichage de l'image dans la fenêtre peut se faire de plusieurs
+ * façons (voir setDefaultBackend) : par QPainter (par défaut), par une
+ * texture OpenGL, ou par mémoire partagée X11.  Elle peut aussi être
+ * supprimée, pour exécuter un programme sans fenêtre visible.
+ *
+ * Si la bibliothèque est compilée avec DRAWINGWINDOW_SHM, et si la
+ * variable d'environnement DRAWINGWINDOW_EXPORT donne un nom, les
+ * trames sont aussi exportées dans un segment de mémoire partagée
+ * POSIX de ce nom, pour d'autres processus (voir SharedFrame).
+ *
+ * Si la variable d'environnement DRAWINGWINDOW_RECORD donne un nom de
+ * fichier, tous les appels de dessin, ainsi que les synchronisations
+ * et les clics reçus, y sont enregistrés avec leur date, dans un
+ * format binaire compact.  L'enregistrement peut ensuite être rejoué
+ * (voir replay), sans le programme d'origine.
+ *
  * Il est possible, dans une application, d'ouvrir plusieurs fenêtres,
  * avec des fonctions de dessin éventuellement différentes.
  * L'application se terminera normalement lorsque la dernière fenêtre
- * sera fermée.
+ * sera fermée.  Avec beaucoup de fenêtres, le mode partagé (voir
+ * setSharedMode) évite d'avoir un thread et un timer par fenêtre.
  */
 
 /*! \example hello.cpp
@@ -122,10 +208,309 @@ private:
     friend class DrawingWindow;
 };
 
+//! Tâche de dessin, en mode partagé.
+class DrawingTask: public QRunnable {
+public:
+    DrawingTask(DrawingWindow &w, DrawingWindow::ThreadFunction f);
+    void start_once(QThreadPool &pool);
+    bool cancel();
+
+protected:
+    void run();
+
+private:
+    enum State { Idle, Queued, Running, Finished, Cancelled };
+
+    DrawingWindow &drawingWindow;
+    DrawingWindow::ThreadFunction threadFunction;
+    State state;
+    QMutex finishedMutex;
+    QWaitCondition finishedCondition;
+};
+
+//! Rendu et threads communs à toutes les fenêtres, en mode partagé.
+class DrawingPresenter: public QObject {
+public:
+    static DrawingPresenter *instance();
+
+    void add(DrawingWindow *w);
+    void remove(DrawingWindow *w);
+    QThreadPool &threadPool();
+
+protected:
+    void timerEvent(QTimerEvent *ev);
+
+private:
+    static QPointer<DrawingPresenter> presenter;
+
+    QBasicTimer timer;
+    QThreadPool pool;
+    std::vector<DrawingWindow *> windows;
+
+    DrawingPresenter();
+};
+
+//! Exception levée pour arrêter une fonction de dessin.
+class DrawingStopped {
+};
+
+//! Enregistrement des appels de dessin, dans un fichier binaire.
+class DrawingRecorder {
+public:
+    // The file starts with "DWRC", the format version, and the window
+    // size.  Each command is then one byte, the time elapsed since the
+    // previous command (us), and its arguments.  Integers are zigzag
+    // varints, doubles, colours and pixels are little-endian, and the
+    // vertices of polylines and lines are stored as deltas.  The
+    // pixels of UnlockPixels are stored per line as the runs that
+    // differ from the buffer at lockPixels time.
+    enum Command {
+        SetColor, SetBgColor, SetPenWidth, SetFont, SetAntialiasing,
+        SetSupersampling, SetBrush, SetBgMode,
+        ClearGraph, SetLayer, ClearLayer,
+        DrawPoint, DrawLine, DrawRect, DrawCircle, DrawTriangle,
+        DrawPointF, DrawLineF, DrawCircleF, DrawTriangleF,
+        DrawPolyline, DrawLines, DrawText,
+        SaveArea, RestoreArea, UnlockPixels,
+        Sync, NextFrame, MousePress, Close
+    };
+
+    static const char magic[4];
+    static const int version = 1;
+
+    static DrawingRecorder *create(const DrawingWindow &w);
+    ~DrawingRecorder();
+
+    DrawingRecorder &record(Command command);
+    DrawingRecorder &put(int value);
+    DrawingRecorder &put(double value);
+    DrawingRecorder &putColor(QRgb color);
+    DrawingRecorder &putString(const char *s);
+    DrawingRecorder &putPoints(const QPoint *points, int n);
+    DrawingRecorder &putLines(const QLine *lines, const unsigned int *colors,
+                              int n);
+    DrawingRecorder &putPixels(const QRgb *pixels, int n);
+
+    void keepPixels(const QRgb *pixels, int n);
+    DrawingRecorder &putChangedPixels(const QRgb *pixels, int offset, int n);
+
+private:
+    static const int bufferSize = 1 << 16;
+    static int count;
+
+    QFile file;
+    QElapsedTimer clock;
+    qint64 lastTime;
+    int used;
+    char buffer[bufferSize];
+    std::vector<QRgb> kept;     // pixels at lockPixels time
+    std::vector<int> runs;      // for putChangedPixels, reused
+
+    DrawingRecorder(const QString &fileName, const DrawingWindow &w);
+    void putVarint(quint64 value);
+    void putBytes(const void *data, int n);
+    void flush();
+};
+
+//! Histogramme des latences, à précision relative constante.
+class DrawingLatency {
+public:
+    DrawingLatency();
+
+    void record(qint64 usecs);
+    void reset();
+    int count() const;
+    double quantile(double q) const;
+
+private:
+    // Values below 2 * subBuckets (us) are exact.  Above, each power
+    // of two is split into subBuckets buckets (about 3% precision),
+    // up to 2^(maxShift + 6) us, about two minutes.
+    static const int subBuckets = 32;
+    static const int maxShift = 21;
+    static const int buckets = (2 + maxShift) * subBuckets;
+
+    mutable QMutex mutex;
+    int counts[buckets];
+    int total;
+    qint64 maxValue;
+
+    static int bucketOf(qint64 value);
+    static qint64 valueOf(int bucket);
+};
+
+//! Lecture d'un fichier écrit par DrawingRecorder.
+class DrawingRecordReader {
+public:
+    //! Nombre maximal d'éléments accepté pour un paramètre
+    static const int maxCount = 1 << 24;
+
+    int width;
+    int height;
+
+    DrawingRecordReader(const char *fileName);
+    ~DrawingRecordReader();
+
+    bool isValid() const;
+    bool atEnd() const;
+    void invalidate();
+
+    int getCommand(qint64 &time);
+    int getInt();
+    int getCount();
+    void getInts(int *values, int n);
+    double getDouble();
+    void getDoubles(double *values, int n);
+    QRgb getColor();
+    QByteArray getString();
+    void getPoints(QPoint *points, int n);
+    bool getLines(QLine *lines, unsigned int *colors, int n);
+    void getPixels(QRgb *pixels, int n);
+    void getChangedPixels(QRgb *pixels, int n);
+
+private:
+    QFile file;
+    uchar *data;
+    const uchar *pos;
+    const uchar *end;
+    bool valid;
+
+    quint64 getVarint();
+    bool need(qint64 n);
+};
+
+//! Méthode d'affichage de l'image dans la fenêtre.
+class DrawingBackend {
+public:
+    static DrawingBackend *create(DrawingWindow &w,
+                                  DrawingWindow::Backend &type);
+
+    DrawingBackend(DrawingWindow &w);
+    virtual ~DrawingBackend();
+
+    virtual void update(const QRect &rect);
+    virtual void viewChanged();
+    virtual void flush();
+    virtual void paint(const QRect &rect) = 0;
+
+    void compose(QImage &dest, const QRect &rect);
+
+protected:
+    DrawingWindow &drawingWindow;
+
+    void paintLayers(QPainter &painter, const QRect &rect);
+
+    bool isViewZoomed() const;
+    QTransform viewTransform() const;
+    QRect viewSource(const QRect &rect) const;
+    void presented();
+};
+
+#ifdef DRAWINGWINDOW_USE_SHM
+//! Export des trames dans un segment de mémoire partagée POSIX.
+class DrawingFrameExport {
+public:
+    static DrawingFrameExport *create(const DrawingWindow &w);
+    ~DrawingFrameExport();
+
+    void publish(DrawingBackend &backend, const QRect &rect);
+
+private:
+    static int count;
+
+    QByteArray name;
+    DrawingWindow::SharedFrame *header;
+    size_t size;
+    int *generations;
+    QImage frame;
+
+    DrawingFrameExport(const QByteArray &name_, const DrawingWindow &w);
+};
+#endif // DRAWINGWINDOW_USE_SHM
+
+//! Affichage par QPainter::drawImage.
+class DrawingRasterBackend: public DrawingBackend {
+public:
+    DrawingRasterBackend(DrawingWindow &w);
+    void paint(const QRect &rect);
+};
+
+//! Aucun affichage : la fenêtre n'apparaît pas à l'écran.
+class DrawingHeadlessBackend: public DrawingBackend {
+public:
+    DrawingHeadlessBackend(DrawingWindow &w);
+    void update(const QRect &rect);
+    void viewChanged();
+    void paint(const QRect &rect);
+};
+
+#ifdef DRAWINGWINDOW_OPENGL
+class DrawingGLView;
+
+//! Affichage par une texture OpenGL, mise à jour sur la zone modifiée.
+class DrawingGLBackend: public DrawingBackend {
+public:
+    DrawingGLBackend(DrawingWindow &w);
+    ~DrawingGLBackend();
+
+    void update(const QRect &rect);
+    void viewChanged();
+    void flush();
+    void paint(const QRect &rect);
+
+    void initializeGL();
+    void paintGL(int width, int height);
+
+private:
+    DrawingGLView *view;
+    GLuint texture;
+    QImage frame;
+    QRect pending;
+};
+
+//! Widget OpenGL, qui recouvre la fenêtre de dessin.
+class DrawingGLView: public QGLWidget {
+public:
+    DrawingGLView(DrawingGLBackend &b, QWidget *parent);
+
+protected:
+    void initializeGL();
+    void resizeGL(int width, int height);
+    void paintGL();
+
+private:
+    DrawingGLBackend &backend;
+};
+#endif // DRAWINGWINDOW_OPENGL
+
+#ifdef DRAWINGWINDOW_USE_XSHM
+//! Affichage par une image X11 en mémoire partagée (MIT-SHM).
+class DrawingXShmBackend: public DrawingBackend {
+public:
+    DrawingXShmBackend(DrawingWindow &w);
+    ~DrawingXShmBackend();
+
+    bool isValid() const;
+    void paint(const QRect &rect);
+
+private:
+    Display *display;
+    XImage *ximage;
+    XShmSegmentInfo shminfo;
+    bool attached;
+    GC gc;
+    QImage frame;
+    QImage source;              // image composée, si la vue est agrandie
+
+    void release();
+};
+#endif // DRAWINGWINDOW_USE_XSHM
+
 enum UserEvents {
     SyncRequest = QEvent::User, //!< Demande de synchronisation.
     CloseRequest,               //!< Demande de fermeture de la fenêtre.
     DrawTextRequest,            //!< Demande d'écriture de texte.
+    PresentRequest,             //!< Demande de rendu.
 };
 
 //! Demande de synchronisation.
@@ -142,6 +527,13 @@ public:
     { }
 };
 
+//! Demande de rendu.
+class PresentRequestEvent: public QEvent {
+public:
+    PresentRequestEvent(): QEvent(static_cast<QEvent::Type>(PresentRequest))
+    { }
+};
+
 //! Demande de tracé de texte.
 class DrawTextEvent: public QEvent {
 public:
@@ -170,6 +562,9 @@ public:
 /*! \var DrawingWindow::DEFAULT_HEIGHT
  *  \brief Hauteur par défaut de la fenêtre.
  */
+/*! \var DrawingWindow::MAX_LAYERS
+ *  \brief Nombre de couches de dessin disponibles.
+ */
 /*! \var DrawingWindow::width
  *  \brief Largeur de la fenêtre.
  */
@@ -177,8 +572,72 @@ public:
  *  \brief Hauteur de la fenêtre.
  */
 /*! \var DrawingWindow::paintInterval
- *  \brief Intervalle de temps entre deux rendus (ms).
+ *  \brief Intervalle de temps minimal entre deux rendus, par défaut (ms).
+ */
+/*! \var DrawingWindow::stopTimeout
+ *  \brief Délai d'arrêt de la fonction de dessin, avant de tuer son
+ *  thread (ms).
+ */
+/*! \var DrawingWindow::maxFrameLag
+ *  \brief Retard maximal rattrapé par frameSteps (s).
+ */
+const double DrawingWindow::maxFrameLag = 0.25;
+
+/*! \struct DrawingWindow::SharedFrame
+ *  \brief En-tête du segment de mémoire partagée des trames exportées.
+ *
+ * L'en-tête est suivi de tilesX × tilesY entiers, le numéro de la
+ * dernière trame ayant modifié chaque carreau (ligne par ligne), puis,
+ * à partir de pixelsOffset, de width × height pixels #FFRRGGBB.
+ *
+ * Un lecteur lit sequence : s'il est impair, une écriture est en
+ * cours.  Sinon, il recopie les carreaux dont le numéro est plus
+ * récent que la dernière trame qu'il a vue, puis relit sequence.
+ * S'il n'a pas changé, la copie est cohérente, et frame est la trame
+ * vue ; sinon, il recommence.  Les compteurs doivent être lus par
+ * fetchAndAddOrdered(0) : le segment est ouvert en lecture et
+ * écriture.  Il n'est accessible qu'à son propriétaire (droits 0600) :
+ * le lecteur doit tourner sous le même utilisateur que le programme.
+ * Voir le programme shmviewer.
+ */
+const char DrawingWindow::sharedFrameMagic[4] = { 'D', 'W', 'F', 'B' };
+
+/*! \var DrawingWindow::maxWindowCoord
+ *  \brief Coordonnée maximale (en valeur absolue) issue du monde.
+ */
+const double DrawingWindow::maxWindowCoord = 16777216.0;
+
+/*! \var DrawingWindow::maxPendingSaves
+ *  \brief Nombre maximal d'enregistrements en cours (cf. saveImageAsync).
+ */
+/*! \var DrawingWindow::saveTimeout
+ *  \brief Attente maximale des enregistrements en cours, à la
+ *  destruction de la fenêtre (ms).
+ */
+
+/*! \var DrawingWindow::maxViewScale
+ *  \brief Agrandissement maximal de la vue (cf. wheelEvent).
+ */
+const double DrawingWindow::maxViewScale = 32.0;
+
+/*! \var DrawingWindow::sharedMode
+ *  \brief Mode des fenêtres créées par la suite (cf. setSharedMode).
+ */
+bool DrawingWindow::sharedMode = false;
+
+/*! \var DrawingWindow::sharedThreads
+ *  \brief Nombre de threads du mode partagé (0 : un par processeur).
+ */
+int DrawingWindow::sharedThreads = 0;
+
+/*! \enum DrawingWindow::Backend
+ *  \brief Méthode d'affichage de l'image dans la fenêtre.
+ */
+/*! \var DrawingWindow::defaultBackend
+ *  \brief Méthode d'affichage des fenêtres créées par la suite (-1 : pas
+ *  encore lue dans l'environnement).
  */
+int DrawingWindow::defaultBackend = -1;
 
 //! Constructeur.
 /*!
@@ -248,9 +707,40 @@ DrawingWindow::DrawingWindow(QWidget *parent, Qt::WindowFlags flags,
 //! Destructeur.
 DrawingWindow::~DrawingWindow()
 {
-    delete thread;
-    delete painter;
-    delete image;
+    if (shared)
+        DrawingPresenter::instance()->remove(this);
+    stopDrawing();
+    if (shared) {
+        // a task still queued in the pool is deleted by itself
+        if (task->cancel())
+            delete task;
+    } else {
+        if (!thread->wait(stopTimeout)) {
+            // last resort, for a function that never calls the library
+            qWarning("DrawingWindow: drawing function not stopped,"
+                     " terminating");
+            thread->terminate();
+            thread->wait();
+        }
+        delete thread;
+    }
+    // pending saves release saveSlots when done: one still running
+    // after saveTimeout keeps it, and it is never freed
+    if (saveSlots->tryAcquire(maxPendingSaves, saveTimeout))
+        delete saveSlots;
+    else
+        qWarning("DrawingWindow: image saves still pending");
+    delete latency;
+    delete recorder;
+#ifdef DRAWINGWINDOW_USE_SHM
+    delete frameExport;
+#endif
+    delete backend;
+    for (int i = 0; i < MAX_LAYERS; i++) {
+        delete layerPainters[i];
+        delete layers[i];
+        delete resolved[i];
+    }
 }
 
 //! Change la couleur de dessin.
@@ -353,8 +843,11 @@ void DrawingWindow::setBgColor(float red, float green, float blue)
  */
 void DrawingWindow::setPenWidth(int width)
 {
+    if (recorder)
+        recorder->record(DrawingRecorder::SetPenWidth).put(width);
     QPen pen(painter->pen());
-    pen.setWidth(width);
+    // with supersampling, a 0 width pen would be one subpixel wide
+    pen.setWidth(supersampling > 1 ? qMax(width, 1) : width);
     painter->setPen(pen);
 }
 
@@ -373,6 +866,9 @@ const QFont &DrawingWindow::getFont() const
  */
 void DrawingWindow::setFont(const QFont &font)
 {
+    if (recorder)
+        recorder->record(DrawingRecorder::SetFont)
+            .putString(font.toString().toUtf8().constData());
     painter->setFont(font);
 }
 
@@ -387,23 +883,202 @@ void DrawingWindow::setFont(const QFont &font)
  */
 void DrawingWindow::setAntialiasing(bool state)
 {
+    if (recorder)
+        recorder->record(DrawingRecorder::SetAntialiasing).put(int(state));
     painter->setRenderHint(QPainter::Antialiasing, state);
 }
 
+//! Active ou non le suréchantillonnage.
+/*!
+ * Alternative à setAntialiasing, plus rapide pour les dessins denses.
+ * Avec un facteur 2 ou 4, toutes les couches sont des images 2 ou 4
+ * fois plus grandes dans chaque direction, où l'on dessine sans
+ * antialiasing, avec les mêmes coordonnées qu'avant.  Au moment du
+ * rendu, seule la zone modifiée est réduite à la taille de la
+ * fenêtre, chaque pixel prenant la moyenne des pixels correspondants
+ * (filtre boîte, vectorisé avec SSE2).
+ *
+ * Le centre d'un pixel de la fenêtre correspond au centre du bloc de
+ * pixels de l'image : un trait d'épaisseur 1 couvre exactement les
+ * mêmes pixels que sans suréchantillonnage, mais les traits obliques
+ * et les courbes sont lissés.
+ *
+ * Le contenu des couches est conservé (agrandi ou réduit).  Pour
+ * getPointColor, saveArea et restoreArea, rien ne change.  Par contre,
+ * lockPixels donne accès à l'image suréchantillonnée, de taille
+ * factor * width × factor * height : voir getPixelStride.
+ *
+ * \param factor        facteur de suréchantillonnage : 1 (désactivé,
+ *                      par défaut), 2 ou 4
+ *
+ * \see getSupersampling
+ */
+void DrawingWindow::setSupersampling(int factor)
+{
+    if ((factor != 1 && factor != 2 && factor != 4)
+        || factor == supersampling)
+        return;
+    if (recorder)
+        recorder->record(DrawingRecorder::SetSupersampling).put(factor);
+    // the centre of pixel (x, y) maps to the centre of its block
+    const QTransform transform(factor, 0, 0, factor,
+                               factor / 2, factor / 2);
+    safeLock(imageMutex);
+    for (int i = 0; i < MAX_LAYERS; i++) {
+        if (!layers[i])
+            continue;
+        QImage *old = layers[i];
+        QPainter *oldPainter = layerPainters[i];
+        layers[i] = new QImage(old->scaled(factor * width, factor * height));
+        layerPainters[i] = new QPainter(layers[i]);
+        QPainter *p = layerPainters[i];
+        QPen pen(oldPainter->pen());
+        if (factor > 1)
+            pen.setWidth(qMax(pen.width(), 1));
+        p->setPen(pen);
+        p->setBackground(oldPainter->background());
+        p->setFont(oldPainter->font());
+        p->setRenderHints(oldPainter->renderHints());
+        if (factor > 1)
+            p->setTransform(transform);
+        delete oldPainter;
+        delete old;
+        delete resolved[i];
+        resolved[i] = factor > 1
+            ? new QImage(width, height, layers[i]->format()) : NULL;
+    }
+    supersampling = factor;
+    image = layers[layer];
+    painter = layerPainters[layer];
+    if (factor > 1)
+        resolve(QRect(0, 0, width, height));
+    dirty();
+    safeUnlock(imageMutex);
+}
+
+//! Retourne le facteur de suréchantillonnage.
+/*!
+ * \see setSupersampling
+ */
+int DrawingWindow::getSupersampling() const
+{
+    return supersampling;
+}
+
 //! Efface la fenêtre.
 /*!
- * La fenêtre est effacée avec la couleur de fond courante.
+ * La fenêtre est effacée avec la couleur de fond courante.  Toutes
+ * les couches supérieures sont également effacées.
  *
- * \see setBgColor
+ * \see setBgColor, clearLayer
  */
 void DrawingWindow::clearGraph()
 {
+    if (recorder)
+        recorder->record(DrawingRecorder::ClearGraph);
     safeLock(imageMutex);
-    painter->fillRect(image->rect(), getBgColor());
+    layerPainters[0]->save();
+    layerPainters[0]->resetTransform();
+    layerPainters[0]->fillRect(layers[0]->rect(), getBgColor());
+    layerPainters[0]->restore();
+    for (int i = 1; i < MAX_LAYERS; i++) {
+        if (layers[i]) {
+            layers[i]->fill(0);
+            layerRects[i] = QRect();
+        }
+    }
     dirty();
     safeUnlock(imageMutex);
 }
 
+//! Change la couche de dessin courante.
+/*!
+ * Toutes les fonctions de dessin agissent sur la couche courante.  La
+ * couche 0, utilisée par défaut, est le fond de la fenêtre.  Les
+ * couches 1 à MAX_LAYERS - 1 sont transparentes tant que rien n'y a
+ * été dessiné, et sont superposées dans l'ordre lors du rendu.
+ *
+ * Les couleurs, l'épaisseur du pinceau, la fonte et l'antialiasing
+ * courants sont conservés lors du changement de couche.
+ *
+ * \param layer         numéro de la couche (0 à MAX_LAYERS - 1)
+ *
+ * \see getLayer, clearLayer, MAX_LAYERS
+ */
+void DrawingWindow::setLayer(int layer)
+{
+    if (layer < 0 || layer >= MAX_LAYERS || layer == this->layer)
+        return;
+    if (recorder)
+        recorder->record(DrawingRecorder::SetLayer).put(layer);
+    safeLock(imageMutex);
+    if (!layers[layer]) {
+        layers[layer] = new QImage(supersampling * width,
+                                   supersampling * height,
+                                   QImage::Format_ARGB32_Premultiplied);
+        layers[layer]->fill(0);
+        layerPainters[layer] = new QPainter(layers[layer]);
+        layerPainters[layer]->setTransform(painter->transform());
+        if (supersampling > 1) {
+            resolved[layer] = new QImage(width, height,
+                                         QImage::Format_ARGB32_Premultiplied);
+            resolved[layer]->fill(0);
+        }
+    }
+    QPainter *newPainter = layerPainters[layer];
+    newPainter->setPen(painter->pen());
+    newPainter->setBackground(painter->background());
+    newPainter->setFont(painter->font());
+    newPainter->setRenderHints(painter->renderHints());
+    this->layer = layer;
+    image = layers[layer];
+    painter = newPainter;
+    safeUnlock(imageMutex);
+}
+
+//! Retourne le numéro de la couche de dessin courante.
+/*!
+ * \see setLayer
+ */
+int DrawingWindow::getLayer() const
+{
+    return layer;
+}
+
+//! Efface la couche courante.
+/*!
+ * Pour la couche 0, c'est équivalent à remplir la fenêtre avec la
+ * couleur de fond courante.  Les autres couches redeviennent
+ * transparentes.  Seule la zone effectivement dessinée depuis le
+ * dernier effacement est traitée, ce qui rend l'opération peu
+ * coûteuse pour un petit objet animé.
+ *
+ * \see setLayer, clearGraph
+ */
+void DrawingWindow::clearLayer()
+{
+    if (recorder)
+        recorder->record(DrawingRecorder::ClearLayer);
+    safeLock(imageMutex);
+    if (layer == 0) {
+        painter->save();
+        painter->resetTransform();
+        painter->fillRect(image->rect(), getBgColor());
+        painter->restore();
+        dirty();
+    } else if (!layerRects[layer].isEmpty()) {
+        QRect r = layerRects[layer] & QRect(0, 0, width, height);
+        painter->save();
+        painter->resetTransform();
+        painter->setCompositionMode(QPainter::CompositionMode_Source);
+        painter->fillRect(deviceRect(r), Qt::transparent);
+        painter->restore();
+        dirty(r);
+        layerRects[layer] = QRect();
+    }
+    safeUnlock(imageMutex);
+}
+
 //! Dessine un point.
 /*!
  * Dessine un point (pixel) aux coordonnées (x, y), avec la couleur de
@@ -415,6 +1090,8 @@ void DrawingWindow::clearGraph()
  */
 void DrawingWindow::drawPoint(int x, int y)
 {
+    if (recorder)
+        recorder->record(DrawingRecorder::DrawPoint).put(x).put(y);
     safeLock(imageMutex);
     painter->drawPoint(x, y);
     dirty(x, y);
@@ -436,6 +1113,9 @@ void DrawingWindow::drawLine(int x1, int y1, int x2, int y2)
     if (x1 == x2 && y1 == y2) {
         drawPoint(x1, y1);
     } else {
+        if (recorder)
+            recorder->record(DrawingRecorder::DrawLine)
+                .put(x1).put(y1).put(x2).put(y2);
         safeLock(imageMutex);
         painter->drawLine(x1, y1, x2, y2);
         dirty(x1, y1, x2, y2);
@@ -459,6 +1139,9 @@ void DrawingWindow::drawRect(int x1, int y1, int x2, int y2)
     if (x1 == x2 && y1 == y2) {
         drawPoint(x1, y1);
     } else {
+        if (recorder)
+            recorder->record(DrawingRecorder::DrawRect)
+                .put(x1).put(y1).put(x2).put(y2);
         QRect r;
         r.setCoords(x1, y1, x2 - 1, y2 - 1);
         r = r.normalized();
@@ -483,9 +1166,9 @@ void DrawingWindow::drawRect(int x1, int y1, int x2, int y2)
  */
 void DrawingWindow::fillRect(int x1, int y1, int x2, int y2)
 {
-    painter->setBrush(getColor());
+    setBrush(true);
     drawRect(x1, y1, x2, y2);
-    painter->setBrush(Qt::NoBrush);
+    setBrush(false);
 }
 
 //! Dessine un cercle.
@@ -500,6 +1183,8 @@ void DrawingWindow::fillRect(int x1, int y1, int x2, int y2)
  */
 void DrawingWindow::drawCircle(int x, int y, int r)
 {
+    if (recorder)
+        recorder->record(DrawingRecorder::DrawCircle).put(x).put(y).put(r);
     QRect rect;
     rect.setCoords(x - r, y - r, x + r - 1, y + r - 1);
     safeLock(imageMutex);
@@ -521,9 +1206,9 @@ void DrawingWindow::drawCircle(int x, int y, int r)
  */
 void DrawingWindow::fillCircle(int x, int y, int r)
 {
-    painter->setBrush(getColor());
+    setBrush(true);
     drawCircle(x, y, r);
-    painter->setBrush(Qt::NoBrush);
+    setBrush(false);
 }
 
 //! Dessine un triangle.
@@ -540,6 +1225,9 @@ void DrawingWindow::fillCircle(int x, int y, int r)
  */
 void DrawingWindow::drawTriangle(int x1, int y1, int x2, int y2, int x3, int y3)
 {
+    if (recorder)
+        recorder->record(DrawingRecorder::DrawTriangle)
+            .put(x1).put(y1).put(x2).put(y2).put(x3).put(y3);
     QPolygon poly(3);
     poly.putPoints(0, 3, x1, y1, x2, y2, x3, y3);
     safeLock(imageMutex);
@@ -562,560 +1250,4251 @@ void DrawingWindow::drawTriangle(int x1, int y1, int x2, int y2, int x3, int y3)
  */
 void DrawingWindow::fillTriangle(int x1, int y1, int x2, int y2, int x3, int y3)
 {
-    painter->setBrush(getColor());
+    setBrush(true);
     drawTriangle(x1, y1, x2, y2, x3, y3);
-    painter->setBrush(Qt::NoBrush);
+    setBrush(false);
 }
 
-//! Écrit du texte.
+//! Dessine un point, en coordonnées réelles.
 /*!
- * Écrit le texte text, aux coordonnées (x, y) et avec les paramètres
- * d'alignement flags.  Le texte est écrit avec la couleur de dessin
- * courante.  Les flags sont une combinaison (ou binaire) de
- * Qt::AlignLeft, Qt::AligneRight, Qt::AlignHCenter, Qt::AlignTop,
- * Qt::AlignBottom, Qt::AlignVCenter, Qt::AlignCenter.  Par défaut, le
- * texte est aligné en haut à gauche.
+ * Comme drawPoint, mais la position n'est pas arrondie :
+ * elle est transmise telle quelle au moteur de rendu.  En mode
+ * antialiasing (ou avec suréchantillonnage), un point entre deux
+ * pixels les colore partiellement tous les deux.
  *
- * \param x, y          coordonnées du texte
- * \param text          texte à écrire
- * \param flags         paramètres d'alignement
+ * \param x, y          coordonnées du point
  *
- * \see drawText(int, int, const std::string &, int)
- * \see drawTextBg, setColor
- * \see QPainter::drawText
+ * \see drawPoint, setAntialiasing
  */
-void DrawingWindow::drawText(int x, int y, const char *text, int flags)
+void DrawingWindow::drawPointF(double x, double y)
 {
-    safeLock(syncMutex);
-    if (!terminateThread) {
-        qApp->postEvent(this, new DrawTextEvent(x, y, text, flags));
-        syncCondition.wait(&syncMutex);
-    }
-    safeUnlock(syncMutex);
+    if (recorder)
+        recorder->record(DrawingRecorder::DrawPointF).put(x).put(y);
+    safeLock(imageMutex);
+    painter->drawPoint(QPointF(x, y));
+    dirty(QRectF(x, y, 1.0, 1.0));
+    safeUnlock(imageMutex);
 }
 
-//! Écrit du texte.
+//! Dessine un segment, en coordonnées réelles.
 /*!
- * \see drawText(int, int, const char *, int)
+ * \see drawLine, drawPointF
  */
-void DrawingWindow::drawText(int x, int y, const std::string &text, int flags)
+void DrawingWindow::drawLineF(double x1, double y1,
+                              double x2, double y2)
 {
-    drawText(x, y, text.c_str(), flags);
+    if (x1 == x2 && y1 == y2) {
+        drawPointF(x1, y1);
+    } else {
+        if (recorder)
+            recorder->record(DrawingRecorder::DrawLineF)
+                .put(x1).put(y1).put(x2).put(y2);
+        safeLock(imageMutex);
+        painter->drawLine(QLineF(x1, y1, x2, y2));
+        dirty(QRectF(QPointF(x1, y1), QPointF(x2, y2)).normalized());
+        safeUnlock(imageMutex);
+    }
 }
 
-//! Écrit du texte sur fond coloré.
+//! Dessine un cercle, en coordonnées réelles.
 /*!
- * Écrit du texte comme drawText, mais l'arrière-plan est coloré avec
- * la couleur de fond courante.
- *
- * \param x, y          coordonnées du texte
- * \param text          texte à écrire
- * \param flags         paramètres d'alignement
+ * Le centre et le rayon ne sont pas arrondis.
  *
- * \see drawTextBg(int, int, const std::string &, int)
- * \see drawText, setColor, setColorBg
+ * \see drawCircle, drawPointF
  */
-void DrawingWindow::drawTextBg(int x, int y, const char *text, int flags)
+void DrawingWindow::drawCircleF(double x, double y, double r)
 {
-    painter->setBackgroundMode(Qt::OpaqueMode);
-    drawText(x, y, text, flags);
-    painter->setBackgroundMode(Qt::TransparentMode);
+    if (recorder)
+        recorder->record(DrawingRecorder::DrawCircleF).put(x).put(y).put(r);
+    safeLock(imageMutex);
+    painter->drawEllipse(QPointF(x, y), r, r);
+    dirty(QRectF(x - r, y - r, 2.0 * r, 2.0 * r));
+    safeUnlock(imageMutex);
 }
 
-//! Écrit du texte sur fond coloré.
+//! Dessine un disque, en coordonnées réelles.
 /*!
- * \see drawTextBg(int, int, const char *, int)
+ * \see fillCircle, drawCircleF
  */
-void DrawingWindow::drawTextBg(int x, int y, const std::string &text, int flags)
+void DrawingWindow::fillCircleF(double x, double y, double r)
 {
-    drawTextBg(x, y, text.c_str(), flags);
+    setBrush(true);
+    drawCircleF(x, y, r);
+    setBrush(false);
 }
 
-//! Retourne la couleur d'un pixel.
+//! Dessine un triangle, en coordonnées réelles.
 /*!
- * Retourne la couleur du pixel de coordonnées (x, y).  La valeur
- * retournée peut servir de paramètres à setColor(unsigned int) ou
- * setBgColor(unsigned int).
- *
- * \param x, y          coordonnées du pixel
- * \return              couleur du pixel
- *
- * \see setColor(unsigned int), setBgColor(unsigned int)
+ * \see drawTriangle, drawPointF
  */
-unsigned int DrawingWindow::getPointColor(int x, int y) const
+void DrawingWindow::drawTriangleF(double x1, double y1,
+                                  double x2, double y2,
+                                  double x3, double y3)
 {
-    return image->pixel(x, y);
+    if (recorder)
+        recorder->record(DrawingRecorder::DrawTriangleF)
+            .put(x1).put(y1).put(x2).put(y2).put(x3).put(y3);
+    const QPointF poly[3] = {
+        QPointF(x1, y1), QPointF(x2, y2), QPointF(x3, y3)
+    };
+    QRectF r(QPointF(qMin(x1, qMin(x2, x3)), qMin(y1, qMin(y2, y3))),
+             QPointF(qMax(x1, qMax(x2, x3)), qMax(y1, qMax(y2, y3))));
+    safeLock(imageMutex);
+    painter->drawConvexPolygon(poly, 3);
+    dirty(r);
+    safeUnlock(imageMutex);
 }
 
-//! Attend l'appui sur un des boutons de la souris.
+//! Dessine un triangle plein, en coordonnées réelles.
 /*!
- * Attend l'appui sur un des boutons de la souris.  Retourne le bouton
- * qui a été pressé et les coordonnées du pointeur de souris à ce
- * moment-là.
- *
- * \param x, y          coordonnées du pointeur de souris
- * \param button        numéro du bouton qui a été pressé
- *                      (1: gauche, 2: droit, 3: milieu, 0 sinon)
- * \param time          durée maximale de l'attente
- * \return              true si un bouton a été pressé
- *
- * \bug                 expérimental
+ * \see fillTriangle, drawTriangleF
  */
-bool DrawingWindow::waitMousePress(int &x, int &y, int &button,
-                                   unsigned long time)
+void DrawingWindow::fillTriangleF(double x1, double y1,
+                                  double x2, double y2,
+                                  double x3, double y3)
 {
-    bool pressed;
-    safeLock(inputMutex);
-    if (terminateThread) {
-        pressed = false;
-    } else {
-        pressed = inputCondition.wait(&inputMutex, time) && !terminateThread;
-        if (pressed) {
-            x = mousePos.x();
-            y = mousePos.y();
-            if (mouseButton & Qt::LeftButton)
-                button = 1;
-            else if (mouseButton & Qt::RightButton)
-                button = 2;
-            else if (mouseButton & Qt::MidButton)
-                button = 3;
-            else
-                button = 0;
-        }
-    }
-    safeUnlock(inputMutex);
-    return pressed;
+    setBrush(true);
+    drawTriangleF(x1, y1, x2, y2, x3, y3);
+    setBrush(false);
 }
 
-//! Synchronise le contenu de la fenêtre.
+//! Dessine une ligne brisée.
 /*!
- * Pour des raisons d'efficacités, le résultat des fonctions de dessin
- * n'est pas affiché immédiatement.  L'appel à sync permet de
- * synchroniser le contenu de la fenêtre.  Autrement dit, cela bloque
- * l'exécution du programme jusqu'à ce que le contenu de la fenêtre
- * soit à jour.
+ * Relie les n points du tableau points par des segments de droite,
+ * avec la couleur de dessin courante.  Beaucoup plus rapide que
+ * d'appeler drawLine pour chacun des segments.
  *
- * \param time          durée maximale de l'attente
- * \return              true si la fenêtre a pu être synchronisée
+ * \param points        tableau des sommets de la ligne brisée
+ * \param n             nombre de sommets
+ *
+ * \see drawLine, drawLines, setColor
  */
-bool DrawingWindow::sync(unsigned long time)
+void DrawingWindow::drawPolyline(const QPoint *points, int n)
 {
-    bool synced;
-    safeLock(syncMutex);
-    if (terminateThread) {
-        synced = false;
-    } else {
-        qApp->postEvent(this, new SyncRequestEvent());
-        synced = syncCondition.wait(&syncMutex, time);
+    if (n <= 0)
+        return;
+    if (n == 1) {
+        drawPoint(points[0].x(), points[0].y());
+        return;
     }
-    safeUnlock(syncMutex);
-    return synced;
+    if (recorder)
+        recorder->record(DrawingRecorder::DrawPolyline).put(n)
+            .putPoints(points, n);
+    QRect r = boundingRect(points, n);
+    safeLock(imageMutex);
+    painter->drawPolyline(points, n);
+    dirty(r);
+    safeUnlock(imageMutex);
 }
 
-//! Ferme la fenêtre graphique.
-void DrawingWindow::closeGraph()
+//! Dessine plusieurs segments.
+/*!
+ * Dessine les n segments du tableau lines, avec la couleur de dessin
+ * courante.  Beaucoup plus rapide que d'appeler drawLine pour chacun
+ * des segments.
+ *
+ * \param lines         tableau des segments
+ * \param n             nombre de segments
+ *
+ * \see drawLine, drawPolyline, setColor
+ */
+void DrawingWindow::drawLines(const QLine *lines, int n)
 {
-    qApp->postEvent(this, new CloseRequestEvent());
+    drawLines(lines, NULL, n);
 }
 
-//! Suspend l'exécution pendant un certain temps.
+//! Dessine plusieurs segments, chacun avec sa couleur.
 /*!
- * \param secs          temps d'attente en seconde
+ * Dessine les n segments du tableau lines.  Le segment lines[i] est
+ * dessiné avec la couleur colors[i] (cf. setColor(unsigned int)).
+ * Après l'appel, la couleur de dessin courante est inchangée.
+ *
+ * \param lines         tableau des segments
+ * \param colors        tableau des couleurs des segments
+ * \param n             nombre de segments
+ *
+ * \see drawLine, drawPolyline, setColor(unsigned int)
  */
-void DrawingWindow::sleep(unsigned long secs)
+void DrawingWindow::drawLines(const QLine *lines, const unsigned int *colors,
+                              int n)
 {
-    DrawingThread::sleep(secs);
+    if (n <= 0)
+        return;
+    if (recorder)
+        recorder->record(DrawingRecorder::DrawLines).put(n)
+            .putLines(lines, colors, n);
+    QRect r = boundingRect(lines, n);
+    safeLock(imageMutex);
+    QPen pen(painter->pen());
+    QColor color = pen.color();
+    for (int i = 0; i < n; i++) {
+        if (colors && (i == 0 || colors[i] != colors[i - 1])) {
+            pen.setColor(QColor::fromRgb(colors[i]));
+            painter->setPen(pen);
+        }
+        const QLine &l = lines[i];
+        // same workaround as in drawLine
+        if (l.p1() == l.p2())
+            painter->drawPoint(l.p1());
+        else
+            painter->drawLine(l);
+    }
+    if (colors) {
+        pen.setColor(color);
+        painter->setPen(pen);
+    }
+    dirty(r);
+    safeUnlock(imageMutex);
 }
 
-//! Suspend l'exécution pendant un certain temps.
+//! Écrit du texte.
 /*!
- * \param msecs          temps d'attente en millisecondes
+ * Écrit le texte text, aux coordonnées (x, y) et avec les paramètres
+ * d'alignement flags.  Le texte est écrit avec la couleur de dessin
+ * courante.  Les flags sont une combinaison (ou binaire) de
+ * Qt::AlignLeft, Qt::AligneRight, Qt::AlignHCenter, Qt::AlignTop,
+ * Qt::AlignBottom, Qt::AlignVCenter, Qt::AlignCenter.  Par défaut, le
+ * texte est aligné en haut à gauche.
+ *
+ * \param x, y          coordonnées du texte
+ * \param text          texte à écrire
+ * \param flags         paramètres d'alignement
+ *
+ * \see drawText(int, int, const std::string &, int)
+ * \see drawTextBg, setColor
+ * \see QPainter::drawText
  */
-void DrawingWindow::msleep(unsigned long msecs)
+void DrawingWindow::drawText(int x, int y, const char *text, int flags)
 {
-    DrawingThread::msleep(msecs);
+    if (recorder)
+        recorder->record(DrawingRecorder::DrawText)
+            .put(x).put(y).put(flags).putString(text);
+    safeLock(syncMutex);
+    if (!terminateThread) {
+        qApp->postEvent(this, new DrawTextEvent(x, y, text, flags));
+        syncCondition.wait(&syncMutex);
+    }
+    safeUnlock(syncMutex);
 }
 
-//! Suspend l'exécution pendant un certain temps.
+//! Écrit du texte.
 /*!
- * \param usecs          temps d'attente en microsecondes
+ * \see drawText(int, int, const char *, int)
  */
-void DrawingWindow::usleep(unsigned long usecs)
+void DrawingWindow::drawText(int x, int y, const std::string &text, int flags)
 {
-    DrawingThread::usleep(usecs);
+    drawText(x, y, text.c_str(), flags);
 }
 
-//--- DrawingWindow (protected methods) --------------------------------
-//! \cond show_protected
-
+//! Écrit du texte sur fond coloré.
 /*!
- * \see QWidget
+ * Écrit du texte comme drawText, mais l'arrière-plan est coloré avec
+ * la couleur de fond courante.
+ *
+ * \param x, y          coordonnées du texte
+ * \param text          texte à écrire
+ * \param flags         paramètres d'alignement
+ *
+ * \see drawTextBg(int, int, const std::string &, int)
+ * \see drawText, setColor, setColorBg
  */
-void DrawingWindow::closeEvent(QCloseEvent *ev)
+void DrawingWindow::drawTextBg(int x, int y, const char *text, int flags)
 {
-    timer.stop();
-    thread->exit();
-    syncMutex.lock();
-    inputMutex.lock();
-    terminateThread = true;     // this flag is needed for the case
-                                // where the following wakeAll() call
-                                // occurs between the
-                                // setTerminationEnable(false) and the
-                                // mutex lock in safeLock() called
-                                // from sync()
-    syncCondition.wakeAll();
-    inputCondition.wakeAll();
-    inputMutex.unlock();
-    syncMutex.unlock();
-    QWidget::closeEvent(ev);
-    if (!thread->wait(250)) {
-        thread->terminate();
-        thread->wait();
-    }
+    setBgMode(true);
+    drawText(x, y, text, flags);
+    setBgMode(false);
 }
 
+//! Écrit du texte sur fond coloré.
 /*!
- * \see QWidget
+ * \see drawTextBg(int, int, const char *, int)
  */
-void DrawingWindow::customEvent(QEvent *ev)
+void DrawingWindow::drawTextBg(int x, int y, const std::string &text, int flags)
 {
-    switch ((int )ev->type()) {
-    case SyncRequest:
-        realSync();
-        break;
-    case CloseRequest:
-        close();
-        break;
-    case DrawTextRequest:
-        DrawTextEvent *tev = dynamic_cast<DrawTextEvent *>(ev);
-        realDrawText(tev->x, tev->y, tev->text, tev->flags);
-        break;
-    }
+    drawTextBg(x, y, text.c_str(), flags);
 }
 
+//! Définit les coordonnées du monde.
 /*!
- * \see QWidget
+ * Après cet appel, les méthodes dont le nom contient "World"
+ * (drawWorldLine, worldToX, etc.) utilisent un repère où le
+ * rectangle [xmin, xmax] × [ymin, ymax] couvre toute la fenêtre :
+ * (xmin, ymax) est le coin en haut à gauche, et (xmax, ymin) le coin
+ * en bas à droite.  Contrairement aux coordonnées de la fenêtre,
+ * l'axe des ordonnées est donc orienté vers le haut.
  *
- * \bug                 expérimental
+ * La transformation est mémorisée sous forme d'un facteur d'échelle
+ * et d'un décalage par axe : une conversion ne coûte qu'une
+ * multiplication et une addition.  Elle est propre à la fonction de
+ * dessin et ne concerne pas les autres méthodes, qui travaillent
+ * toujours en pixels.
+ *
+ * \param xmin, xmax    abscisses des bords gauche et droit
+ * \param ymin, ymax    ordonnées des bords bas et haut
+ *
+ * \see resetWorld, translateWorld, scaleWorld, pushWorld
  */
-void DrawingWindow::mousePressEvent(QMouseEvent *ev)
+void DrawingWindow::setWorld(double xmin, double ymin,
+                             double xmax, double ymax)
 {
-    inputMutex.lock();
-    mousePos = ev->pos();
-    mouseButton = ev->button();
-    ev->accept();
-    inputCondition.wakeAll();
-    inputMutex.unlock();
+    if (xmin == xmax || ymin == ymax)
+        return;
+    world.scaleX = (width - 1) / (xmax - xmin);
+    world.scaleY = -(height - 1) / (ymax - ymin);
+    world.offsetX = -xmin * world.scaleX;
+    world.offsetY = -ymax * world.scaleY;
 }
 
+//! Revient aux coordonnées de la fenêtre.
 /*!
- * \see QWidget
+ * Les coordonnées du monde redeviennent celles de la fenêtre, en
+ * pixels.  C'est la transformation initiale.
+ *
+ * \see setWorld
  */
-void DrawingWindow::keyPressEvent(QKeyEvent *ev)
+void DrawingWindow::resetWorld()
 {
-    if (ev->key() == Qt::Key_Escape) {
-        ev->accept();
-        close();
-    }
+    world.scaleX = world.scaleY = 1.0;
+    world.offsetX = world.offsetY = 0.0;
 }
 
+//! Déplace l'origine des coordonnées du monde.
 /*!
- * \see QWidget
+ * Le point (dx, dy) du repère courant devient l'origine du nouveau
+ * repère.  Avec pushWorld et popWorld, cela permet de dessiner un
+ * objet dans son propre repère, puis de le placer où l'on veut.
+ *
+ * \param dx, dy        nouvelle origine, en coordonnées du monde
+ *
+ * \see setWorld, scaleWorld, pushWorld
  */
-void DrawingWindow::paintEvent(QPaintEvent *ev)
+void DrawingWindow::translateWorld(double dx, double dy)
 {
-    QPainter widgetPainter(this);
-    imageMutex.lock();
-    QImage imageCopy(*image);
-    imageMutex.unlock();
-    QRect rect = ev->rect();
-    widgetPainter.drawImage(rect, imageCopy, rect);
+    world.offsetX += world.scaleX * dx;
+    world.offsetY += world.scaleY * dy;
 }
 
+//! Change l'échelle des coordonnées du monde.
 /*!
- * \see QWidget
+ * Une unité du nouveau repère vaut kx (resp. ky) unités du repère
+ * courant, en abscisse (resp. en ordonnée).  L'origine ne bouge pas.
+ *
+ * \param kx, ky        facteurs d'échelle
+ *
+ * \see setWorld, translateWorld, pushWorld
  */
-void DrawingWindow::showEvent(QShowEvent *ev)
+void DrawingWindow::scaleWorld(double kx, double ky)
 {
-    QWidget::showEvent(ev);
-    qApp->flush();
-    qApp->syncX();
-    timer.start(paintInterval, this);
-    thread->start_once(QThread::IdlePriority);
+    world.scaleX *= kx;
+    world.scaleY *= ky;
 }
 
+//! Sauvegarde les coordonnées du monde courantes.
 /*!
- * \see QWidget
+ * Elles seront restaurées par l'appel correspondant à popWorld.  Les
+ * appels peuvent être imbriqués.
+ *
+ * \see popWorld
  */
-void DrawingWindow::timerEvent(QTimerEvent *ev)
+void DrawingWindow::pushWorld()
 {
-    if (ev->timerId() == timer.timerId()) {
-        mayUpdate();
-        timer.start(paintInterval, this);
-    } else {
-        QWidget::timerEvent(ev);
-    }
+    worldStack.push_back(world);
 }
 
-// \endcond
-
-//--- DrawingWindow (private methods) ----------------------------------
-
-//! Fonction d'initialisation.
+//! Restaure les coordonnées du monde sauvegardées.
 /*!
- * Fonction appelée par les différents constructeurs.
+ * Sans effet si aucune sauvegarde n'est en attente.
  *
- * \param fun           fonction de dessin
+ * \see pushWorld
  */
-void DrawingWindow::initialize(DrawingWindow::ThreadFunction fun)
+void DrawingWindow::popWorld()
 {
-    terminateThread = false;
-    lockCount = 0;
-    image = new QImage(width, height, QImage::Format_RGB32);
-    painter = new QPainter(image);
-    thread = new DrawingThread(*this, fun);
-
-    setFocusPolicy(Qt::StrongFocus);
-    setFixedSize(image->size());
-    setAttribute(Qt::WA_OpaquePaintEvent);
-    setFocus();
-
-    setColor("black");
-    setBgColor("white");
-    clearGraph();
-
-    dirtyFlag = false;
+    if (worldStack.empty())
+        return;
+    world = worldStack.back();
+    worldStack.pop_back();
 }
 
-//! Change la couleur de dessin.
+//! Convertit une abscisse du monde en abscisse de la fenêtre.
 /*!
- * \param color                 couleur
+ * Le résultat est arrondi au pixel le plus proche.
+ *
+ * \see setWorld, worldToY, xToWorld
  */
-inline
-void DrawingWindow::setColor(const QColor &color)
+int DrawingWindow::worldToX(double x) const
 {
-    QPen pen(painter->pen());
-    pen.setColor(color);
-    painter->setPen(pen);
+    return roundCoord(world.scaleX * x + world.offsetX);
 }
 
-//! Change la couleur de fond.
+//! Convertit une ordonnée du monde en ordonnée de la fenêtre.
 /*!
- * \param color                 couleur
+ * Le résultat est arrondi au pixel le plus proche.
+ *
+ * \see setWorld, worldToX, yToWorld
  */
-inline
-void DrawingWindow::setBgColor(const QColor &color)
+int DrawingWindow::worldToY(double y) const
 {
-    painter->setBackground(color);
+    return roundCoord(world.scaleY * y + world.offsetY);
 }
 
-//! Retourne la couleur de dessin courante.
+//! Convertit une abscisse de la fenêtre en abscisse du monde.
 /*!
- * \return              couleur de dessin courante
+ * \see setWorld, yToWorld, worldToX
  */
-inline
-QColor DrawingWindow::getColor()
+double DrawingWindow::xToWorld(int x) const
 {
-    return painter->pen().color();
+    return (x - world.offsetX) / world.scaleX;
 }
 
-//! Retourne la couleur de fond courante.
+//! Convertit une ordonnée de la fenêtre en ordonnée du monde.
 /*!
- * \return              couleur de fond courante
+ * \see setWorld, xToWorld, worldToY
  */
-inline
-QColor DrawingWindow::getBgColor()
+double DrawingWindow::yToWorld(int y) const
 {
-    return painter->background().color();
+    return (y - world.offsetY) / world.scaleY;
 }
 
-//! Verrouille un mutex.
+//! Convertit un tableau de points du monde en points de la fenêtre.
 /*!
- * S'assure que le thread courant ne peut pas être terminé s'il
- * détient un mutex.  Pendant de safeUnlock.
+ * Équivalent à appeler worldToX et worldToY pour chacun des points,
+ * mais en une seule passe, deux points à la fois avec SSE2.  Le
+ * résultat peut ensuite être passé à drawPolyline, par exemple.
  *
- * \param mutex         le mutex à verrouiller
+ * \param x, y          tableaux des coordonnées des points, dans le monde
+ * \param points        tableau des n points convertis
+ * \param n             nombre de points
  *
- * \see safeUnlock
+ * \see setWorld, worldToX, worldToY, drawWorldPolyline
  */
-inline
-void DrawingWindow::safeLock(QMutex &mutex)
+void DrawingWindow::worldToWindow(const double *x, const double *y,
+                                  QPoint *points, int n) const
 {
-    if (lockCount++ == 0)
-        thread->setTerminationEnabled(false);
-    mutex.lock();
+    int i = 0;
+    // Qt 4 stores QPoint as (y, x) on Mac OS
+#if defined(__SSE2__) && !defined(Q_OS_MAC)
+    const __m128d scaleX = _mm_set1_pd(world.scaleX);
+    const __m128d scaleY = _mm_set1_pd(world.scaleY);
+    const __m128d offsetX = _mm_set1_pd(world.offsetX);
+    const __m128d offsetY = _mm_set1_pd(world.offsetY);
+    const __m128d lo = _mm_set1_pd(-maxWindowCoord);
+    const __m128d hi = _mm_set1_pd(maxWindowCoord);
+    for (/* i */; i + 2 <= n; i += 2) {
+        __m128d vx = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(x + i), scaleX),
+                                offsetX);
+        __m128d vy = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(y + i), scaleY),
+                                offsetY);
+        // same clamping and rounding as roundCoord, NaN included
+        vx = _mm_min_pd(_mm_max_pd(vx, lo), hi);
+        vy = _mm_min_pd(_mm_max_pd(vy, lo), hi);
+        // x0 y0 x1 y1
+        const __m128i xy = _mm_unpacklo_epi32(_mm_cvtpd_epi32(vx),
+                                              _mm_cvtpd_epi32(vy));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(points + i), xy);
+    }
+#endif
+    for (/* i */; i < n; i++)
+        points[i] = QPoint(roundCoord(world.scaleX * x[i] + world.offsetX),
+                           roundCoord(world.scaleY * y[i] + world.offsetY));
 }
 
-//! Déverrouille un mutex.
+//! Dessine un point, en coordonnées du monde.
 /*!
- * S'assure que le thread courant ne peut pas être terminé s'il
- * détient un mutex.  Pendant de safeLock.
- *
- * \param mutex         le mutex à déverrouiller
- *
- * \see safeLock
+ * \see setWorld, drawPoint
  */
-inline
-void DrawingWindow::safeUnlock(QMutex &mutex)
+void DrawingWindow::drawWorldPoint(double x, double y)
 {
-    mutex.unlock();
-    if (--lockCount == 0)
-        thread->setTerminationEnabled(true);
+    drawPoint(worldToX(x), worldToY(y));
 }
 
-//! Marque l'image entière comme non à jour.
-inline
-void DrawingWindow::dirty()
+//! Dessine un segment, en coordonnées du monde.
+/*!
+ * \see setWorld, drawLine
+ */
+void DrawingWindow::drawWorldLine(double x1, double y1, double x2, double y2)
 {
-    dirtyFlag = true;
-    dirtyRect = image->rect();
+    drawLine(worldToX(x1), worldToY(y1), worldToX(x2), worldToY(y2));
 }
 
-//! Marque un point de l'image comme non à jour.
+//! Dessine un rectangle, en coordonnées du monde.
 /*!
- * \param x, y          coordonnées du point
+ * \see setWorld, drawRect
  */
-inline
-void DrawingWindow::dirty(int x, int y)
+void DrawingWindow::drawWorldRect(double x1, double y1, double x2, double y2)
 {
-    dirty(QRect(x, y, 1, 1));
+    drawRect(worldToX(x1), worldToY(y1), worldToX(x2), worldToY(y2));
 }
 
-//! Marque une zone de l'image comme non à jour.
+//! Dessine un rectangle plein, en coordonnées du monde.
 /*!
- * La zone est définie par un rectangle dont les coordonnées de deux
- * sommets oppposés sont données.
+ * \see setWorld, fillRect
+ */
+void DrawingWindow::fillWorldRect(double x1, double y1, double x2, double y2)
+{
+    fillRect(worldToX(x1), worldToY(y1), worldToX(x2), worldToY(y2));
+}
+
+//! Dessine un cercle, de centre donné en coordonnées du monde.
+/*!
+ * Le rayon r reste exprimé en pixels.
+ *
+ * \see setWorld, drawCircle
+ */
+void DrawingWindow::drawWorldCircle(double x, double y, int r)
+{
+    drawCircle(worldToX(x), worldToY(y), r);
+}
+
+//! Dessine un disque, de centre donné en coordonnées du monde.
+/*!
+ * Le rayon r reste exprimé en pixels.
+ *
+ * \see setWorld, fillCircle
+ */
+void DrawingWindow::fillWorldCircle(double x, double y, int r)
+{
+    fillCircle(worldToX(x), worldToY(y), r);
+}
+
+//! Dessine un triangle, en coordonnées du monde.
+/*!
+ * \see setWorld, drawTriangle
+ */
+void DrawingWindow::drawWorldTriangle(double x1, double y1,
+                                      double x2, double y2,
+                                      double x3, double y3)
+{
+    drawTriangle(worldToX(x1), worldToY(y1), worldToX(x2), worldToY(y2),
+                 worldToX(x3), worldToY(y3));
+}
+
+//! Dessine un triangle plein, en coordonnées du monde.
+/*!
+ * \see setWorld, fillTriangle
+ */
+void DrawingWindow::fillWorldTriangle(double x1, double y1,
+                                      double x2, double y2,
+                                      double x3, double y3)
+{
+    fillTriangle(worldToX(x1), worldToY(y1), worldToX(x2), worldToY(y2),
+                 worldToX(x3), worldToY(y3));
+}
+
+//! Dessine une ligne brisée, en coordonnées du monde.
+/*!
+ * Les n sommets sont convertis en une seule passe (voir
+ * worldToWindow), puis dessinés comme par drawPolyline.
+ *
+ * \param x, y          tableaux des coordonnées des sommets, dans le monde
+ * \param n             nombre de sommets
+ *
+ * \see setWorld, drawPolyline, worldToWindow
+ */
+void DrawingWindow::drawWorldPolyline(const double *x, const double *y, int n)
+{
+    if (n <= 0)
+        return;
+    worldPoints.resize(n);
+    worldToWindow(x, y, &worldPoints[0], n);
+    drawPolyline(&worldPoints[0], n);
+}
+
+//! Retourne la couleur d'un pixel.
+/*!
+ * Retourne la couleur du pixel de coordonnées (x, y), dans la couche
+ * courante.  La valeur
+ * retournée peut servir de paramètres à setColor(unsigned int) ou
+ * setBgColor(unsigned int).
+ *
+ * \param x, y          coordonnées du pixel
+ * \return              couleur du pixel
+ *
+ * \see setColor(unsigned int), setBgColor(unsigned int)
+ */
+unsigned int DrawingWindow::getPointColor(int x, int y) const
+{
+    return image->pixel(supersampling * x, supersampling * y);
+}
+
+//! Sauvegarde une zone de la fenêtre.
+/*!
+ * Copie le contenu du rectangle défini par les coordonnées de deux
+ * sommets opposés (x1, y1) et (x2, y2), dans la couche courante.  Le
+ * contenu pourra être remis en place par restoreArea.
+ *
+ * C'est la technique classique pour animer un petit objet : on
+ * sauvegarde la zone avant de dessiner l'objet, puis on la restaure
+ * pour l'effacer.  Les tampons de sauvegarde sont recyclés : une
+ * fois le régime établi, aucune allocation mémoire n'est faite.
  *
  * \param x1, y1        coordonnées d'un sommet du rectangle
  * \param x2, y2        coordonnées du sommet opposé du rectangle
+ * \return              identifiant de la sauvegarde
+ *
+ * \see restoreArea
  */
-inline
-void DrawingWindow::dirty(int x1, int y1, int x2, int y2)
+int DrawingWindow::saveArea(int x1, int y1, int x2, int y2)
 {
+    int area;
+    if (freeAreas.empty()) {
+        area = savedAreas.size();
+        savedAreas.push_back(SavedArea());
+    } else {
+        area = freeAreas.back();
+        freeAreas.pop_back();
+    }
+    SavedArea &saved = savedAreas[area];
     QRect r;
     r.setCoords(x1, y1, x2, y2);
-    dirty(r.normalized());
+    r = r.normalized() & QRect(0, 0, width, height);
+    saved.used = true;
+    saved.layer = layer;
+    saved.rect = r;
+    if (!r.isEmpty()) {
+        const QRect d = deviceRect(r);
+        saved.pixels.resize(d.width() * d.height());
+        safeLock(imageMutex);
+        QRgb *dest = &saved.pixels[0];
+        for (int y = d.top(); y <= d.bottom(); y++) {
+            std::memcpy(dest, scanLine(image, y) + d.left(),
+                        d.width() * sizeof(QRgb));
+            dest += d.width();
+        }
+        safeUnlock(imageMutex);
+    }
+    if (recorder)
+        recorder->record(DrawingRecorder::SaveArea)
+            .put(x1).put(y1).put(x2).put(y2).put(area);
+    return area;
 }
 
-//! Marque une zone de l'image comme non à jour.
+//! Restaure une zone sauvegardée.
 /*!
- * \param rect          rectangle délimitant la zone
+ * Remet en place, dans la couche où elle a été prise, une zone
+ * sauvegardée par saveArea.  L'identifiant de sauvegarde est ensuite
+ * libéré, et ne doit plus être utilisé : un identifiant déjà libéré
+ * est ignoré, avec un avertissement.
+ *
+ * \param area          identifiant retourné par saveArea
+ *
+ * \see saveArea
  */
-void DrawingWindow::dirty(const QRect &rect)
+void DrawingWindow::restoreArea(int area)
 {
-    if (dirtyFlag) {
-        dirtyRect |= rect;
-    } else {
-        dirtyFlag = true;
-        dirtyRect = rect;
+    if (area < 0 || area >= (int )savedAreas.size())
+        return;
+    // freeing a handle twice would give it to two later saveArea
+    if (!savedAreas[area].used) {
+        qWarning("DrawingWindow: area %d already restored", area);
+        return;
+    }
+    if (recorder)
+        recorder->record(DrawingRecorder::RestoreArea).put(area);
+    SavedArea &saved = savedAreas[area];
+    const QRect &r = saved.rect;
+    const QRect d = deviceRect(r);
+    // nothing to restore if the supersampling changed in between
+    if (!r.isEmpty()
+        && saved.pixels.size() == unsigned(d.width() * d.height())) {
+        safeLock(imageMutex);
+        const QRgb *src = &saved.pixels[0];
+        for (int y = d.top(); y <= d.bottom(); y++) {
+            std::memcpy(scanLine(layers[saved.layer], y) + d.left(), src,
+                        d.width() * sizeof(QRgb));
+            src += d.width();
+        }
+        if (saved.layer > 0)
+            layerRects[saved.layer] |= r;
+        dirty(r);
+        safeUnlock(imageMutex);
     }
+    saved.used = false;
+    freeAreas.push_back(area);
 }
 
-//! Génère un update si besoin.
+//! Enregistre le contenu de la fenêtre dans un fichier, en arrière-plan.
 /*!
- * Génère une demande de mise à jour de la fenêtre (appel à update)
- * s'il y en a besoin.
+ * Les couches sont recopiées (une simple recopie mémoire), puis
+ * superposées et compressées par un thread du pool global de
+ * QtConcurrent : la fonction de dessin peut continuer aussitôt.  Le
+ * QFuture retourné permet d'attendre le résultat (result) ou de
+ * savoir si l'enregistrement est terminé (isFinished).
+ *
+ * Au plus maxPendingSaves enregistrements peuvent être en cours pour
+ * une fenêtre : au-delà, l'appel attend que l'un d'eux se termine.
+ * La destruction de la fenêtre attend aussi les enregistrements en
+ * cours, au plus saveTimeout ms.
+ *
+ * \param fileName      nom du fichier
+ * \param format        format de l'image ("PNG", "JPG"...), déduit
+ *                      de l'extension du nom de fichier si NULL
+ * \return              résultat futur : true si l'image a été
+ *                      enregistrée
+ *
+ * \see QImage::save
  */
-void DrawingWindow::mayUpdate()
+QFuture<bool> DrawingWindow::saveImageAsync(const char *fileName,
+                                            const char *format)
 {
-    imageMutex.lock();
-    bool dirty = dirtyFlag;
-    QRect rect = dirtyRect;
-    dirtyFlag = false;
-    imageMutex.unlock();
-    if (dirty)
-        update(rect);
+    std::vector<QImage> snapshot;
+    safeLock(imageMutex);
+    // the presented layers may lag behind the drawing by one frame
+    if (dirtyFlag && supersampling > 1)
+        resolve(dirtyRect);
+    // deep copies: the painters write into the shared pixels without
+    // detaching, a shallow copy would change under the compression
+    snapshot.push_back(presentedLayer(0)->copy());
+    for (int i = 1; i < MAX_LAYERS; i++) {
+        if (layers[i] && !layerRects[i].isEmpty())
+            snapshot.push_back(presentedLayer(i)->copy());
+    }
+    safeUnlock(imageMutex);
+    // backpressure: wait for one of the pending saves, if too many;
+    // only after safeLock, which throws when the window is closing
+    saveSlots->acquire();
+    return QtConcurrent::run(saveSnapshot, snapshot,
+                             QString::fromLocal8Bit(fileName),
+                             QByteArray(format), saveSlots);
 }
 
-//! Fonction bas-niveau pour sync.
+//! Affiche une partie d'un canevas.
 /*!
- * Fonction de synchronisation dans le thread principal.
+ * Recopie dans la couche courante la zone du canevas de la taille de
+ * la fenêtre, dont le coin en haut à gauche est (x, y).  Les parties
+ * hors du canevas, ou jamais dessinées, ont la couleur de fond du
+ * canevas.  Les carreaux évincés sont relus.
  *
- * \see sync, customEvent
+ * En faisant varier (x, y), la fenêtre se déplace sur le canevas.
+ *
+ * \param canvas        canevas à afficher
+ * \param x, y          position de la fenêtre dans le canevas
+ *
+ * \see DrawingCanvas
  */
-void DrawingWindow::realSync()
+void DrawingWindow::drawCanvas(DrawingCanvas &canvas, int x, int y)
 {
-    mayUpdate();
-    qApp->sendPostedEvents(this, QEvent::UpdateLater);
-    qApp->sendPostedEvents(this, QEvent::UpdateRequest);
-    qApp->sendPostedEvents(this, QEvent::Paint);
-    qApp->processEvents(QEventLoop::ExcludeUserInputEvents |
-                        QEventLoop::ExcludeSocketNotifiers |
-                        QEventLoop::DeferredDeletion |
-                        QEventLoop::X11ExcludeTimers);
-    qApp->flush();
-    qApp->syncX();
-    syncMutex.lock();
-    syncCondition.wakeAll();
-    syncMutex.unlock();
+    const int T = DrawingCanvas::TILE_SIZE;
+    const int f = supersampling;
+    const int stride = getPixelStride();
+    unsigned int *pixels = lockPixels();
+    for (int wy = 0; wy < height; wy++) {
+        const int cy = y + wy;
+        QRgb *dest = pixels + f * wy * stride;
+        int wx = 0;
+        while (wx < width) {
+            const int cx = x + wx;
+            // run of pixels within one tile, or outside the canvas
+            int n;
+            const QRgb *src = NULL;
+            if (cy < 0 || cy >= canvas.height
+                || cx < 0 || cx >= canvas.width) {
+                n = cx < 0 ? qMin(-cx, width - wx) : width - wx;
+            } else {
+                n = qMin(T - cx % T, qMin(canvas.width - cx, width - wx));
+                const int i = (cy / T) * canvas.tilesX + cx / T;
+                const DrawingCanvas::Tile &t = canvas.tiles[i];
+                if (t.image || t.slot >= 0)
+                    src = scanLine(canvas.tile(i), cy % T) + cx % T;
+            }
+            for (int k = 0; k < n; k++) {
+                const QRgb c = src ? src[k] : canvas.bgColor;
+                for (int j = 0; j < f; j++)
+                    dest[f * (wx + k) + j] = c;
+            }
+            wx += n;
+        }
+        // supersampled: the other lines of the block are copies
+        for (int j = 1; j < f; j++)
+            std::memcpy(dest + j * stride, dest, stride * sizeof(QRgb));
+    }
+    unlockPixels();
 }
 
-//! Fonction bas-niveau pour drawText.
+//! Donne un accès direct aux pixels.
 /*!
- * Le rendu de texte doit être fait dans le thread principal.  D'où
- * les manipulations tordues et la synchronisation qui s'en suit.
+ * Retourne l'adresse du premier pixel de la couche courante.  Les
+ * pixels sont rangés ligne par ligne, chaque ligne comportant
+ * exactement getPixelStride() pixels : le pixel (x, y) est donc à
+ * l'indice y * getPixelStride() + x.  Sans suréchantillonnage, c'est
+ * width.  Chaque pixel est de la forme #AARRGGBB, l'octet alpha étant
+ * ignoré pour la couche 0.  Pour les couches supérieures, les
+ * composantes doivent être prémultipliées par alpha.
  *
- * \param x, y, text, flags     cf. drawText
+ * Avec un facteur de suréchantillonnage f (voir setSupersampling),
+ * le tampon est f fois plus grand dans chaque direction : le pixel
+ * (x, y) de la fenêtre correspond au bloc de f × f pixels dont le
+ * coin est à l'indice f * (y * getPixelStride() + x).  Pour dessiner
+ * à la résolution de la fenêtre, il faut remplir tout le bloc.
  *
- * \see drawText, customEvent
+ * C'est le moyen le plus rapide de produire une image calculée point
+ * par point : il n'y a aucun appel de fonction par pixel.  Les pixels
+ * peuvent être écrits par plusieurs threads en même temps, par
+ * exemple un par bande de lignes.
+ *
+ * Le tampon est verrouillé jusqu'à l'appel à unlockPixels, qui doit
+ * être fait le plus tôt possible, depuis le même thread.  Entre les
+ * deux, aucune autre méthode de dessin ne doit être appelée.
+ *
+ * \return              adresse du premier pixel
+ *
+ * \see getPixelStride, unlockPixels
  */
-void DrawingWindow::realDrawText(int x, int y, const char *text, int flags)
+unsigned int *DrawingWindow::lockPixels()
 {
-    QRect r(image->rect());
-    switch (flags & Qt::AlignHorizontal_Mask) {
-    case Qt::AlignRight:
-        r.setRight(x);
-        break;
-    case Qt::AlignHCenter:
-        if (x < width / 2)
-            r.setLeft(2 * x - width + 1);
-        else
-            r.setRight(2 * x);
-        break;
-    default:
-        r.setLeft(x);
-    }
-    switch (flags & Qt::AlignVertical_Mask) {
-    case Qt::AlignBottom:
-        r.setBottom(y);
-        break;
-    case Qt::AlignVCenter:
-        if (y < height / 2)
-            r.setTop(2 * y - height + 1);
-        else
-            r.setBottom(2 * y);
-        break;
-    default:
-        r.setTop(y);
-    }
-    syncMutex.lock();
-    painter->drawText(r, flags, QString::fromUtf8(text), &r);
-    dirty(r);
-    syncCondition.wakeAll();
-    syncMutex.unlock();
+    safeLock(imageMutex);
+    // recording: unlockPixels only records what changed since now
+    if (recorder)
+        recorder->keepPixels(scanLine(image, 0),
+                             image->width() * image->height());
+    return scanLine(image, 0);
 }
 
-//--- DrawingThread ----------------------------------------------------
+//! Retourne le nombre de pixels par ligne du tampon de lockPixels.
+/*!
+ * C'est getSupersampling() * width.
+ *
+ * \see lockPixels, getSupersampling
+ */
+int DrawingWindow::getPixelStride() const
+{
+    return supersampling * width;
+}
 
-//! Constructeur.
-DrawingThread::DrawingThread(DrawingWindow &w, DrawingWindow::ThreadFunction f)
-    : drawingWindow(w)
-    , threadFunction(f)
-    , started_once(false)
+//! Rend l'accès aux pixels.
+/*!
+ * Toute la fenêtre sera mise à jour.
+ *
+ * \see lockPixels, unlockPixels(int, int, int, int)
+ */
+void DrawingWindow::unlockPixels()
 {
+    if (recorder)
+        recordPixels(QRect(0, 0, width, height));
+    dirty();
+    safeUnlock(imageMutex);
 }
 
-//! Démarre le thread si ce n'a pas encore été fait.
-void DrawingThread::start_once(Priority priority)
+//! Rend l'accès aux pixels.
+/*!
+ * Seul le rectangle défini par les coordonnées de deux sommets
+ * opposés (x1, y1) et (x2, y2) a été modifié, et sera mis à jour.
+ * Ces coordonnées sont celles de la fenêtre, même avec
+ * suréchantillonnage : le rectangle couvre alors les blocs de pixels
+ * correspondants du tampon.
+ *
+ * \param x1, y1        coordonnées d'un sommet du rectangle
+ * \param x2, y2        coordonnées du sommet opposé du rectangle
+ *
+ * \see lockPixels, unlockPixels()
+ */
+void DrawingWindow::unlockPixels(int x1, int y1, int x2, int y2)
 {
-    if (!started_once) {
-        started_once = true;
-        start(priority);
+    if (recorder) {
+        QRect r;
+        r.setCoords(x1, y1, x2, y2);
+        recordPixels(r.normalized());
     }
+    dirty(x1, y1, x2, y2);
+    safeUnlock(imageMutex);
 }
 
-//! La vraie fonction pour le thread.
-void DrawingThread::run()
+//! Attend l'appui sur un des boutons de la souris.
+/*!
+ * Attend l'appui sur un des boutons de la souris.  Retourne le bouton
+ * qui a été pressé et les coordonnées du pointeur de souris à ce
+ * moment-là.
+ *
+ * Avec HeadlessBackend, aucun clic ne peut arriver : la méthode
+ * retourne aussitôt false, sans attendre.
+ *
+ * \param x, y          coordonnées du pointeur de souris, dans
+ *                      l'image (même si la vue est agrandie)
+ * \param button        numéro du bouton qui a été pressé
+ *                      (1: gauche, 2: droit, 3: milieu, 0 sinon)
+ * \param time          durée maximale de l'attente
+ * \return              true si un bouton a été pressé
+ *
+ * \bug                 expérimental
+ */
+bool DrawingWindow::waitMousePress(int &x, int &y, int &button,
+                                   unsigned long time)
+{
+    bool pressed;
+    safeLock(inputMutex);
+    // headless: the window is never shown, no click can ever come
+    if (terminateThread || backendType == HeadlessBackend) {
+        pressed = false;
+    } else {
+        pressed = inputCondition.wait(&inputMutex, time) && !terminateThread;
+        if (pressed) {
+            x = mousePos.x();
+            y = mousePos.y();
+            if (mouseButton & Qt::LeftButton)
+                button = 1;
+            else if (mouseButton & Qt::RightButton)
+                button = 2;
+            else if (mouseButton & Qt::MidButton)
+                button = 3;
+            else
+                button = 0;
+        }
+    }
+    safeUnlock(inputMutex);
+    if (recorder) {
+        recorder->record(DrawingRecorder::MousePress).put(int(pressed));
+        if (pressed)
+            recorder->put(x).put(y).put(button);
+    }
+    return pressed;
+}
+
+//! Synchronise le contenu de la fenêtre.
+/*!
+ * Pour des raisons d'efficacités, le résultat des fonctions de dessin
+ * n'est pas affiché immédiatement.  L'appel à sync permet de
+ * synchroniser le contenu de la fenêtre.  Autrement dit, cela bloque
+ * l'exécution du programme jusqu'à ce que le contenu de la fenêtre
+ * soit à jour.
+ *
+ * \param time          durée maximale de l'attente
+ * \return              true si la fenêtre a pu être synchronisée
+ */
+bool DrawingWindow::sync(unsigned long time)
 {
-    threadFunction(drawingWindow);
+    if (recorder)
+        recorder->record(DrawingRecorder::Sync);
+    bool synced;
+    safeLock(syncMutex);
+    if (terminateThread) {
+        synced = false;
+    } else {
+        qApp->postEvent(this, new SyncRequestEvent());
+        synced = syncCondition.wait(&syncMutex, time);
+    }
+    safeUnlock(syncMutex);
+    return synced;
 }
+
+//! Attend la prochaine trame.
+/*!
+ * Bloque l'exécution jusqu'au prochain rendu de la fenêtre.  Une
+ * animation rythmée par waitNextFrame, plutôt que par msleep, est
+ * calée sur l'affichage : on ne dessine pas d'images qui ne seraient
+ * jamais montrées, et la cadence ne dépend pas du temps passé à
+ * dessiner.  Typiquement :
+ *
+ * \code
+ * while (...) {
+ *     for (int n = w.frameSteps(dt); n > 0; n--)
+ *         ... // avancer la simulation d'un pas de durée dt
+ *     ... // dessiner l'état courant
+ *     w.waitNextFrame();
+ * }
+ * \endcode
+ *
+ * \param time          durée maximale de l'attente
+ * \return              true si une nouvelle trame a eu lieu
+ *
+ * \see frameTime, frameSteps, setFrameRate
+ */
+bool DrawingWindow::waitNextFrame(unsigned long time)
+{
+    bool framed;
+    safeLock(syncMutex);
+    if (terminateThread) {
+        framed = false;
+    } else {
+        requestPresent();
+        framed = frameCondition.wait(&syncMutex, time) && !terminateThread;
+        currentFrameTime = frameTimestamp / 1000.0;
+    }
+    safeUnlock(syncMutex);
+    if (recorder)
+        recorder->record(DrawingRecorder::NextFrame);
+    return framed;
+}
+
+//! Retourne la date de la trame courante.
+/*!
+ * C'est la date, en secondes depuis l'affichage de la fenêtre, du
+ * rendu attendu lors du dernier appel à waitNextFrame.
+ *
+ * \see waitNextFrame
+ */
+double DrawingWindow::frameTime() const
+{
+    return currentFrameTime;
+}
+
+//! Nombre de pas de simulation à effectuer pour la trame courante.
+/*!
+ * Permet d'animer une simulation à pas de temps fixe, indépendamment
+ * de la cadence d'affichage.  Retourne le nombre de pas de durée step
+ * nécessaires pour que le temps simulé rattrape la date de la trame
+ * courante (cf. frameTime).  Le reliquat est conservé pour l'appel
+ * suivant.
+ *
+ * Si le retard est trop important (par exemple après une longue
+ * pause), seules les dernières maxFrameLag secondes sont rattrapées.
+ *
+ * \param step          durée d'un pas de simulation (s), strictement
+ *                      positive : sinon, rien n'est à faire et le
+ *                      résultat est 0
+ * \return              nombre de pas à effectuer, au plus INT_MAX
+ *
+ * \see waitNextFrame, frameTime
+ */
+int DrawingWindow::frameSteps(double step)
+{
+    if (!(step > 0.0))                  // also rejects NaN
+        return 0;
+    if (currentFrameTime - stepTime > maxFrameLag)
+        stepTime = currentFrameTime - maxFrameLag;
+    // a tiny step must not overflow the conversion to int
+    const double steps = (currentFrameTime - stepTime) / step;
+    const int n = steps < INT_MAX ? (int )steps : INT_MAX;
+    stepTime += n * step;
+    return n;
+}
+
+//! Change la cadence maximale des rendus.
+/*!
+ * Une modification de l'image est affichée dès que possible, mais pas
+ * plus souvent que fps fois par seconde ; c'est aussi la cadence de
+ * waitNextFrame.  Sans modification ni attente de trame, la fenêtre
+ * ne fait aucun rendu.  Au-delà de la fréquence de l'écran, des
+ * trames sont rendues sans être vues.
+ *
+ * En mode partagé, la cadence est fixe, commune à toutes les fenêtres
+ * (voir setSharedMode).
+ *
+ * \param fps           nombre de rendus par seconde, ou 0 pour la
+ *                      cadence par défaut (30)
+ *
+ * \see getFrameRate
+ */
+void DrawingWindow::setFrameRate(double fps)
+{
+    frameInterval = fps > 0.0 ? qBound(1, qRound(1000.0 / fps), 1000)
+                              : paintInterval;
+}
+
+//! Retourne la cadence maximale des rendus.
+/*!
+ * \see setFrameRate
+ */
+double DrawingWindow::getFrameRate() const
+{
+    return 1000.0 / frameInterval;
+}
+
+//! Retourne un quantile de la latence d'affichage.
+/*!
+ * La latence est mesurée, pour chaque rendu, entre la première
+ * modification de l'image qu'il affiche et la fin de son affichage
+ * par la méthode d'affichage (voir setDefaultBackend).  Les mesures
+ * sont gardées dans un histogramme, précis à 3 % près.
+ *
+ * Par exemple, getLatency(0.5) est la médiane, getLatency(0.99) le
+ * 99e centile, et getLatency(1.0) le maximum.
+ *
+ * \param quantile      quantile, entre 0 et 1
+ * \return              latence (ms), 0 si aucun rendu n'a été mesuré
+ *
+ * \see getLatencyCount, resetLatency, setLatencyOverlay
+ */
+double DrawingWindow::getLatency(double quantile) const
+{
+    return latency->quantile(quantile);
+}
+
+//! Retourne le nombre de rendus mesurés.
+/*!
+ * \see getLatency
+ */
+int DrawingWindow::getLatencyCount() const
+{
+    return latency->count();
+}
+
+//! Oublie les mesures de latence.
+/*!
+ * Par exemple pour ne mesurer qu'une phase de l'animation.
+ *
+ * \see getLatency
+ */
+void DrawingWindow::resetLatency()
+{
+    latency->reset();
+}
+
+//! Affiche ou non la latence en bas de la fenêtre.
+/*!
+ * Médiane, 99e centile et maximum sont affichés par dessus l'image,
+ * mis à jour à chaque rendu.  Seulement avec RasterBackend.
+ *
+ * \param state         true pour afficher
+ *
+ * \see getLatency
+ */
+void DrawingWindow::setLatencyOverlay(bool state)
+{
+    latencyOverlay = state;
+    requestPresent();
+}
+
+//! Ferme la fenêtre graphique.
+void DrawingWindow::closeGraph()
+{
+    if (recorder)
+        recorder->record(DrawingRecorder::Close);
+    qApp->postEvent(this, new CloseRequestEvent());
+}
+
+//! Suspend l'exécution pendant un certain temps.
+/*!
+ * \param secs          temps d'attente en seconde
+ */
+void DrawingWindow::sleep(unsigned long secs)
+{
+    DrawingThread::sleep(secs);
+}
+
+//! Suspend l'exécution pendant un certain temps.
+/*!
+ * \param msecs          temps d'attente en millisecondes
+ */
+void DrawingWindow::msleep(unsigned long msecs)
+{
+    DrawingThread::msleep(msecs);
+}
+
+//! Suspend l'exécution pendant un certain temps.
+/*!
+ * \param usecs          temps d'attente en microsecondes
+ */
+void DrawingWindow::usleep(unsigned long usecs)
+{
+    DrawingThread::usleep(usecs);
+}
+
+//! Active ou désactive le mode partagé.
+/*!
+ * Par défaut, chaque fenêtre a son propre thread pour la fonction de
+ * dessin, et son propre timer pour le rendu.  En mode partagé, les
+ * fonctions de dessin sont exécutées par un ensemble de maxThreads
+ * threads, commun à toutes les fenêtres, et un seul timer fait le
+ * rendu de toutes les fenêtres à mettre à jour.
+ *
+ * S'il y a plus de fenêtres que de threads, les fonctions de dessin
+ * en trop ne démarrent que lorsqu'une autre fonction est terminée.
+ *
+ * Le mode ne concerne que les fenêtres créées par la suite.
+ *
+ * \param state         true pour activer le mode partagé
+ * \param maxThreads    nombre maximal de threads de dessin
+ *                      (0 : un par processeur)
+ */
+void DrawingWindow::setSharedMode(bool state, int maxThreads)
+{
+    sharedMode = state;
+    sharedThreads = maxThreads;
+    if (state && qApp)
+        DrawingPresenter::instance()->threadPool().setMaxThreadCount(
+            maxThreads > 0 ? maxThreads : QThread::idealThreadCount());
+}
+
+//! Retourne vrai si le mode partagé est actif.
+/*!
+ * \see setSharedMode
+ */
+bool DrawingWindow::getSharedMode()
+{
+    return sharedMode;
+}
+
+//! Change la méthode d'affichage par défaut.
+/*!
+ * La méthode d'affichage ne concerne que les fenêtres créées par la
+ * suite.  Sans appel à cette méthode, elle est donnée par la variable
+ * d'environnement DRAWINGWINDOW_BACKEND : "raster", "opengl", "xshm"
+ * ou "headless", ce qui permet de les comparer sans recompiler.
+ *
+ * - RasterBackend : dessin de l'image par QPainter, dans paintEvent.
+ * - OpenGLBackend : la zone modifiée de l'image est recopiée dans une
+ *   texture OpenGL, affichée par la carte graphique (ou par Mesa
+ *   llvmpipe, à défaut).  Il faut compiler avec DRAWINGWINDOW_OPENGL
+ *   défini, et le module opengl de Qt (QT += opengl).
+ * - XShmBackend : l'image est recopiée dans une image X11 en mémoire
+ *   partagée avec le serveur X, qui l'affiche sans autre copie.  Il
+ *   faut compiler avec DRAWINGWINDOW_XSHM défini, et la bibliothèque
+ *   Xext (LIBS += -lXext).  Le serveur X doit être local.
+ * - HeadlessBackend : rien n'est affiché, et la fenêtre n'apparaît pas
+ *   à l'écran ; le dessin se fait normalement dans l'image, pour
+ *   exécuter des programmes par lots, ou pour l'export des trames.  Un
+ *   serveur X reste nécessaire à Qt (Xvfb convient).  Comme aucun clic
+ *   ne peut arriver, waitMousePress retourne aussitôt false.
+ *
+ * Une méthode indisponible est remplacée par RasterBackend.
+ *
+ * \param backend       méthode d'affichage
+ *
+ * \see getBackend
+ */
+void DrawingWindow::setDefaultBackend(Backend backend)
+{
+    defaultBackend = backend;
+}
+
+//! Retourne la méthode d'affichage par défaut.
+/*!
+ * \see setDefaultBackend
+ */
+DrawingWindow::Backend DrawingWindow::getDefaultBackend()
+{
+    if (defaultBackend < 0) {
+        const char *env = getenv("DRAWINGWINDOW_BACKEND");
+        if (env && strcmp(env, "opengl") == 0)
+            defaultBackend = OpenGLBackend;
+        else if (env && strcmp(env, "xshm") == 0)
+            defaultBackend = XShmBackend;
+        else if (env && strcmp(env, "headless") == 0)
+            defaultBackend = HeadlessBackend;
+        else
+            defaultBackend = RasterBackend;
+    }
+    return static_cast<Backend>(defaultBackend);
+}
+
+//! Retourne la méthode d'affichage de la fenêtre.
+/*!
+ * C'est la méthode par défaut lors de la création de la fenêtre, ou
+ * RasterBackend si elle n'était pas disponible.
+ *
+ * \see setDefaultBackend
+ */
+DrawingWindow::Backend DrawingWindow::getBackend() const
+{
+    return backendType;
+}
+
+//! Rejoue un enregistrement.
+/*!
+ * Exécute, dans la fenêtre w, les appels enregistrés dans le fichier
+ * fileName (voir la variable d'environnement DRAWINGWINDOW_RECORD,
+ * dans la description de la classe).  Doit être appelé depuis la
+ * fonction de dessin de w, dont la taille doit être celle de la
+ * fenêtre enregistrée (voir getRecordSize).
+ *
+ * Les attentes d'évènements (waitMousePress, waitNextFrame) ne sont
+ * pas rejouées : leur résultat est déjà contenu dans les appels qui
+ * suivent.  Les appels à sync le sont.  Sans realTime, les appels
+ * s'enchaînent aussi vite que possible, ce qui permet de mesurer le
+ * coût du dessin seul.  Avec realTime, chaque appel est fait à la
+ * même date, relativement au début, que lors de l'enregistrement.
+ *
+ * \param w             fenêtre de dessin
+ * \param fileName      nom du fichier d'enregistrement
+ * \param realTime      respect des dates enregistrées
+ * \return              false si le fichier est illisible ou tronqué
+ *
+ * \see getRecordSize
+ */
+bool DrawingWindow::replay(DrawingWindow &w, const char *fileName,
+                           bool realTime)
+{
+    DrawingRecordReader in(fileName);
+    if (!in.isValid() || in.width != w.width || in.height != w.height)
+        return false;
+
+    std::vector<QPoint> points;
+    std::vector<QLine> lines;
+    std::vector<unsigned int> colors;
+    std::vector<int> areas;     // recorded identifier -> new identifier
+    QElapsedTimer clock;
+    clock.start();
+    qint64 time = 0;            // date of the command (us)
+    bool closed = false;
+    while (!closed && !in.atEnd() && in.isValid()) {
+        int command = in.getCommand(time);
+        if (realTime) {
+            qint64 ahead = time - clock.nsecsElapsed() / 1000;
+            if (ahead > 0)
+                usleep(ahead);
+        }
+        switch (command) {
+        case DrawingRecorder::SetColor:
+            w.setColor(QColor::fromRgba(in.getColor()));
+            break;
+        case DrawingRecorder::SetBgColor:
+            w.setBgColor(QColor::fromRgba(in.getColor()));
+            break;
+        case DrawingRecorder::SetPenWidth:
+            w.setPenWidth(in.getInt());
+            break;
+        case DrawingRecorder::SetFont: {
+            QFont font;
+            font.fromString(QString::fromUtf8(in.getString().constData()));
+            w.setFont(font);
+            break;
+        }
+        case DrawingRecorder::SetAntialiasing:
+            w.setAntialiasing(in.getInt());
+            break;
+        case DrawingRecorder::SetSupersampling:
+            w.setSupersampling(in.getInt());
+            break;
+        case DrawingRecorder::SetBrush:
+            w.setBrush(in.getInt());
+            break;
+        case DrawingRecorder::SetBgMode:
+            w.setBgMode(in.getInt());
+            break;
+        case DrawingRecorder::ClearGraph:
+            w.clearGraph();
+            break;
+        case DrawingRecorder::SetLayer:
+            w.setLayer(in.getInt());
+            break;
+        case DrawingRecorder::ClearLayer:
+            w.clearLayer();
+            break;
+        case DrawingRecorder::DrawPoint: {
+            int x = in.getInt();
+            int y = in.getInt();
+            w.drawPoint(x, y);
+            break;
+        }
+        case DrawingRecorder::DrawLine: {
+            int c[4];
+            in.getInts(c, 4);
+            w.drawLine(c[0], c[1], c[2], c[3]);
+            break;
+        }
+        case DrawingRecorder::DrawRect: {
+            int c[4];
+            in.getInts(c, 4);
+            w.drawRect(c[0], c[1], c[2], c[3]);
+            break;
+        }
+        case DrawingRecorder::DrawCircle: {
+            int c[3];
+            in.getInts(c, 3);
+            w.drawCircle(c[0], c[1], c[2]);
+            break;
+        }
+        case DrawingRecorder::DrawTriangle: {
+            int c[6];
+            in.getInts(c, 6);
+            w.drawTriangle(c[0], c[1], c[2], c[3], c[4], c[5]);
+            break;
+        }
+        case DrawingRecorder::DrawPointF: {
+            double c[2];
+            in.getDoubles(c, 2);
+            w.drawPointF(c[0], c[1]);
+            break;
+        }
+        case DrawingRecorder::DrawLineF: {
+            double c[4];
+            in.getDoubles(c, 4);
+            w.drawLineF(c[0], c[1], c[2], c[3]);
+            break;
+        }
+        case DrawingRecorder::DrawCircleF: {
+            double c[3];
+            in.getDoubles(c, 3);
+            w.drawCircleF(c[0], c[1], c[2]);
+            break;
+        }
+        case DrawingRecorder::DrawTriangleF: {
+            double c[6];
+            in.getDoubles(c, 6);
+            w.drawTriangleF(c[0], c[1], c[2], c[3], c[4], c[5]);
+            break;
+        }
+        case DrawingRecorder::DrawPolyline: {
+            int n = in.getCount();
+            if (n == 0)
+                break;
+            points.resize(n);
+            in.getPoints(&points[0], n);
+            w.drawPolyline(&points[0], n);
+            break;
+        }
+        case DrawingRecorder::DrawLines: {
+            int n = in.getCount();
+            if (n == 0)
+                break;
+            lines.resize(n);
+            colors.resize(n);
+            bool colored = in.getLines(&lines[0], &colors[0], n);
+            w.drawLines(&lines[0], colored ? &colors[0] : NULL, n);
+            break;
+        }
+        case DrawingRecorder::DrawText: {
+            int c[3];
+            in.getInts(c, 3);
+            w.drawText(c[0], c[1], in.getString().constData(), c[2]);
+            break;
+        }
+        case DrawingRecorder::SaveArea: {
+            int c[5];
+            in.getInts(c, 5);
+            if (c[4] >= 0 && c[4] < in.maxCount) {
+                if (c[4] >= int(areas.size()))
+                    areas.resize(c[4] + 1, -1);
+                areas[c[4]] = w.saveArea(c[0], c[1], c[2], c[3]);
+            }
+            break;
+        }
+        case DrawingRecorder::RestoreArea: {
+            int area = in.getInt();
+            if (area >= 0 && area < int(areas.size()))
+                w.restoreArea(areas[area]);
+            break;
+        }
+        case DrawingRecorder::UnlockPixels: {
+            int c[4];
+            in.getInts(c, 4);
+            QRect r;
+            r.setCoords(c[0], c[1], c[2], c[3]);
+            r &= QRect(0, 0, w.width, w.height);
+            unsigned int *pixels = w.lockPixels();
+            if (!r.isEmpty()) {
+                const QRect d = w.deviceRect(r);
+                const int stride = w.getPixelStride();
+                for (int y = d.top(); y <= d.bottom(); y++)
+                    in.getChangedPixels(pixels + y * stride + d.left(),
+                                        d.width());
+            }
+            w.unlockPixels(c[0], c[1], c[2], c[3]);
+            break;
+        }
+        case DrawingRecorder::Sync:
+            w.sync();
+            break;
+        case DrawingRecorder::NextFrame:
+            break;
+        case DrawingRecorder::MousePress:
+            if (in.getInt()) {
+                int c[3];
+                in.getInts(c, 3);
+            }
+            break;
+        case DrawingRecorder::Close:
+            closed = true;
+            break;
+        default:
+            in.invalidate();
+            break;
+        }
+    }
+    w.sync();
+    return in.isValid();
+}
+
+//! Lit la taille de la fenêtre d'un enregistrement.
+/*!
+ * \param fileName      nom du fichier d'enregistrement
+ * \param width         largeur de la fenêtre enregistrée
+ * \param height        hauteur de la fenêtre enregistrée
+ * \return              false si le fichier n'est pas un enregistrement
+ *
+ * \see replay
+ */
+bool DrawingWindow::getRecordSize(const char *fileName,
+                                  int &width, int &height)
+{
+    DrawingRecordReader in(fileName);
+    if (!in.isValid())
+        return false;
+    width = in.width;
+    height = in.height;
+    return true;
+}
+
+//--- DrawingWindow (protected methods) --------------------------------
+//! \cond show_protected
+
+/*!
+ * \see QWidget
+ */
+void DrawingWindow::closeEvent(QCloseEvent *ev)
+{
+    if (shared) {
+        DrawingPresenter::instance()->remove(this);
+    } else {
+        timer.stop();
+        thread->exit();
+    }
+    // the drawing function stops by itself (see safeLock), and is
+    // waited for, for stopTimeout ms at most, by the destructor
+    stopDrawing();
+    QWidget::closeEvent(ev);
+}
+
+/*!
+ * \see QWidget
+ */
+void DrawingWindow::customEvent(QEvent *ev)
+{
+    switch ((int )ev->type()) {
+    case SyncRequest:
+        realSync();
+        break;
+    case CloseRequest:
+        close();
+        break;
+    case PresentRequest:
+        schedulePresent();
+        break;
+    case DrawTextRequest:
+        DrawTextEvent *tev = dynamic_cast<DrawTextEvent *>(ev);
+        realDrawText(tev->x, tev->y, tev->text, tev->flags);
+        break;
+    }
+}
+
+/*!
+ * Avec &lt;Ctrl&gt;, commence un déplacement de la vue.  Sinon, le
+ * clic est transmis à la fonction de dessin (voir waitMousePress), en
+ * coordonnées de l'image.
+ *
+ * \see QWidget
+ *
+ * \bug                 expérimental
+ */
+void DrawingWindow::mousePressEvent(QMouseEvent *ev)
+{
+    if (ev->modifiers() & Qt::ControlModifier) {
+        panning = true;
+        panPos = ev->pos();
+        ev->accept();
+        return;
+    }
+    inputMutex.lock();
+    mousePos = widgetToImage(ev->pos());
+    mouseButton = ev->button();
+    ev->accept();
+    inputCondition.wakeAll();
+    inputMutex.unlock();
+}
+
+/*!
+ * Déplace la vue, pendant un glissement commencé avec &lt;Ctrl&gt;.
+ *
+ * \see QWidget
+ */
+void DrawingWindow::mouseMoveEvent(QMouseEvent *ev)
+{
+    if (!panning) {
+        QWidget::mouseMoveEvent(ev);
+        return;
+    }
+    const QPoint delta = ev->pos() - panPos;
+    panPos = ev->pos();
+    setView(viewScale, viewOrigin - QPointF(delta) / viewScale);
+    ev->accept();
+}
+
+/*!
+ * \see QWidget
+ */
+void DrawingWindow::mouseReleaseEvent(QMouseEvent *ev)
+{
+    if (panning && ev->buttons() == Qt::NoButton)
+        panning = false;
+    QWidget::mouseReleaseEvent(ev);
+}
+
+/*!
+ * Agrandit ou réduit la vue autour du pointeur, d'un facteur 1,25 par
+ * cran de la molette.
+ *
+ * \see QWidget
+ */
+void DrawingWindow::wheelEvent(QWheelEvent *ev)
+{
+    const double scale = qBound(1.0,
+                                viewScale * std::pow(1.25, ev->delta() / 120.0),
+                                maxViewScale);
+    // the image point under the pointer stays in place
+    const QPointF pos(ev->pos());
+    setView(scale, viewOrigin + pos / viewScale - pos / scale);
+    ev->accept();
+}
+
+/*!
+ * &lt;Esc&gt; ferme la fenêtre, &lt;Home&gt; revient à la vue d'origine.
+ *
+ * \see QWidget
+ */
+void DrawingWindow::keyPressEvent(QKeyEvent *ev)
+{
+    switch (ev->key()) {
+    case Qt::Key_Escape:
+        ev->accept();
+        close();
+        break;
+    case Qt::Key_Home:
+        ev->accept();
+        setView(1.0, QPointF());
+        break;
+    default:
+        QWidget::keyPressEvent(ev);
+        break;
+    }
+}
+
+/*!
+ * \see QWidget
+ */
+void DrawingWindow::paintEvent(QPaintEvent *ev)
+{
+    backend->paint(ev->rect());
+    if (overlayShown && backendType == RasterBackend)
+        paintOverlay();
+}
+
+/*!
+ * \see QWidget
+ */
+void DrawingWindow::showEvent(QShowEvent *ev)
+{
+    QWidget::showEvent(ev);
+    qApp->flush();
+    qApp->syncX();
+    if (!frameClock.isValid())
+        frameClock.start();
+    if (shared) {
+        DrawingPresenter *presenter = DrawingPresenter::instance();
+        presenter->add(this);
+        task->start_once(presenter->threadPool());
+    } else {
+        // first present at once, then only on request
+        timer.start(0, this);
+        thread->start_once(QThread::IdlePriority);
+    }
+}
+
+/*!
+ * Un rendu, puis plus rien jusqu'à la prochaine demande (voir
+ * requestPresent) : la fenêtre ne consomme rien au repos.
+ *
+ * \see QWidget
+ */
+void DrawingWindow::timerEvent(QTimerEvent *ev)
+{
+    if (ev->timerId() == timer.timerId()) {
+        timer.stop();
+        lastPresent = frameClock.elapsed();
+        nextFrame();
+    } else {
+        QWidget::timerEvent(ev);
+    }
+}
+
+/*!
+ * Pas de moteur de rendu Qt pour l'affichage par mémoire partagée X11.
+ *
+ * \see QWidget
+ */
+QPaintEngine *DrawingWindow::paintEngine() const
+{
+    if (backendType == XShmBackend)
+        return NULL;
+    return QWidget::paintEngine();
+}
+
+// \endcond
+
+//--- DrawingWindow (private methods) ----------------------------------
+
+//! Fonction d'initialisation.
+/*!
+ * Fonction appelée par les différents constructeurs.
+ *
+ * \param fun           fonction de dessin
+ */
+void DrawingWindow::initialize(DrawingWindow::ThreadFunction fun)
+{
+    shared = sharedMode;
+    recorder = NULL;
+    frameExport = NULL;
+    supersampling = 1;
+    resetWorld();
+    viewScale = 1.0;
+    panning = false;
+    saveSlots = new QSemaphore(maxPendingSaves);
+    dirtyTime = -1;
+    pendingTime = -1;
+    frameInterval = paintInterval;
+    presentRequested = 0;
+    lastPresent = 0;
+    latency = new DrawingLatency;
+    latencyOverlay = 0;
+    overlayShown = false;
+    backendType = RasterBackend;
+    backend = NULL;
+    terminateThread = 0;
+    lockCount = 0;
+    frameTimestamp = 0;
+    currentFrameTime = 0.0;
+    stepTime = 0.0;
+    for (int i = 0; i < MAX_LAYERS; i++) {
+        layers[i] = NULL;
+        layerPainters[i] = NULL;
+        resolved[i] = NULL;
+    }
+    layers[0] = new QImage(width, height, QImage::Format_RGB32);
+    layerPainters[0] = new QPainter(layers[0]);
+    layer = 0;
+    image = layers[0];
+    painter = layerPainters[0];
+    if (shared) {
+        thread = NULL;
+        task = new DrawingTask(*this, fun);
+    } else {
+        thread = new DrawingThread(*this, fun);
+        task = NULL;
+    }
+
+    setFocusPolicy(Qt::StrongFocus);
+    setFixedSize(image->size());
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    setFocus();
+
+    backendType = getDefaultBackend();
+    backend = DrawingBackend::create(*this, backendType);
+
+    setColor("black");
+    setBgColor("white");
+    clearGraph();
+
+    dirtyFlag = false;
+
+    // created last: the default state above is not recorded
+    recorder = DrawingRecorder::create(*this);
+
+#ifdef DRAWINGWINDOW_USE_SHM
+    frameExport = DrawingFrameExport::create(*this);
+    if (frameExport)
+        frameExport->publish(*backend, QRect(0, 0, width, height));
+#endif
+}
+
+//! Change la couleur de dessin.
+/*!
+ * \param color                 couleur
+ */
+inline
+void DrawingWindow::setColor(const QColor &color)
+{
+    if (recorder)
+        recorder->record(DrawingRecorder::SetColor).putColor(color.rgba());
+    QPen pen(painter->pen());
+    pen.setColor(color);
+    painter->setPen(pen);
+}
+
+//! Change la couleur de fond.
+/*!
+ * \param color                 couleur
+ */
+inline
+void DrawingWindow::setBgColor(const QColor &color)
+{
+    if (recorder)
+        recorder->record(DrawingRecorder::SetBgColor).putColor(color.rgba());
+    painter->setBackground(color);
+}
+
+//! Retourne la couleur de dessin courante.
+/*!
+ * \return              couleur de dessin courante
+ */
+inline
+QColor DrawingWindow::getColor()
+{
+    return painter->pen().color();
+}
+
+//! Retourne la couleur de fond courante.
+/*!
+ * \return              couleur de fond courante
+ */
+inline
+QColor DrawingWindow::getBgColor()
+{
+    return painter->background().color();
+}
+
+//! Active ou non le remplissage des formes.
+/*!
+ * Utilisé par les méthodes fillXxx, autour de la méthode drawXxx
+ * correspondante.
+ *
+ * \param state         remplissage avec la couleur de dessin courante
+ */
+void DrawingWindow::setBrush(bool state)
+{
+    if (recorder)
+        recorder->record(DrawingRecorder::SetBrush).put(int(state));
+    if (state)
+        painter->setBrush(getColor());
+    else
+        painter->setBrush(Qt::NoBrush);
+}
+
+//! Active ou non le fond coloré du texte.
+/*!
+ * \param state         fond coloré pour drawText
+ *
+ * \see drawTextBg
+ */
+void DrawingWindow::setBgMode(bool state)
+{
+    if (recorder)
+        recorder->record(DrawingRecorder::SetBgMode).put(int(state));
+    painter->setBackgroundMode(state ? Qt::OpaqueMode : Qt::TransparentMode);
+}
+
+//! Enregistre les pixels d'une zone de la couche courante.
+/*!
+ * Appelé par unlockPixels, tant que l'image est encore verrouillée.
+ * Seuls les pixels qui diffèrent de ceux conservés par lockPixels
+ * sont enregistrés.
+ *
+ * \param rect          zone modifiée, en coordonnées de la fenêtre
+ */
+void DrawingWindow::recordPixels(const QRect &rect)
+{
+    const QRect r = rect & QRect(0, 0, width, height);
+    recorder->record(DrawingRecorder::UnlockPixels)
+        .put(r.left()).put(r.top()).put(r.right()).put(r.bottom());
+    if (r.isEmpty())
+        return;
+    const QRect d = deviceRect(r);
+    const int stride = getPixelStride();
+    for (int y = d.top(); y <= d.bottom(); y++)
+        recorder->putChangedPixels(scanLine(image, y) + d.left(),
+                                   y * stride + d.left(), d.width());
+}
+
+//! Accès direct à une ligne de pixels.
+/*!
+ * On ne peut pas utiliser QImage::scanLine, qui pourrait provoquer
+ * une copie de l'image (une copie légère peut être en cours
+ * d'utilisation par paintEvent), alors que le QPainter continue de
+ * dessiner dans le tampon d'origine.
+ *
+ * \param img           image (une des couches)
+ * \param y             numéro de ligne
+ * \return              adresse du premier pixel de la ligne
+ */
+inline
+QRgb *DrawingWindow::scanLine(const QImage *img, int y)
+{
+    return reinterpret_cast<QRgb *>(const_cast<uchar *>(img->constScanLine(y)));
+}
+
+//! Arrondit une coordonnée de la fenêtre.
+/*!
+ * La valeur est d'abord bornée à ±maxWindowCoord, pour que la
+ * conversion en entier reste définie.  Avec SSE2, l'arrondi est le
+ * même que celui de worldToWindow.
+ */
+inline
+int DrawingWindow::roundCoord(double v)
+{
+    v = qBound(-maxWindowCoord, v, maxWindowCoord);
+#ifdef __SSE2__
+    return _mm_cvtsd_si32(_mm_set_sd(v));
+#else
+    return qRound(v);
+#endif
+}
+
+//! Zone des couches correspondant à une zone de la fenêtre.
+/*!
+ * Identique, sauf en cas de suréchantillonnage.
+ *
+ * \see setSupersampling
+ */
+inline
+QRect DrawingWindow::deviceRect(const QRect &rect) const
+{
+    const int f = supersampling;
+    return QRect(f * rect.x(), f * rect.y(),
+                 f * rect.width(), f * rect.height());
+}
+
+//! Image affichée pour une couche.
+/*!
+ * C'est la couche elle-même, ou sa version réduite en cas de
+ * suréchantillonnage.
+ *
+ * \see setSupersampling
+ */
+inline
+const QImage *DrawingWindow::presentedLayer(int i) const
+{
+    return supersampling > 1 ? resolved[i] : layers[i];
+}
+
+//! Vrai si la vue est agrandie (voir wheelEvent).
+inline
+bool DrawingWindow::isViewZoomed() const
+{
+    return viewScale > 1.0;
+}
+
+//! Transformation des coordonnées de l'image vers celles du widget.
+QTransform DrawingWindow::viewTransform() const
+{
+    return QTransform().scale(viewScale, viewScale)
+        .translate(-viewOrigin.x(), -viewOrigin.y());
+}
+
+//! Pixel de l'image sous un point du widget.
+QPoint DrawingWindow::widgetToImage(const QPoint &pos) const
+{
+    if (!isViewZoomed())
+        return pos;
+    return QPoint(int(std::floor(viewOrigin.x() + pos.x() / viewScale)),
+                  int(std::floor(viewOrigin.y() + pos.y() / viewScale)));
+}
+
+//! Zone de l'image visible dans une zone du widget.
+QRect DrawingWindow::widgetToImage(const QRect &rect) const
+{
+    if (!isViewZoomed())
+        return rect;
+    QRect r;
+    r.setCoords(
+        int(std::floor(viewOrigin.x() + rect.left() / viewScale)),
+        int(std::floor(viewOrigin.y() + rect.top() / viewScale)),
+        int(std::ceil(viewOrigin.x() + (rect.right() + 1) / viewScale)) - 1,
+        int(std::ceil(viewOrigin.y() + (rect.bottom() + 1) / viewScale)) - 1);
+    return r & QRect(0, 0, width, height);
+}
+
+//! Zone du widget où est affichée une zone de l'image.
+QRect DrawingWindow::imageToWidget(const QRect &rect) const
+{
+    if (!isViewZoomed())
+        return rect;
+    QRect r;
+    r.setCoords(
+        int(std::floor((rect.left() - viewOrigin.x()) * viewScale)),
+        int(std::floor((rect.top() - viewOrigin.y()) * viewScale)),
+        int(std::ceil((rect.right() + 1 - viewOrigin.x()) * viewScale)) - 1,
+        int(std::ceil((rect.bottom() + 1 - viewOrigin.y()) * viewScale)) - 1);
+    return r & QRect(0, 0, width, height);
+}
+
+//! Change la vue, et la réaffiche.
+/*!
+ * La vue reste à l'intérieur de l'image.  Seul l'affichage change :
+ * l'image elle-même n'est pas modifiée, et la fonction de dessin n'est
+ * pas interrompue.
+ *
+ * \param scale         agrandissement, entre 1 et maxViewScale
+ * \param origin        point de l'image en haut à gauche du widget
+ */
+void DrawingWindow::setView(double scale, const QPointF &origin)
+{
+    scale = qBound(1.0, scale, maxViewScale);
+    const double w = width - width / scale;
+    const double h = height - height / scale;
+    const QPointF o(qBound(0.0, origin.x(), w), qBound(0.0, origin.y(), h));
+    if (scale == viewScale && o == viewOrigin)
+        return;
+    viewScale = scale;
+    viewOrigin = o;
+    backend->viewChanged();
+}
+
+//! Verrouille un mutex.
+/*!
+ * C'est ici que la fonction de dessin est arrêtée, si la fenêtre a été
+ * fermée (voir stopDrawing) : seulement si le thread courant ne détient
+ * aucun mutex, pour ne pas bloquer le thread principal.  Pendant de
+ * safeUnlock.
+ *
+ * \param mutex         le mutex à verrouiller
+ *
+ * \see safeUnlock
+ */
+inline
+void DrawingWindow::safeLock(QMutex &mutex)
+{
+    if (lockCount++ == 0 && terminateThread) {
+        lockCount = 0;
+        throw DrawingStopped();
+    }
+    mutex.lock();
+}
+
+//! Déverrouille un mutex.
+/*!
+ * Pendant de safeLock.
+ *
+ * \param mutex         le mutex à déverrouiller
+ *
+ * \see safeLock
+ */
+inline
+void DrawingWindow::safeUnlock(QMutex &mutex)
+{
+    mutex.unlock();
+    lockCount--;
+}
+
+//! Marque l'image entière comme non à jour.
+inline
+void DrawingWindow::dirty()
+{
+    if (!dirtyFlag) {
+        dirtyTime = clockTime();
+        requestPresent();
+    }
+    dirtyFlag = true;
+    dirtyRect = QRect(0, 0, width, height);
+}
+
+//! Marque un point de l'image comme non à jour.
+/*!
+ * \param x, y          coordonnées du point
+ */
+inline
+void DrawingWindow::dirty(int x, int y)
+{
+    dirty(QRect(x, y, 1, 1));
+}
+
+//! Marque une zone de l'image comme non à jour.
+/*!
+ * La zone est définie par un rectangle dont les coordonnées de deux
+ * sommets oppposés sont données.
+ *
+ * \param x1, y1        coordonnées d'un sommet du rectangle
+ * \param x2, y2        coordonnées du sommet opposé du rectangle
+ */
+inline
+void DrawingWindow::dirty(int x1, int y1, int x2, int y2)
+{
+    QRect r;
+    r.setCoords(x1, y1, x2, y2);
+    dirty(r.normalized());
+}
+
+//! Marque une zone de l'image comme non à jour.
+/*!
+ * Sur une couche autre que la couche 0, la zone dessinée de la couche
+ * est élargie de l'épaisseur du pinceau et des pixels touchés par
+ * l'antialiasing, pour que clearLayer efface bien tout le tracé.
+ *
+ * \param rect          rectangle délimitant la zone
+ */
+void DrawingWindow::dirty(const QRect &rect)
+{
+    if (layer > 0) {
+        // the rect is the geometric bounds: a wide or antialiased pen
+        // spills over it
+        const int penWidth = painter->pen().width();
+        if (penWidth > 1
+            || (painter->renderHints() & QPainter::Antialiasing)) {
+            const int margin = penWidth / 2 + 1;
+            layerRects[layer] |=
+                rect.adjusted(-margin, -margin, margin, margin);
+        } else {
+            layerRects[layer] |= rect;
+        }
+    }
+    if (dirtyFlag) {
+        dirtyRect |= rect;
+    } else {
+        dirtyFlag = true;
+        dirtyRect = rect;
+        dirtyTime = clockTime();
+        requestPresent();
+    }
+}
+
+//! Marque une zone de l'image comme non à jour.
+/*!
+ * Pour les primitives en coordonnées réelles : la zone est arrondie
+ * au pixel, puis élargie pour couvrir l'épaisseur du pinceau et les
+ * pixels voisins touchés par l'antialiasing.
+ *
+ * \param rect          rectangle délimitant la zone
+ */
+void DrawingWindow::dirty(const QRectF &rect)
+{
+    const int margin = 1 + painter->pen().width() / 2;
+    dirty(rect.toAlignedRect().adjusted(-margin, -margin, margin, margin));
+}
+
+//! Rectangle englobant d'un ensemble de points.
+/*!
+ * \param points        tableau de points
+ * \param n             nombre de points (au moins 1)
+ * \return              le plus petit rectangle contenant tous les points
+ */
+QRect DrawingWindow::boundingRect(const QPoint *points, int n)
+{
+    int x1 = points[0].x();
+    int y1 = points[0].y();
+    int x2 = x1;
+    int y2 = y1;
+    for (int i = 1; i < n; i++) {
+        x1 = qMin(x1, points[i].x());
+        x2 = qMax(x2, points[i].x());
+        y1 = qMin(y1, points[i].y());
+        y2 = qMax(y2, points[i].y());
+    }
+    QRect r;
+    r.setCoords(x1, y1, x2, y2);
+    return r;
+}
+
+//! Rectangle englobant d'un ensemble de segments.
+/*!
+ * \param lines         tableau de segments
+ * \param n             nombre de segments (au moins 1)
+ * \return              le plus petit rectangle contenant tous les segments
+ */
+QRect DrawingWindow::boundingRect(const QLine *lines, int n)
+{
+    int x1 = qMin(lines[0].x1(), lines[0].x2());
+    int y1 = qMin(lines[0].y1(), lines[0].y2());
+    int x2 = qMax(lines[0].x1(), lines[0].x2());
+    int y2 = qMax(lines[0].y1(), lines[0].y2());
+    for (int i = 1; i < n; i++) {
+        x1 = qMin(x1, qMin(lines[i].x1(), lines[i].x2()));
+        y1 = qMin(y1, qMin(lines[i].y1(), lines[i].y2()));
+        x2 = qMax(x2, qMax(lines[i].x1(), lines[i].x2()));
+        y2 = qMax(y2, qMax(lines[i].y1(), lines[i].y2()));
+    }
+    QRect r;
+    r.setCoords(x1, y1, x2, y2);
+    return r;
+}
+
+//! Demande un rendu au thread principal.
+/*!
+ * Un seul évènement à la fois : le thread principal remet le drapeau
+ * à zéro en le traitant (voir schedulePresent).  Inutile en mode
+ * partagé, où les rendus sont périodiques.
+ */
+void DrawingWindow::requestPresent()
+{
+    if (!shared && presentRequested.testAndSetOrdered(0, 1))
+        qApp->postEvent(this, new PresentRequestEvent());
+}
+
+//! Programme le prochain rendu, suite à requestPresent.
+/*!
+ * Le rendu a lieu dès que le précédent date d'au moins frameInterval
+ * ms.  Rien à faire si un rendu est déjà programmé.
+ */
+void DrawingWindow::schedulePresent()
+{
+    presentRequested = 0;
+    if (timer.isActive() || terminateThread || !frameClock.isValid())
+        return;
+    const qint64 wait = lastPresent + frameInterval - frameClock.elapsed();
+    timer.start(qMax(wait, qint64(0)), this);
+}
+
+//! Génère un update si besoin.
+/*!
+ * Génère une demande de mise à jour de la fenêtre (appel à update)
+ * s'il y en a besoin.
+ */
+void DrawingWindow::mayUpdate()
+{
+    imageMutex.lock();
+    bool dirty = dirtyFlag;
+    QRect rect = dirtyRect;
+    qint64 time = dirtyTime;
+    dirtyFlag = false;
+    if (dirty && supersampling > 1)
+        resolve(rect);
+    imageMutex.unlock();
+    if (dirty) {
+        // not yet presented: the latency counts from the oldest one
+        if (pendingTime < 0)
+            pendingTime = time;
+        backend->update(rect);
+#ifdef DRAWINGWINDOW_USE_SHM
+        if (frameExport)
+            frameExport->publish(*backend, rect);
+#endif
+    }
+}
+
+//! Réduit une zone des couches suréchantillonnées.
+/*!
+ * Met à jour les images affichées (resolved), à la taille de la
+ * fenêtre.  Appelée avec imageMutex verrouillé.
+ *
+ * \param rect          zone à réduire, en coordonnées de la fenêtre
+ *
+ * \see setSupersampling
+ */
+void DrawingWindow::resolve(const QRect &rect)
+{
+    const QRect r = rect & QRect(0, 0, width, height);
+    if (r.isEmpty())
+        return;
+    // every existing layer, since a cleared area must be resolved too
+    for (int i = 0; i < MAX_LAYERS; i++) {
+        if (layers[i])
+            downsample(layers[i], resolved[i], r);
+    }
+}
+
+//! Réduit une zone d'une image suréchantillonnée (filtre boîte).
+/*!
+ * Chaque pixel de dest, dans rect, prend la moyenne arrondie des
+ * supersampling × supersampling pixels correspondants de src.  Les
+ * quatre composantes sont moyennées séparément : pour les couches
+ * prémultipliées par alpha, c'est bien la moyenne des couleurs.
+ *
+ * \param src           image suréchantillonnée
+ * \param dest          image à la taille de la fenêtre
+ * \param rect          zone à réduire, en coordonnées de dest
+ */
+void DrawingWindow::downsample(const QImage *src, QImage *dest,
+                               const QRect &rect)
+{
+    const int f = supersampling;
+    const int n = f * f;
+    const int stride = src->bytesPerLine() / sizeof(QRgb);
+    const int w = rect.width();
+    for (int y = rect.top(); y <= rect.bottom(); y++) {
+        QRgb *d = scanLine(dest, y) + rect.left();
+        const QRgb *s = scanLine(src, f * y) + f * rect.left();
+        int x = 0;
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        if (f == 2) {
+            // 4 pixels at a time: 8 source pixels on each of 2 lines
+            const __m128i round = _mm_set1_epi16(2);
+            for (/* x */; x + 4 <= w; x += 4) {
+                const __m128i *l0 =
+                    reinterpret_cast<const __m128i *>(s + 2 * x);
+                const __m128i *l1 =
+                    reinterpret_cast<const __m128i *>(s + stride + 2 * x);
+                const __m128i a = _mm_loadu_si128(l0);
+                const __m128i b = _mm_loadu_si128(l0 + 1);
+                const __m128i c = _mm_loadu_si128(l1);
+                const __m128i e = _mm_loadu_si128(l1 + 1);
+                // vertical sums, 16 bits per component, 2 pixels each
+                const __m128i s01 = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                                  _mm_unpacklo_epi8(c, zero));
+                const __m128i s23 = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                                                  _mm_unpackhi_epi8(c, zero));
+                const __m128i s45 = _mm_add_epi16(_mm_unpacklo_epi8(b, zero),
+                                                  _mm_unpacklo_epi8(e, zero));
+                const __m128i s67 = _mm_add_epi16(_mm_unpackhi_epi8(b, zero),
+                                                  _mm_unpackhi_epi8(e, zero));
+                // horizontal sums of pixel pairs
+                __m128i o01 = _mm_add_epi16(_mm_unpacklo_epi64(s01, s23),
+                                            _mm_unpackhi_epi64(s01, s23));
+                __m128i o23 = _mm_add_epi16(_mm_unpacklo_epi64(s45, s67),
+                                            _mm_unpackhi_epi64(s45, s67));
+                o01 = _mm_srli_epi16(_mm_add_epi16(o01, round), 2);
+                o23 = _mm_srli_epi16(_mm_add_epi16(o23, round), 2);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(d + x),
+                                 _mm_packus_epi16(o01, o23));
+            }
+        } else if (f == 4) {
+            // 2 pixels at a time: 8 source pixels on each of 4 lines
+            const __m128i round = _mm_set1_epi16(8);
+            for (/* x */; x + 2 <= w; x += 2) {
+                __m128i acc0 = zero;
+                __m128i acc1 = zero;
+                for (int k = 0; k < 4; k++) {
+                    const QRgb *row = s + k * stride + 4 * x;
+                    const __m128i *l = reinterpret_cast<const __m128i *>(row);
+                    const __m128i a = _mm_loadu_si128(l);
+                    const __m128i b = _mm_loadu_si128(l + 1);
+                    acc0 = _mm_add_epi16(acc0, _mm_unpacklo_epi8(a, zero));
+                    acc0 = _mm_add_epi16(acc0, _mm_unpackhi_epi8(a, zero));
+                    acc1 = _mm_add_epi16(acc1, _mm_unpacklo_epi8(b, zero));
+                    acc1 = _mm_add_epi16(acc1, _mm_unpackhi_epi8(b, zero));
+                }
+                __m128i o = _mm_add_epi16(_mm_unpacklo_epi64(acc0, acc1),
+                                          _mm_unpackhi_epi64(acc0, acc1));
+                o = _mm_srli_epi16(_mm_add_epi16(o, round), 4);
+                _mm_storel_epi64(reinterpret_cast<__m128i *>(d + x),
+                                 _mm_packus_epi16(o, o));
+            }
+        }
+#endif
+        for (/* x */; x < w; x++) {
+            unsigned int sum[4] = { 0, 0, 0, 0 };
+            for (int k = 0; k < f; k++) {
+                const QRgb *p = s + k * stride + f * x;
+                for (int j = 0; j < f; j++) {
+                    sum[0] += qAlpha(p[j]);
+                    sum[1] += qRed(p[j]);
+                    sum[2] += qGreen(p[j]);
+                    sum[3] += qBlue(p[j]);
+                }
+            }
+            d[x] = qRgba((sum[1] + n / 2) / n, (sum[2] + n / 2) / n,
+                         (sum[3] + n / 2) / n, (sum[0] + n / 2) / n);
+        }
+    }
+}
+
+//! Rendu d'une trame.
+/*!
+ * Met à jour la fenêtre si besoin, et réveille la fonction de dessin
+ * si elle attend la trame suivante.
+ *
+ * \see timerEvent, waitNextFrame
+ */
+void DrawingWindow::nextFrame()
+{
+    mayUpdate();
+    if (backendType == RasterBackend) {
+        const bool overlay = latencyOverlay;
+        if (overlay || overlayShown)
+            update(overlayRect());
+        overlayShown = overlay;
+    }
+    syncMutex.lock();
+    frameTimestamp = frameClock.elapsed();
+    frameCondition.wakeAll();
+    syncMutex.unlock();
+}
+
+//! Demande l'arrêt de la fonction de dessin.
+/*!
+ * Réveille la fonction de dessin si elle est en attente : les
+ * méthodes d'attente retournent alors false.  Elle est arrêtée lors
+ * de son prochain appel à safeLock.
+ *
+ * \see closeEvent
+ */
+void DrawingWindow::stopDrawing()
+{
+    syncMutex.lock();
+    inputMutex.lock();
+    terminateThread = 1;        // set with the mutexes held, so that
+                                // a waiting method either sees it
+                                // before waiting, or is woken by the
+                                // following wakeAll() calls
+    syncCondition.wakeAll();
+    frameCondition.wakeAll();
+    inputCondition.wakeAll();
+    inputMutex.unlock();
+    syncMutex.unlock();
+}
+
+//! Fonction bas-niveau pour sync.
+/*!
+ * Fonction de synchronisation dans le thread principal.
+ *
+ * \see sync, customEvent
+ */
+void DrawingWindow::realSync()
+{
+    mayUpdate();
+    backend->flush();
+    qApp->sendPostedEvents(this, QEvent::UpdateLater);
+    qApp->sendPostedEvents(this, QEvent::UpdateRequest);
+    qApp->sendPostedEvents(this, QEvent::Paint);
+    qApp->processEvents(QEventLoop::ExcludeUserInputEvents |
+                        QEventLoop::ExcludeSocketNotifiers |
+                        QEventLoop::DeferredDeletion |
+                        QEventLoop::X11ExcludeTimers);
+    qApp->flush();
+    qApp->syncX();
+    syncMutex.lock();
+    syncCondition.wakeAll();
+    syncMutex.unlock();
+}
+
+//! Date courante, pour les mesures de latence.
+/*!
+ * \return              date (ns) depuis l'affichage de la fenêtre, -1
+ *                      avant
+ */
+inline
+qint64 DrawingWindow::clockTime() const
+{
+    return frameClock.isValid() ? frameClock.nsecsElapsed() : -1;
+}
+
+//! Mesure la latence, à la fin d'un affichage.
+/*!
+ * Appelée par les méthodes d'affichage, dans le thread principal.
+ */
+void DrawingWindow::presented()
+{
+    if (pendingTime < 0)
+        return;
+    latency->record((clockTime() - pendingTime) / 1000);
+    pendingTime = -1;
+}
+
+//! Zone du widget où la latence est affichée.
+QRect DrawingWindow::overlayRect() const
+{
+    const int h = fontMetrics().height() + 4;
+    return QRect(0, height - h, width, h);
+}
+
+//! Affiche la latence par dessus l'image, depuis paintEvent.
+void DrawingWindow::paintOverlay()
+{
+    const QString text =
+        QString("p50 %1 ms   p99 %2 ms   max %3 ms   (%4)")
+        .arg(latency->quantile(0.5), 0, 'f', 1)
+        .arg(latency->quantile(0.99), 0, 'f', 1)
+        .arg(latency->quantile(1.0), 0, 'f', 1)
+        .arg(latency->count());
+    const QRect r = overlayRect();
+    QPainter widgetPainter(this);
+    widgetPainter.fillRect(r, QColor(0, 0, 0, 160));
+    widgetPainter.setPen(Qt::white);
+    widgetPainter.drawText(r.adjusted(4, 0, -4, 0),
+                           Qt::AlignLeft | Qt::AlignVCenter, text);
+}
+
+//! Fonction bas-niveau pour drawText.
+/*!
+ * Le rendu de texte doit être fait dans le thread principal.  D'où
+ * les manipulations tordues et la synchronisation qui s'en suit.
+ *
+ * \param x, y, text, flags     cf. drawText
+ *
+ * \see drawText, customEvent
+ */
+void DrawingWindow::realDrawText(int x, int y, const char *text, int flags)
+{
+    QRect r(0, 0, width, height);
+    switch (flags & Qt::AlignHorizontal_Mask) {
+    case Qt::AlignRight:
+        r.setRight(x);
+        break;
+    case Qt::AlignHCenter:
+        if (x < width / 2)
+            r.setLeft(2 * x - width + 1);
+        else
+            r.setRight(2 * x);
+        break;
+    default:
+        r.setLeft(x);
+    }
+    switch (flags & Qt::AlignVertical_Mask) {
+    case Qt::AlignBottom:
+        r.setBottom(y);
+        break;
+    case Qt::AlignVCenter:
+        if (y < height / 2)
+            r.setTop(2 * y - height + 1);
+        else
+            r.setBottom(2 * y);
+        break;
+    default:
+        r.setTop(y);
+    }
+    syncMutex.lock();
+    painter->drawText(r, flags, QString::fromUtf8(text), &r);
+    dirty(r);
+    syncCondition.wakeAll();
+    syncMutex.unlock();
+}
+
+//! Superpose et enregistre des couches, pour saveImageAsync.
+/*!
+ * Exécutée par un thread du pool global.  Rend sa place dans la file
+ * des enregistrements une fois terminée.
+ *
+ * \param snapshot      copie des couches, la première est le fond
+ * \param fileName      nom du fichier
+ * \param format        format de l'image, vide pour le déduire du nom
+ * \param slots         places libres pour les enregistrements
+ * \return              true si l'image a été enregistrée
+ */
+bool DrawingWindow::saveSnapshot(std::vector<QImage> snapshot,
+                                 QString fileName, QByteArray format,
+                                 QSemaphore *slots)
+{
+    QImage &image = snapshot[0];
+    if (snapshot.size() > 1) {
+        QPainter painter(&image);
+        for (unsigned i = 1; i < snapshot.size(); i++)
+            painter.drawImage(0, 0, snapshot[i]);
+    }
+    const bool saved = image.save(fileName, format.isEmpty()
+                                  ? NULL : format.constData());
+    slots->release();
+    return saved;
+}
+
+//--- DrawingCanvas ----------------------------------------------------
+
+/*! \class DrawingCanvas
+ *  \brief Dessin virtuel, plus grand que la fenêtre.
+ *
+ * Un DrawingCanvas est une image de taille quelconque, par exemple
+ * plusieurs dizaines de milliers de pixels de côté, découpée en
+ * carreaux de TILE_SIZE × TILE_SIZE pixels.  Un carreau n'est alloué
+ * que lors du premier dessin qui le touche : la mémoire utilisée est
+ * proportionnelle à la surface effectivement dessinée.  Les carreaux
+ * jamais dessinés ont la couleur de fond.
+ *
+ * Avec une limite de carreaux en mémoire (voir setMaxTiles), les
+ * carreaux les moins récemment utilisés sont évincés vers un fichier
+ * temporaire, et relus au besoin.
+ *
+ * Les méthodes de dessin sont celles de DrawingWindow, dans les
+ * coordonnées du canevas.  Une partie du canevas est affichée par
+ * DrawingWindow::drawCanvas.  Un canevas s'utilise depuis la fonction
+ * de dessin, sans verrou : il ne doit pas être partagé entre threads.
+ * Il n'y a pas de texte : il s'écrit directement dans la fenêtre,
+ * après drawCanvas.
+ */
+
+/*! \var DrawingCanvas::TILE_SIZE
+ *  \brief Côté des carreaux (pixels).
+ */
+/*! \var DrawingCanvas::width
+ *  \brief Largeur du canevas.
+ */
+/*! \var DrawingCanvas::height
+ *  \brief Hauteur du canevas.
+ */
+
+//! Constructeur.
+/*!
+ * Aucun carreau n'est alloué.
+ *
+ * \param width_        largeur du canevas
+ * \param height_       hauteur du canevas
+ * \param bgColor_      couleur de fond, de la forme #00RRGGBB
+ * \param maxTiles_     nombre maximal de carreaux en mémoire
+ *                      (0 : pas de limite)
+ *
+ * \see setMaxTiles
+ */
+DrawingCanvas::DrawingCanvas(int width_, int height_,
+                             unsigned int bgColor_, int maxTiles_)
+    : width(qMax(width_, 1))
+    , height(qMax(height_, 1))
+    , tilesX((width + TILE_SIZE - 1) / TILE_SIZE)
+    , tilesY((height + TILE_SIZE - 1) / TILE_SIZE)
+    , bgColor(bgColor_ | 0xff000000)
+    , maxTiles(qMax(maxTiles_, 0))
+    , allocated(0)
+    , useClock(0)
+    , slots(0)
+    , store(NULL)
+    , pen(QColor(Qt::black))
+    , antialiasing(false)
+    , filling(false)
+{
+    Tile empty = { NULL, -1, 0, false };
+    tiles.resize(tilesX * tilesY, empty);
+}
+
+//! Destructeur.
+DrawingCanvas::~DrawingCanvas()
+{
+    clear();
+}
+
+//! Change la couleur de dessin.
+/*!
+ * \see DrawingWindow::setColor(unsigned int)
+ */
+void DrawingCanvas::setColor(unsigned int color)
+{
+    pen.setColor(QColor::fromRgb(color));
+}
+
+//! Change la couleur de dessin.
+/*!
+ * \see DrawingWindow::setColor(const char *)
+ */
+void DrawingCanvas::setColor(const char *name)
+{
+    pen.setColor(QColor(name));
+}
+
+//! Change la couleur de dessin.
+/*!
+ * \see DrawingWindow::setColor(float, float, float)
+ */
+void DrawingCanvas::setColor(float red, float green, float blue)
+{
+    pen.setColor(QColor::fromRgbF(red, green, blue));
+}
+
+//! Change l'épaisseur du pinceau.
+/*!
+ * \see DrawingWindow::setPenWidth
+ */
+void DrawingCanvas::setPenWidth(int width)
+{
+    pen.setWidth(width);
+}
+
+//! Active ou non l'antialiasing.
+/*!
+ * \see DrawingWindow::setAntialiasing
+ */
+void DrawingCanvas::setAntialiasing(bool state)
+{
+    antialiasing = state;
+}
+
+//! Efface le canevas.
+/*!
+ * Tous les carreaux sont libérés, et le fichier temporaire supprimé.
+ */
+void DrawingCanvas::clear()
+{
+    for (unsigned i = 0; i < tiles.size(); i++) {
+        delete tiles[i].image;
+        tiles[i].image = NULL;
+        tiles[i].slot = -1;
+        tiles[i].modified = false;
+    }
+    resident.clear();
+    allocated = 0;
+    slots = 0;
+    delete store;
+    store = NULL;
+}
+
+//! Dessine un point.
+/*!
+ * \see DrawingWindow::drawPoint(int, int)
+ */
+void DrawingCanvas::drawPoint(int x, int y)
+{
+    if (pen.width() > 1 || antialiasing) {
+        drawLine(x, y, x, y);
+        return;
+    }
+    if (x < 0 || x >= width || y < 0 || y >= height)
+        return;
+    // common case: a single pixel, no painter
+    const int i = (y / TILE_SIZE) * tilesX + x / TILE_SIZE;
+    QImage *image = tile(i);
+    tiles[i].modified = true;
+    image->setPixel(x % TILE_SIZE, y % TILE_SIZE, pen.color().rgb());
+}
+
+//! Dessine un segment.
+/*!
+ * \see DrawingWindow::drawLine(int, int, int, int)
+ */
+void DrawingCanvas::drawLine(int x1, int y1, int x2, int y2)
+{
+    Shape shape;
+    shape.kind = Shape::Line;
+    shape.line = QLine(x1, y1, x2, y2);
+    shape.bounds.setCoords(x1, y1, x2, y2);
+    shape.bounds = shape.bounds.normalized();
+    paint(shape);
+}
+
+//! Dessine un rectangle.
+/*!
+ * \see DrawingWindow::drawRect
+ */
+void DrawingCanvas::drawRect(int x1, int y1, int x2, int y2)
+{
+    Shape shape;
+    shape.kind = Shape::Rect;
+    shape.rect.setCoords(x1, y1, x2 - 1, y2 - 1);
+    shape.rect = shape.rect.normalized();
+    shape.bounds = shape.rect.adjusted(0, 0, 1, 1);
+    paint(shape);
+}
+
+//! Dessine un rectangle plein.
+/*!
+ * \see DrawingWindow::fillRect
+ */
+void DrawingCanvas::fillRect(int x1, int y1, int x2, int y2)
+{
+    filling = true;
+    drawRect(x1, y1, x2, y2);
+    filling = false;
+}
+
+//! Dessine un cercle.
+/*!
+ * \see DrawingWindow::drawCircle(int, int, int)
+ */
+void DrawingCanvas::drawCircle(int x, int y, int r)
+{
+    Shape shape;
+    shape.kind = Shape::Ellipse;
+    shape.rect.setCoords(x - r, y - r, x + r - 1, y + r - 1);
+    shape.bounds = shape.rect.adjusted(0, 0, 1, 1);
+    paint(shape);
+}
+
+//! Dessine un disque.
+/*!
+ * \see DrawingWindow::fillCircle(int, int, int)
+ */
+void DrawingCanvas::fillCircle(int x, int y, int r)
+{
+    filling = true;
+    drawCircle(x, y, r);
+    filling = false;
+}
+
+//! Dessine une ligne brisée.
+/*!
+ * \see DrawingWindow::drawPolyline
+ */
+void DrawingCanvas::drawPolyline(const QPoint *points, int n)
+{
+    if (n <= 0)
+        return;
+    Shape shape;
+    shape.kind = Shape::Polyline;
+    shape.points = points;
+    shape.n = n;
+    shape.bounds = DrawingWindow::boundingRect(points, n);
+    paint(shape);
+}
+
+//! Retourne la couleur d'un pixel.
+/*!
+ * Ne charge pas le carreau s'il a été évincé : seul le pixel est lu
+ * dans le fichier.
+ *
+ * \see DrawingWindow::getPointColor
+ */
+unsigned int DrawingCanvas::getPointColor(int x, int y) const
+{
+    if (x < 0 || x >= width || y < 0 || y >= height)
+        return bgColor;
+    const Tile &t = tiles[(y / TILE_SIZE) * tilesX + x / TILE_SIZE];
+    const int tx = x % TILE_SIZE;
+    const int ty = y % TILE_SIZE;
+    if (t.image)
+        return t.image->pixel(tx, ty);
+    QRgb pixel = bgColor;
+    if (t.slot >= 0) {
+        const qint64 tileBytes = TILE_SIZE * TILE_SIZE * sizeof(QRgb);
+        store->seek(t.slot * tileBytes
+                    + (ty * TILE_SIZE + tx) * sizeof(QRgb));
+        store->read(reinterpret_cast<char *>(&pixel), sizeof pixel);
+    }
+    return pixel;
+}
+
+//! Limite le nombre de carreaux en mémoire.
+/*!
+ * Au-delà, les carreaux les moins récemment utilisés sont évincés
+ * vers un fichier temporaire.  Le surplus éventuel est évincé
+ * aussitôt.
+ *
+ * \param n             nombre maximal de carreaux (0 : pas de limite)
+ *
+ * \see getMaxTiles, getResidentTiles
+ */
+void DrawingCanvas::setMaxTiles(int n)
+{
+    maxTiles = qMax(n, 0);
+    while (maxTiles > 0 && int(resident.size()) > maxTiles)
+        evict();
+}
+
+//! Retourne le nombre maximal de carreaux en mémoire.
+/*!
+ * \see setMaxTiles
+ */
+int DrawingCanvas::getMaxTiles() const
+{
+    return maxTiles;
+}
+
+//! Retourne le nombre de carreaux alloués, en mémoire ou évincés.
+int DrawingCanvas::getAllocatedTiles() const
+{
+    return allocated;
+}
+
+//! Retourne le nombre de carreaux en mémoire.
+/*!
+ * \see setMaxTiles
+ */
+int DrawingCanvas::getResidentTiles() const
+{
+    return resident.size();
+}
+
+//! Retourne un carreau, prêt à être modifié.
+/*!
+ * Le carreau est alloué s'il n'a jamais été dessiné, ou relu s'il a
+ * été évincé, quitte à en évincer un autre.
+ *
+ * \param i             indice du carreau
+ */
+QImage *DrawingCanvas::tile(int i)
+{
+    Tile &t = tiles[i];
+    t.lastUse = ++useClock;
+    if (t.image)
+        return t.image;
+    if (maxTiles > 0 && int(resident.size()) >= maxTiles)
+        evict();
+    t.image = new QImage(TILE_SIZE, TILE_SIZE, QImage::Format_RGB32);
+    if (t.slot >= 0) {
+        readTile(i, *t.image);
+    } else {
+        t.image->fill(bgColor);
+        allocated++;
+    }
+    t.modified = t.slot < 0;
+    resident.push_back(i);
+    return t.image;
+}
+
+//! Évince le carreau en mémoire le moins récemment utilisé.
+/*!
+ * Il n'est écrit dans le fichier que s'il a changé depuis sa dernière
+ * écriture.  Si le fichier ne peut être créé ou écrit, rien n'est
+ * évincé, et la limite de carreaux en mémoire est levée.
+ */
+void DrawingCanvas::evict()
+{
+    if (resident.empty())
+        return;
+    unsigned oldest = 0;
+    for (unsigned k = 1; k < resident.size(); k++) {
+        if (tiles[resident[k]].lastUse < tiles[resident[oldest]].lastUse)
+            oldest = k;
+    }
+    Tile &t = tiles[resident[oldest]];
+    if (t.modified) {
+        if (!store) {
+            store = new QTemporaryFile;
+            if (!store->open()) {
+                qWarning("DrawingCanvas: cannot create the tile store");
+                delete store;
+                store = NULL;
+                maxTiles = 0;
+                return;
+            }
+        }
+        const qint64 tileBytes = TILE_SIZE * TILE_SIZE * sizeof(QRgb);
+        if (t.slot < 0)
+            t.slot = slots++;
+        if (!store->seek(t.slot * tileBytes)
+            || store->write(reinterpret_cast<const char *>(
+                                t.image->constBits()), tileBytes)
+            != tileBytes) {
+            // keep the tile, and every other one, in memory
+            qWarning("DrawingCanvas: cannot write to the tile store");
+            maxTiles = 0;
+            return;
+        }
+        t.modified = false;
+    }
+    delete t.image;
+    t.image = NULL;
+    resident[oldest] = resident.back();
+    resident.pop_back();
+}
+
+//! Relit un carreau évincé.
+void DrawingCanvas::readTile(int i, QImage &image) const
+{
+    const qint64 tileBytes = TILE_SIZE * TILE_SIZE * sizeof(QRgb);
+    store->seek(tiles[i].slot * tileBytes);
+    store->read(reinterpret_cast<char *>(image.bits()), tileBytes);
+}
+
+//! Dessine une forme sur tous les carreaux qu'elle touche.
+/*!
+ * Chaque carreau est dessiné avec son propre QPainter, décalé de sa
+ * position : les pixels touchés sont les mêmes que sur une seule
+ * grande image.
+ */
+void DrawingCanvas::paint(const Shape &shape)
+{
+    // room for the pen and the antialiasing
+    const int margin = pen.width() / 2 + 2;
+    const QRect r = shape.bounds.adjusted(-margin, -margin, margin, margin)
+        & QRect(0, 0, width, height);
+    if (r.isEmpty())
+        return;
+    for (int ty = r.top() / TILE_SIZE; ty <= r.bottom() / TILE_SIZE; ty++) {
+        for (int tx = r.left() / TILE_SIZE; tx <= r.right() / TILE_SIZE;
+             tx++) {
+            const int i = ty * tilesX + tx;
+            QImage *image = tile(i);
+            tiles[i].modified = true;
+            QPainter painter(image);
+            painter.translate(-tx * TILE_SIZE, -ty * TILE_SIZE);
+            painter.setPen(pen);
+            if (filling)
+                painter.setBrush(pen.color());
+            painter.setRenderHint(QPainter::Antialiasing, antialiasing);
+            switch (shape.kind) {
+            case Shape::Line:
+                if (shape.line.p1() == shape.line.p2())
+                    painter.drawPoint(shape.line.p1());
+                else
+                    painter.drawLine(shape.line);
+                break;
+            case Shape::Rect:
+                painter.drawRect(shape.rect);
+                break;
+            case Shape::Ellipse:
+                painter.drawEllipse(shape.rect);
+                break;
+            case Shape::Polyline:
+                if (shape.n == 1)
+                    painter.drawPoint(shape.points[0]);
+                else
+                    painter.drawPolyline(shape.points, shape.n);
+                break;
+            }
+        }
+    }
+}
+
+//--- DrawingThread ----------------------------------------------------
+
+//! Constructeur.
+DrawingThread::DrawingThread(DrawingWindow &w, DrawingWindow::ThreadFunction f)
+    : drawingWindow(w)
+    , threadFunction(f)
+    , started_once(false)
+{
+}
+
+//! Démarre le thread si ce n'a pas encore été fait.
+void DrawingThread::start_once(Priority priority)
+{
+    if (!started_once) {
+        started_once = true;
+        start(priority);
+    }
+}
+
+//! La vraie fonction pour le thread.
+void DrawingThread::run()
+{
+    try {
+        if (!drawingWindow.terminateThread)
+            threadFunction(drawingWindow);
+    } catch (const DrawingStopped &) {
+        // fenêtre fermée
+    }
+}
+
+//--- DrawingTask ------------------------------------------------------
+
+//! Constructeur.
+DrawingTask::DrawingTask(DrawingWindow &w, DrawingWindow::ThreadFunction f)
+    : drawingWindow(w)
+    , threadFunction(f)
+    , state(Idle)
+{
+    setAutoDelete(false);
+}
+
+//! Confie la tâche aux threads partagés si ce n'a pas encore été fait.
+void DrawingTask::start_once(QThreadPool &pool)
+{
+    QMutexLocker lock(&finishedMutex);
+    if (state == Idle) {
+        state = Queued;
+        pool.start(this);
+    }
+}
+
+//! Termine la tâche, pour la destruction de la fenêtre.
+/*!
+ * Si la tâche est en cours, attend sa fin (la fonction de dessin doit
+ * avoir été arrêtée, voir DrawingWindow::stopDrawing).  Si elle attend
+ * encore un thread libre, elle n'est pas attendue : le pool garde un
+ * pointeur vers elle, et run la détruira sans appeler la fonction de
+ * dessin.
+ *
+ * \return              true si la tâche peut être détruite par
+ *                      l'appelant
+ */
+bool DrawingTask::cancel()
+{
+    QMutexLocker lock(&finishedMutex);
+    if (state == Queued) {
+        state = Cancelled;
+        return false;
+    }
+    while (state == Running)
+        finishedCondition.wait(&finishedMutex);
+    return true;
+}
+
+//! La vraie fonction pour la tâche.
+/*!
+ * La priorité du thread, partagé, est rétablie à la fin.
+ */
+void DrawingTask::run()
+{
+    {
+        QMutexLocker lock(&finishedMutex);
+        if (state == Cancelled) {
+            // the window is gone
+            lock.unlock();
+            delete this;
+            return;
+        }
+        state = Running;
+    }
+    QThread *thread = QThread::currentThread();
+    const QThread::Priority priority = thread->priority();
+    thread->setPriority(QThread::IdlePriority);
+    try {
+        if (!drawingWindow.terminateThread)
+            threadFunction(drawingWindow);
+    } catch (const DrawingStopped &) {
+        // fenêtre fermée
+    }
+    thread->setPriority(priority);
+    QMutexLocker lock(&finishedMutex);
+    state = Finished;
+    finishedCondition.wakeAll();
+}
+
+//--- DrawingPresenter -------------------------------------------------
+
+QPointer<DrawingPresenter> DrawingPresenter::presenter;
+
+//! Constructeur.
+DrawingPresenter::DrawingPresenter()
+    : QObject(qApp)
+{
+    int n = DrawingWindow::sharedThreads;
+    pool.setMaxThreadCount(n > 0 ? n : QThread::idealThreadCount());
+}
+
+//! Retourne l'unique instance, créée au premier appel.
+DrawingPresenter *DrawingPresenter::instance()
+{
+    if (!presenter)
+        presenter = new DrawingPresenter();
+    return presenter;
+}
+
+//! Ajoute une fenêtre à mettre à jour.
+void DrawingPresenter::add(DrawingWindow *w)
+{
+    if (std::find(windows.begin(), windows.end(), w) == windows.end())
+        windows.push_back(w);
+    if (!timer.isActive())
+        timer.start(DrawingWindow::paintInterval, this);
+}
+
+//! Retire une fenêtre à mettre à jour.
+void DrawingPresenter::remove(DrawingWindow *w)
+{
+    windows.erase(std::remove(windows.begin(), windows.end(), w),
+                  windows.end());
+    if (windows.empty())
+        timer.stop();
+}
+
+//! Retourne l'ensemble des threads de dessin.
+QThreadPool &DrawingPresenter::threadPool()
+{
+    return pool;
+}
+
+//! Rendu de toutes les fenêtres, en une seule fois.
+void DrawingPresenter::timerEvent(QTimerEvent *ev)
+{
+    if (ev->timerId() == timer.timerId()) {
+        for (unsigned i = 0; i < windows.size(); i++)
+            windows[i]->nextFrame();
+    } else {
+        QObject::timerEvent(ev);
+    }
+}
+
+//--- DrawingLatency ---------------------------------------------------
+
+//! Constructeur.
+DrawingLatency::DrawingLatency()
+{
+    reset();
+}
+
+//! Ajoute une mesure.
+/*!
+ * \param usecs         latence (µs)
+ */
+void DrawingLatency::record(qint64 usecs)
+{
+    if (usecs < 0)
+        usecs = 0;
+    QMutexLocker locker(&mutex);
+    counts[bucketOf(usecs)]++;
+    total++;
+    if (usecs > maxValue)
+        maxValue = usecs;
+}
+
+//! Oublie toutes les mesures.
+void DrawingLatency::reset()
+{
+    QMutexLocker locker(&mutex);
+    std::fill(counts, counts + buckets, 0);
+    total = 0;
+    maxValue = 0;
+}
+
+//! Retourne le nombre de mesures.
+int DrawingLatency::count() const
+{
+    QMutexLocker locker(&mutex);
+    return total;
+}
+
+//! Retourne un quantile des mesures.
+/*!
+ * \param q             quantile, entre 0 et 1 (1 : maximum exact)
+ * \return              latence (ms), 0 s'il n'y a aucune mesure
+ */
+double DrawingLatency::quantile(double q) const
+{
+    QMutexLocker locker(&mutex);
+    if (total == 0)
+        return 0.0;
+    if (q >= 1.0)
+        return maxValue / 1000.0;
+    const int rank = qMax(1, int(std::ceil(q * total)));
+    int seen = 0;
+    int i = 0;
+    while (i < buckets - 1 && (seen += counts[i]) < rank)
+        i++;
+    return qMin(valueOf(i), maxValue) / 1000.0;
+}
+
+//! Indice de l'intervalle d'une valeur.
+int DrawingLatency::bucketOf(qint64 value)
+{
+    if (value < 2 * subBuckets)
+        return value;
+    int shift = 0;
+    while ((value >> shift) >= 2 * subBuckets)
+        shift++;
+    if (shift > maxShift)
+        return buckets - 1;
+    return (shift + 1) * subBuckets + (value >> shift) - subBuckets;
+}
+
+//! Valeur représentative (milieu) d'un intervalle.
+qint64 DrawingLatency::valueOf(int bucket)
+{
+    if (bucket < 2 * subBuckets)
+        return bucket;
+    const int shift = bucket / subBuckets - 1;
+    const qint64 low = qint64(bucket % subBuckets + subBuckets) << shift;
+    return low + (qint64(1) << shift) / 2;
+}
+
+//--- DrawingRecorder --------------------------------------------------
+
+const char DrawingRecorder::magic[4] = { 'D', 'W', 'R', 'C' };
+
+//! Nombre de fenêtres déjà enregistrées.
+int DrawingRecorder::count = 0;
+
+//! Crée l'enregistreur d'une fenêtre, si c'est demandé.
+/*!
+ * L'enregistrement est demandé par la variable d'environnement
+ * DRAWINGWINDOW_RECORD, qui donne le nom du fichier.  Pour les
+ * fenêtres suivantes, ce nom est suffixé par ".1", ".2", etc.
+ *
+ * \return              NULL si pas d'enregistrement
+ */
+DrawingRecorder *DrawingRecorder::create(const DrawingWindow &w)
+{
+    const char *env = getenv("DRAWINGWINDOW_RECORD");
+    if (!env || !*env)
+        return NULL;
+    QString fileName = QString::fromLocal8Bit(env);
+    if (count > 0)
+        fileName += QString(".") + QString::number(count);
+    count++;
+    DrawingRecorder *recorder = new DrawingRecorder(fileName, w);
+    if (!recorder->file.isOpen()) {
+        qWarning("DrawingWindow: cannot record to %s",
+                 qPrintable(fileName));
+        delete recorder;
+        recorder = NULL;
+    }
+    return recorder;
+}
+
+DrawingRecorder::DrawingRecorder(const QString &fileName,
+                                 const DrawingWindow &w)
+    : file(fileName)
+    , lastTime(0)
+    , used(0)
+{
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return;
+    putBytes(magic, sizeof magic);
+    putVarint(version);
+    putVarint(w.width);
+    putVarint(w.height);
+    clock.start();
+}
+
+DrawingRecorder::~DrawingRecorder()
+{
+    if (file.isOpen()) {
+        flush();
+        file.close();
+    }
+}
+
+//! Commence l'enregistrement d'une commande.
+/*!
+ * Les paramètres sont ajoutés ensuite, par les méthodes putXxx.
+ */
+DrawingRecorder &DrawingRecorder::record(Command command)
+{
+    const qint64 now = clock.nsecsElapsed() / 1000;
+    const char c = command;
+    putBytes(&c, 1);
+    putVarint(now - lastTime);
+    lastTime = now;
+    return *this;
+}
+
+DrawingRecorder &DrawingRecorder::put(int value)
+{
+    putVarint((quint32(value) << 1) ^ quint32(value >> 31));
+    return *this;
+}
+
+DrawingRecorder &DrawingRecorder::put(double value)
+{
+    quint64 bits;
+    std::memcpy(&bits, &value, sizeof bits);
+    uchar bytes[8];
+    for (int i = 0; i < 8; i++)
+        bytes[i] = uchar(bits >> (8 * i));
+    putBytes(bytes, 8);
+    return *this;
+}
+
+DrawingRecorder &DrawingRecorder::putColor(QRgb color)
+{
+    const uchar bytes[4] = {
+        uchar(color), uchar(color >> 8), uchar(color >> 16), uchar(color >> 24)
+    };
+    putBytes(bytes, 4);
+    return *this;
+}
+
+DrawingRecorder &DrawingRecorder::putString(const char *s)
+{
+    const int n = std::strlen(s);
+    putVarint(n);
+    putBytes(s, n);
+    return *this;
+}
+
+DrawingRecorder &DrawingRecorder::putPoints(const QPoint *points, int n)
+{
+    QPoint previous(0, 0);
+    for (int i = 0; i < n; i++) {
+        put(points[i].x() - previous.x()).put(points[i].y() - previous.y());
+        previous = points[i];
+    }
+    return *this;
+}
+
+DrawingRecorder &DrawingRecorder::putLines(const QLine *lines,
+                                           const unsigned int *colors, int n)
+{
+    put(int(colors != NULL));
+    QPoint previous(0, 0);
+    for (int i = 0; i < n; i++) {
+        const QPoint p1 = lines[i].p1();
+        const QPoint p2 = lines[i].p2();
+        put(p1.x() - previous.x()).put(p1.y() - previous.y());
+        put(p2.x() - p1.x()).put(p2.y() - p1.y());
+        previous = p2;
+    }
+    for (int i = 0; colors && i < n; i++)
+        putColor(colors[i]);
+    return *this;
+}
+
+DrawingRecorder &DrawingRecorder::putPixels(const QRgb *pixels, int n)
+{
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    putBytes(pixels, n * sizeof(QRgb));
+#else
+    for (int i = 0; i < n; i++)
+        putColor(pixels[i]);
+#endif
+    return *this;
+}
+
+//! Conserve les pixels du tampon, au moment de lockPixels.
+/*!
+ * Ils servent de référence à putChangedPixels.
+ */
+void DrawingRecorder::keepPixels(const QRgb *pixels, int n)
+{
+    kept.assign(pixels, pixels + n);
+}
+
+//! Enregistre les pixels modifiés d'une ligne.
+/*!
+ * La ligne est comparée aux pixels conservés par keepPixels, et
+ * enregistrée comme le nombre de séquences modifiées, puis pour
+ * chacune le nombre de pixels inchangés qui la précèdent, sa longueur
+ * et ses pixels.  Deux séquences séparées par moins de minGap pixels
+ * inchangés n'en font qu'une : c'est moins cher qu'un en-tête.
+ *
+ * \param pixels        pixels de la ligne
+ * \param offset        indice de pixels[0] dans les pixels conservés
+ * \param n             nombre de pixels
+ */
+DrawingRecorder &DrawingRecorder::putChangedPixels(const QRgb *pixels,
+                                                   int offset, int n)
+{
+    static const int minGap = 2;
+    const QRgb *old = &kept[offset];
+    // runs of changed pixels, as (start, end) pairs
+    runs.clear();
+    int x = 0;
+    while (x < n) {
+        while (x < n && pixels[x] == old[x])
+            x++;
+        if (x == n)
+            break;
+        // the run ends before minGap unchanged pixels in a row
+        const int start = x;
+        int end = x;
+        while (x < n && x - end < minGap) {
+            if (pixels[x] != old[x])
+                end = x + 1;
+            x++;
+        }
+        runs.push_back(start);
+        runs.push_back(end);
+        x = end;
+    }
+    putVarint(runs.size() / 2);
+    int last = 0;
+    for (unsigned i = 0; i < runs.size(); i += 2) {
+        putVarint(runs[i] - last);
+        putVarint(runs[i + 1] - runs[i]);
+        putPixels(pixels + runs[i], runs[i + 1] - runs[i]);
+        last = runs[i + 1];
+    }
+    return *this;
+}
+
+void DrawingRecorder::putVarint(quint64 value)
+{
+    if (used + 10 > bufferSize)
+        flush();
+    while (value >= 0x80) {
+        buffer[used++] = char(value | 0x80);
+        value >>= 7;
+    }
+    buffer[used++] = char(value);
+}
+
+void DrawingRecorder::putBytes(const void *data, int n)
+{
+    if (used + n > bufferSize)
+        flush();
+    if (n > bufferSize) {
+        file.write(static_cast<const char *>(data), n);
+    } else {
+        std::memcpy(buffer + used, data, n);
+        used += n;
+    }
+}
+
+void DrawingRecorder::flush()
+{
+    if (used > 0)
+        file.write(buffer, used);
+    used = 0;
+}
+
+//--- DrawingRecordReader ----------------------------------------------
+
+//! Ouvre un enregistrement et lit son en-tête.
+/*!
+ * Le fichier est projeté en mémoire, sans copie.
+ */
+DrawingRecordReader::DrawingRecordReader(const char *fileName)
+    : width(0)
+    , height(0)
+    , file(QString::fromLocal8Bit(fileName))
+    , data(NULL)
+    , pos(NULL)
+    , end(NULL)
+    , valid(false)
+{
+    if (!file.open(QIODevice::ReadOnly) || file.size() <= 0)
+        return;
+    data = file.map(0, file.size());
+    if (!data)
+        return;
+    pos = data;
+    end = data + file.size();
+    valid = true;
+    if (!need(sizeof DrawingRecorder::magic)
+        || std::memcmp(pos, DrawingRecorder::magic,
+                       sizeof DrawingRecorder::magic) != 0) {
+        invalidate();
+        return;
+    }
+    pos += sizeof DrawingRecorder::magic;
+    if (getVarint() != quint64(DrawingRecorder::version))
+        invalidate();
+    width = getCount();
+    height = getCount();
+    if (width <= 0 || height <= 0)
+        invalidate();
+}
+
+DrawingRecordReader::~DrawingRecordReader()
+{
+    if (data)
+        file.unmap(data);
+}
+
+//! Indique si la lecture s'est bien passée jusque-là.
+bool DrawingRecordReader::isValid() const
+{
+    return valid;
+}
+
+bool DrawingRecordReader::atEnd() const
+{
+    return pos >= end;
+}
+
+//! Marque l'enregistrement comme illisible, et arrête la lecture.
+void DrawingRecordReader::invalidate()
+{
+    valid = false;
+    pos = end;
+}
+
+//! Lit une commande et sa date.
+/*!
+ * \param time          date de la commande précédente, mise à jour (µs)
+ * \return              commande, ou -1 en cas d'erreur
+ */
+int DrawingRecordReader::getCommand(qint64 &time)
+{
+    if (!need(1))
+        return -1;
+    const int command = *pos++;
+    time += getVarint();
+    return command;
+}
+
+int DrawingRecordReader::getInt()
+{
+    const quint32 z = getVarint();
+    return int(z >> 1) ^ -int(z & 1);
+}
+
+//! Lit un nombre d'éléments, borné par maxCount.
+int DrawingRecordReader::getCount()
+{
+    const quint64 n = getVarint();
+    if (n > quint64(maxCount)) {
+        invalidate();
+        return 0;
+    }
+    return int(n);
+}
+
+void DrawingRecordReader::getInts(int *values, int n)
+{
+    for (int i = 0; i < n; i++)
+        values[i] = getInt();
+}
+
+double DrawingRecordReader::getDouble()
+{
+    if (!need(8))
+        return 0.0;
+    quint64 bits = 0;
+    for (int i = 0; i < 8; i++)
+        bits |= quint64(pos[i]) << (8 * i);
+    pos += 8;
+    double value;
+    std::memcpy(&value, &bits, sizeof value);
+    return value;
+}
+
+void DrawingRecordReader::getDoubles(double *values, int n)
+{
+    for (int i = 0; i < n; i++)
+        values[i] = getDouble();
+}
+
+QRgb DrawingRecordReader::getColor()
+{
+    if (!need(4))
+        return 0;
+    const QRgb color = pos[0] | pos[1] << 8 | pos[2] << 16 | QRgb(pos[3]) << 24;
+    pos += 4;
+    return color;
+}
+
+QByteArray DrawingRecordReader::getString()
+{
+    const int n = getCount();
+    if (!need(n))
+        return QByteArray();
+    QByteArray s(reinterpret_cast<const char *>(pos), n);
+    pos += n;
+    return s;
+}
+
+void DrawingRecordReader::getPoints(QPoint *points, int n)
+{
+    QPoint previous(0, 0);
+    for (int i = 0; i < n; i++) {
+        const int dx = getInt();
+        const int dy = getInt();
+        points[i] = previous + QPoint(dx, dy);
+        previous = points[i];
+    }
+}
+
+//! Lit des segments, et leurs couleurs s'il y en a.
+/*!
+ * \return              true si les couleurs sont présentes
+ */
+bool DrawingRecordReader::getLines(QLine *lines, unsigned int *colors, int n)
+{
+    const bool colored = getInt();
+    QPoint previous(0, 0);
+    for (int i = 0; i < n; i++) {
+        int d[4];
+        getInts(d, 4);
+        const QPoint p1 = previous + QPoint(d[0], d[1]);
+        const QPoint p2 = p1 + QPoint(d[2], d[3]);
+        lines[i] = QLine(p1, p2);
+        previous = p2;
+    }
+    for (int i = 0; colored && i < n; i++)
+        colors[i] = getColor();
+    return colored;
+}
+
+void DrawingRecordReader::getPixels(QRgb *pixels, int n)
+{
+    if (!need(qint64(n) * 4))
+        return;
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    std::memcpy(pixels, pos, n * sizeof(QRgb));
+    pos += n * sizeof(QRgb);
+#else
+    for (int i = 0; i < n; i++)
+        pixels[i] = getColor();
+#endif
+}
+
+//! Lit les pixels modifiés d'une ligne, écrits par putChangedPixels.
+/*!
+ * Les pixels inchangés de la ligne ne sont pas touchés.
+ */
+void DrawingRecordReader::getChangedPixels(QRgb *pixels, int n)
+{
+    const int runs = getCount();
+    int x = 0;
+    for (int i = 0; i < runs && valid; i++) {
+        x += getCount();
+        const int length = getCount();
+        if (length > n - x) {
+            invalidate();
+            return;
+        }
+        getPixels(pixels + x, length);
+        x += length;
+    }
+}
+
+quint64 DrawingRecordReader::getVarint()
+{
+    quint64 value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (!need(1))
+            return 0;
+        const uchar b = *pos++;
+        value |= quint64(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return value;
+    }
+    invalidate();
+    return 0;
+}
+
+//! Vérifie qu'il reste au moins n octets à lire.
+bool DrawingRecordReader::need(qint64 n)
+{
+    if (valid && n <= end - pos)
+        return true;
+    invalidate();
+    return false;
+}
+
+#ifdef DRAWINGWINDOW_USE_SHM
+
+//--- DrawingFrameExport -----------------------------------------------
+
+//! Nombre de fenêtres déjà exportées.
+int DrawingFrameExport::count = 0;
+
+//! Crée l'export des trames d'une fenêtre, si c'est demandé.
+/*!
+ * L'export est demandé par la variable d'environnement
+ * DRAWINGWINDOW_EXPORT, qui donne le nom du segment.  Pour les
+ * fenêtres suivantes, ce nom est suffixé par ".1", ".2", etc.
+ *
+ * Le segment ne doit pas déjà exister : un segment de même nom, d'un
+ * autre programme en cours ou laissé par un arrêt brutal, n'est
+ * jamais repris, et l'export n'a pas lieu.
+ *
+ * \return              NULL si pas d'export
+ */
+DrawingFrameExport *DrawingFrameExport::create(const DrawingWindow &w)
+{
+    const char *env = getenv("DRAWINGWINDOW_EXPORT");
+    if (!env || !*env)
+        return NULL;
+    QByteArray name(env);
+    if (name[0] != '/')
+        name.prepend('/');
+    if (count > 0)
+        name += '.' + QByteArray::number(count);
+    count++;
+    DrawingFrameExport *frameExport = new DrawingFrameExport(name, w);
+    if (!frameExport->header) {
+        qWarning("DrawingWindow: cannot export frames to %s",
+                 name.constData());
+        delete frameExport;
+        frameExport = NULL;
+    }
+    return frameExport;
+}
+
+DrawingFrameExport::DrawingFrameExport(const QByteArray &name_,
+                                       const DrawingWindow &w)
+    : name(name_)
+    , header(NULL)
+    , size(0)
+    , generations(NULL)
+{
+    typedef DrawingWindow::SharedFrame SharedFrame;
+    const int tileSize = DrawingWindow::sharedTileSize;
+    const int tilesX = (w.width + tileSize - 1) / tileSize;
+    const int tilesY = (w.height + tileSize - 1) / tileSize;
+    // pixels on their own cache lines
+    const int pixelsOffset =
+        (sizeof(SharedFrame) + tilesX * tilesY * sizeof(int) + 63) & ~63;
+    size = pixelsOffset + size_t(w.width) * w.height * sizeof(QRgb);
+
+    // O_EXCL: taking over a segment still in use would make its
+    // viewers fault while it is resized
+    int fd = shm_open(name.constData(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        if (errno == EEXIST)
+            qWarning("DrawingWindow: shared memory segment %s already"
+                     " exists (another program, or left by a crash)",
+                     name.constData());
+        return;
+    }
+    void *data = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        shm_unlink(name.constData());
+        return;
+    }
+
+    // the segment is zero-filled: sequence, frame and generations are 0
+    header = static_cast<SharedFrame *>(data);
+    header->version = DrawingWindow::sharedFrameVersion;
+    header->width = w.width;
+    header->height = w.height;
+    header->tileSize = tileSize;
+    header->tilesX = tilesX;
+    header->tilesY = tilesY;
+    header->pixelsOffset = pixelsOffset;
+    header->closed = 0;
+    generations = reinterpret_cast<int *>(header + 1);
+    frame = QImage(static_cast<uchar *>(data) + pixelsOffset,
+                   w.width, w.height, QImage::Format_RGB32);
+    // the magic number last: a reader seeing it sees the rest
+    header->frame.fetchAndAddOrdered(0);
+    std::memcpy(header->magic, DrawingWindow::sharedFrameMagic,
+                sizeof header->magic);
+}
+
+//! Marque le segment comme fermé, et le supprime.
+/*!
+ * Les lecteurs qui l'ont déjà ouvert gardent la dernière trame.
+ */
+DrawingFrameExport::~DrawingFrameExport()
+{
+    if (!header)
+        return;
+    header->closed = 1;
+    header->sequence.fetchAndAddOrdered(2);
+    munmap(header, size);
+    shm_unlink(name.constData());
+}
+
+//! Publie une zone de la trame.
+/*!
+ * Les carreaux touchés par rect sont recomposés directement dans le
+ * segment, et marqués du numéro de la nouvelle trame.  Le compteur
+ * sequence est impair pendant l'écriture (seqlock) : un lecteur qui
+ * le trouve impair, ou changé après sa copie, recommence.  Le
+ * producteur n'attend jamais les lecteurs.
+ *
+ * \param backend       méthode d'affichage, pour la composition
+ * \param rect          zone modifiée
+ */
+void DrawingFrameExport::publish(DrawingBackend &backend, const QRect &rect)
+{
+    const QRect r = rect & frame.rect();
+    if (r.isEmpty())
+        return;
+    const int t = header->tileSize;
+    const int tx1 = r.left() / t;
+    const int tx2 = r.right() / t;
+    const int ty1 = r.top() / t;
+    const int ty2 = r.bottom() / t;
+    const QRect tiles(tx1 * t, ty1 * t, (tx2 - tx1 + 1) * t,
+                      (ty2 - ty1 + 1) * t);
+
+    const int next = header->frame + 1;
+    header->sequence.fetchAndAddOrdered(1);
+    backend.compose(frame, tiles);
+    for (int ty = ty1; ty <= ty2; ty++) {
+        for (int tx = tx1; tx <= tx2; tx++)
+            generations[ty * header->tilesX + tx] = next;
+    }
+    header->frame = next;
+    header->sequence.fetchAndAddOrdered(1);
+}
+
+#endif // DRAWINGWINDOW_USE_SHM
+
+//--- DrawingBackend ---------------------------------------------------
+
+//! Crée la méthode d'affichage d'une fenêtre.
+/*!
+ * \param w             fenêtre de dessin
+ * \param type          méthode demandée ; devient RasterBackend si
+ *                      elle n'est pas disponible
+ */
+DrawingBackend *DrawingBackend::create(DrawingWindow &w,
+                                       DrawingWindow::Backend &type)
+{
+    switch (type) {
+    case DrawingWindow::OpenGLBackend:
+#ifdef DRAWINGWINDOW_OPENGL
+        if (QGLFormat::hasOpenGL())
+            return new DrawingGLBackend(w);
+#endif
+        break;
+    case DrawingWindow::XShmBackend:
+#ifdef DRAWINGWINDOW_USE_XSHM
+        {
+            DrawingXShmBackend *b = new DrawingXShmBackend(w);
+            if (b->isValid())
+                return b;
+            delete b;
+        }
+#endif
+        break;
+    case DrawingWindow::HeadlessBackend:
+        return new DrawingHeadlessBackend(w);
+    case DrawingWindow::RasterBackend:
+        break;
+    }
+    if (type != DrawingWindow::RasterBackend)
+        qWarning("DrawingWindow: backend %d unavailable, using raster",
+                 static_cast<int>(type));
+    type = DrawingWindow::RasterBackend;
+    return new DrawingRasterBackend(w);
+}
+
+//! Constructeur.
+DrawingBackend::DrawingBackend(DrawingWindow &w)
+    : drawingWindow(w)
+{
+}
+
+//! Destructeur.
+DrawingBackend::~DrawingBackend()
+{
+}
+
+//! Demande l'affichage d'une zone de l'image.
+/*!
+ * Par défaut, génère un paintEvent de la zone correspondante de la
+ * fenêtre, selon la vue.
+ */
+void DrawingBackend::update(const QRect &rect)
+{
+    drawingWindow.update(drawingWindow.imageToWidget(rect));
+}
+
+//! Demande l'affichage complet, après un changement de vue.
+/*!
+ * Par défaut, génère un paintEvent de toute la fenêtre.
+ */
+void DrawingBackend::viewChanged()
+{
+    drawingWindow.update();
+}
+
+//! Termine immédiatement les affichages demandés, pour sync.
+void DrawingBackend::flush()
+{
+}
+
+//! Superpose les couches sur une zone, avec un QPainter.
+/*!
+ * Les images ne sont pas recopiées, mais partagées (voir QImage) :
+ * le mutex n'est tenu que le temps de les référencer.
+ */
+void DrawingBackend::paintLayers(QPainter &painter, const QRect &rect)
+{
+    DrawingWindow &w = drawingWindow;
+    QImage imageCopy[DrawingWindow::MAX_LAYERS];
+    w.imageMutex.lock();
+    imageCopy[0] = *w.presentedLayer(0);
+    for (int i = 1; i < DrawingWindow::MAX_LAYERS; i++) {
+        // only the layers having something drawn in the damaged area
+        // need to be composited
+        if (w.layers[i] && w.layerRects[i].intersects(rect))
+            imageCopy[i] = *w.presentedLayer(i);
+    }
+    w.imageMutex.unlock();
+    for (int i = 0; i < DrawingWindow::MAX_LAYERS; i++) {
+        if (!imageCopy[i].isNull())
+            painter.drawImage(rect, imageCopy[i], rect);
+    }
+}
+
+//! Vrai si la vue est agrandie.
+bool DrawingBackend::isViewZoomed() const
+{
+    return drawingWindow.isViewZoomed();
+}
+
+//! Transformation des coordonnées de l'image vers celles du widget.
+QTransform DrawingBackend::viewTransform() const
+{
+    return drawingWindow.viewTransform();
+}
+
+//! Zone de l'image visible dans une zone du widget.
+QRect DrawingBackend::viewSource(const QRect &rect) const
+{
+    return drawingWindow.widgetToImage(rect);
+}
+
+//! Signale la fin d'un affichage, pour la mesure de la latence.
+void DrawingBackend::presented()
+{
+    drawingWindow.presented();
+}
+
+//! Recopie les couches superposées sur une zone d'une image.
+/*!
+ * La zone est recopiée sous le mutex, ce qui évite la copie complète
+ * de l'image si le thread de dessin la modifie entre temps.
+ *
+ * \param dest          image de même taille que la fenêtre
+ * \param rect          zone à recopier
+ */
+void DrawingBackend::compose(QImage &dest, const QRect &rect)
+{
+    DrawingWindow &w = drawingWindow;
+    const QRect r = rect & dest.rect();
+    if (r.isEmpty())
+        return;
+    QPainter painter;
+    w.imageMutex.lock();
+    for (int y = r.top(); y <= r.bottom(); y++)
+        std::memcpy(reinterpret_cast<QRgb *>(dest.scanLine(y)) + r.left(),
+                    w.scanLine(w.presentedLayer(0), y) + r.left(),
+                    r.width() * sizeof(QRgb));
+    for (int i = 1; i < DrawingWindow::MAX_LAYERS; i++) {
+        if (w.layers[i] && w.layerRects[i].intersects(r)) {
+            if (!painter.isActive())
+                painter.begin(&dest);
+            painter.drawImage(r, *w.presentedLayer(i), r);
+        }
+    }
+    w.imageMutex.unlock();
+}
+
+//--- DrawingRasterBackend ---------------------------------------------
+
+//! Constructeur.
+DrawingRasterBackend::DrawingRasterBackend(DrawingWindow &w)
+    : DrawingBackend(w)
+{
+}
+
+//! Dessine une zone de l'image sur le widget, depuis paintEvent.
+/*!
+ * Si la vue est agrandie, QPainter rééchantillonne la zone de l'image
+ * visible (au plus proche voisin).
+ */
+void DrawingRasterBackend::paint(const QRect &rect)
+{
+    QPainter widgetPainter(&drawingWindow);
+    if (isViewZoomed()) {
+        widgetPainter.setTransform(viewTransform());
+        paintLayers(widgetPainter, viewSource(rect));
+    } else {
+        paintLayers(widgetPainter, rect);
+    }
+    presented();
+}
+
+//--- DrawingHeadlessBackend -------------------------------------------
+
+//! Constructeur.
+/*!
+ * La fenêtre n'est jamais affichée à l'écran, mais reçoit ses
+ * évènements comme si elle l'était (voir Qt::WA_DontShowOnScreen).
+ */
+DrawingHeadlessBackend::DrawingHeadlessBackend(DrawingWindow &w)
+    : DrawingBackend(w)
+{
+    w.setAttribute(Qt::WA_DontShowOnScreen);
+}
+
+//! Rien à afficher : la latence est nulle.
+void DrawingHeadlessBackend::update(const QRect &)
+{
+    presented();
+}
+
+//! Rien à afficher.
+void DrawingHeadlessBackend::viewChanged()
+{
+}
+
+//! Rien à afficher.
+void DrawingHeadlessBackend::paint(const QRect &)
+{
+}
+
+#ifdef DRAWINGWINDOW_OPENGL
+
+//--- DrawingGLBackend -------------------------------------------------
+
+//! Constructeur.
+/*!
+ * Le widget OpenGL recouvre la fenêtre, et lui laisse les évènements
+ * de souris et de clavier.
+ */
+DrawingGLBackend::DrawingGLBackend(DrawingWindow &w)
+    : DrawingBackend(w)
+    , texture(0)
+    , frame(w.width, w.height, QImage::Format_RGB32)
+{
+    view = new DrawingGLView(*this, &w);
+    view->setGeometry(0, 0, w.width, w.height);
+    view->setFocusPolicy(Qt::NoFocus);
+    view->setAttribute(Qt::WA_TransparentForMouseEvents);
+}
+
+//! Destructeur.
+DrawingGLBackend::~DrawingGLBackend()
+{
+    if (texture) {
+        view->makeCurrent();
+        glDeleteTextures(1, &texture);
+    }
+    delete view;
+}
+
+//! Note la zone à recopier dans la texture, et demande un rendu.
+void DrawingGLBackend::update(const QRect &rect)
+{
+    pending |= rect;
+    view->update();
+}
+
+//! Demande un rendu : la vue ne change que les coordonnées de texture.
+void DrawingGLBackend::viewChanged()
+{
+    view->update();
+}
+
+//! Fait le rendu OpenGL immédiatement.
+void DrawingGLBackend::flush()
+{
+    if (!pending.isEmpty())
+        view->updateGL();
+}
+
+//! Rien à faire : le widget OpenGL recouvre la fenêtre.
+void DrawingGLBackend::paint(const QRect &)
+{
+}
+
+//! Crée la texture, de la taille de la fenêtre.
+void DrawingGLBackend::initializeGL()
+{
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, frame.width(), frame.height(),
+                 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+    pending = frame.rect();
+}
+
+//! Recopie la zone modifiée dans la texture, et l'affiche.
+/*!
+ * Les pixels de l'image (QRgb, 0xAARRGGBB) sont envoyés tels quels
+ * grâce au format GL_BGRA / GL_UNSIGNED_INT_8_8_8_8_REV.  La vue est
+ * appliquée par les coordonnées de texture.
+ *
+ * \param width, height         taille du widget
+ */
+void DrawingGLBackend::paintGL(int width, int height)
+{
+    glBindTexture(GL_TEXTURE_2D, texture);
+    if (!pending.isEmpty()) {
+        const QRect r = pending & frame.rect();
+        pending = QRect();
+        compose(frame, r);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, frame.width());
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, r.x());
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, r.y());
+        glTexSubImage2D(GL_TEXTURE_2D, 0, r.x(), r.y(), r.width(), r.height(),
+                        GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                        frame.constBits());
+    }
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(0, width, height, 0, -1, 1);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    // visible part of the image, in texture coordinates
+    const QTransform inverse = viewTransform().inverted();
+    const QPointF t1 = inverse.map(QPointF(0, 0));
+    const QPointF t2 = inverse.map(QPointF(frame.width(), frame.height()));
+    const GLfloat u1 = t1.x() / frame.width();
+    const GLfloat v1 = t1.y() / frame.height();
+    const GLfloat u2 = t2.x() / frame.width();
+    const GLfloat v2 = t2.y() / frame.height();
+    glEnable(GL_TEXTURE_2D);
+    glBegin(GL_QUADS);
+    glTexCoord2f(u1, v1);
+    glVertex2i(0, 0);
+    glTexCoord2f(u2, v1);
+    glVertex2i(width, 0);
+    glTexCoord2f(u2, v2);
+    glVertex2i(width, height);
+    glTexCoord2f(u1, v2);
+    glVertex2i(0, height);
+    glEnd();
+    presented();
+}
+
+//--- DrawingGLView ----------------------------------------------------
+
+//! Constructeur.
+DrawingGLView::DrawingGLView(DrawingGLBackend &b, QWidget *parent)
+    : QGLWidget(parent)
+    , backend(b)
+{
+}
+
+/*!
+ * \see QGLWidget
+ */
+void DrawingGLView::initializeGL()
+{
+    backend.initializeGL();
+}
+
+/*!
+ * \see QGLWidget
+ */
+void DrawingGLView::resizeGL(int width, int height)
+{
+    glViewport(0, 0, width, height);
+}
+
+/*!
+ * \see QGLWidget
+ */
+void DrawingGLView::paintGL()
+{
+    backend.paintGL(width(), height());
+}
+
+#endif // DRAWINGWINDOW_OPENGL
+
+#ifdef DRAWINGWINDOW_USE_XSHM
+
+//--- DrawingXShmBackend -----------------------------------------------
+
+//! Constructeur.
+/*!
+ * Crée l'image partagée.  En cas d'échec (serveur distant, format de
+ * pixels différent de celui de QImage::Format_RGB32...), isValid
+ * retourne false.
+ */
+DrawingXShmBackend::DrawingXShmBackend(DrawingWindow &w)
+    : DrawingBackend(w)
+    , display(QX11Info::display())
+    , ximage(NULL)
+    , attached(false)
+    , gc(0)
+{
+    shminfo.shmid = -1;
+    shminfo.shmaddr = reinterpret_cast<char *>(-1);
+    if (!display || !XShmQueryExtension(display))
+        return;
+    ximage = XShmCreateImage(display,
+                             static_cast<Visual *>(QX11Info::appVisual()),
+                             QX11Info::appDepth(), ZPixmap, NULL, &shminfo,
+                             w.width, w.height);
+    if (!ximage || ximage->bits_per_pixel != 32
+        || ximage->red_mask != 0xff0000 || ximage->green_mask != 0xff00
+        || ximage->blue_mask != 0xff) {
+        release();
+        return;
+    }
+    shminfo.shmid = shmget(IPC_PRIVATE, ximage->bytes_per_line * ximage->height,
+                           IPC_CREAT | 0600);
+    if (shminfo.shmid != -1) {
+        shminfo.shmaddr = static_cast<char *>(shmat(shminfo.shmid, NULL, 0));
+        if (shminfo.shmaddr != reinterpret_cast<char *>(-1)) {
+            ximage->data = shminfo.shmaddr;
+            shminfo.readOnly = False;
+            attached = XShmAttach(display, &shminfo);
+            XSync(display, False);
+        }
+        // the segment is freed once detached by both sides
+        shmctl(shminfo.shmid, IPC_RMID, NULL);
+    }
+    if (!attached) {
+        release();
+        return;
+    }
+    frame = QImage(reinterpret_cast<uchar *>(ximage->data),
+                   w.width, w.height, ximage->bytes_per_line,
+                   QImage::Format_RGB32);
+    w.setAttribute(Qt::WA_PaintOnScreen);
+    gc = XCreateGC(display, w.winId(), 0, NULL);
+}
+
+//! Destructeur.
+DrawingXShmBackend::~DrawingXShmBackend()
+{
+    release();
+}
+
+//! Vrai si l'image partagée a pu être créée.
+bool DrawingXShmBackend::isValid() const
+{
+    return gc != 0;
+}
+
+//! Recopie une zone de l'image dans l'image partagée, et l'affiche.
+/*!
+ * Appelée depuis paintEvent.  On attend que le serveur X ait lu
+ * l'image partagée avant de rendre la main, pour qu'elle ne soit pas
+ * modifiée entre temps.  Si la vue est agrandie, la zone visible est
+ * composée à part, puis rééchantillonnée dans l'image partagée.
+ */
+void DrawingXShmBackend::paint(const QRect &rect)
+{
+    const QRect r = rect & frame.rect();
+    if (r.isEmpty())
+        return;
+    if (isViewZoomed()) {
+        const QRect src = viewSource(r);
+        if (source.isNull())
+            source = QImage(frame.size(), QImage::Format_RGB32);
+        compose(source, src);
+        QPainter painter(&frame);
+        painter.setClipRect(r);
+        painter.setTransform(viewTransform());
+        painter.drawImage(src, source, src);
+    } else {
+        compose(frame, r);
+    }
+    XShmPutImage(display, drawingWindow.winId(), gc, ximage,
+                 r.x(), r.y(), r.x(), r.y(), r.width(), r.height(), False);
+    XSync(display, False);
+    presented();
+}
+
+//! Libère les ressources X11 et la mémoire partagée.
+void DrawingXShmBackend::release()
+{
+    frame = QImage();
+    source = QImage();
+    if (gc) {
+        XFreeGC(display, gc);
+        gc = 0;
+    }
+    if (attached) {
+        XShmDetach(display, &shminfo);
+        XSync(display, False);
+        attached = false;
+    }
+    if (ximage) {
+        ximage->data = NULL;
+        XDestroyImage(ximage);
+        ximage = NULL;
+    }
+    if (shminfo.shmaddr != reinterpret_cast<char *>(-1)) {
+        shmdt(shminfo.shmaddr);
+        shminfo.shmaddr = reinterpret_cast<char *>(-1);
+    }
+}
+
+#endif // DRAWINGWINDOW_USE_XSHM
@@ -1,20 +1,37 @@
 #ifndef DRAWING_WINDOW_H
 #define DRAWING_WINDOW_H
 
+#include <QAtomicInt>
 #include <QBasicTimer>
 #include <QColor>
+#include <QElapsedTimer>
 #include <QFont>
+#include <QFuture>
 #include <QImage>
+#include <QLine>
 #include <QMutex>
 #include <QPainter>
 #include <QPen>
+#include <QPoint>
 #include <QRect>
+#include <QRectF>
+#include <QSemaphore>
+#include <QTransform>
 #include <QWaitCondition>
 #include <QWidget>
 #include <Qt>
 #include <string>
-
+#include <vector>
+
+class DrawingBackend;
+class DrawingCanvas;
+class DrawingFrameExport;
+class DrawingLatency;
+class DrawingPresenter;
+class DrawingRecorder;
+class DrawingTask;
 class DrawingThread;
+class QTemporaryFile;
 
 class DrawingWindow: public QWidget {
 public:
@@ -22,6 +39,32 @@ public:
 
     static const int DEFAULT_WIDTH = 640;
     static const int DEFAULT_HEIGHT = 480;
+    static const int MAX_LAYERS = 4;
+
+    static const int sharedTileSize = 64;
+    static const int sharedFrameVersion = 1;
+    static const char sharedFrameMagic[4];
+
+    struct SharedFrame {
+        char magic[4];                  //!< "DWFB"
+        int version;                    //!< sharedFrameVersion
+        int width;                      //!< largeur de la fenêtre
+        int height;                     //!< hauteur de la fenêtre
+        int tileSize;                   //!< côté des carreaux
+        int tilesX;                     //!< nombre de carreaux par ligne
+        int tilesY;                     //!< nombre de lignes de carreaux
+        int pixelsOffset;               //!< position des pixels
+        int closed;                     //!< fenêtre fermée
+        QBasicAtomicInt sequence;       //!< impair pendant une écriture
+        QBasicAtomicInt frame;          //!< numéro de la dernière trame
+    };
+
+    enum Backend {
+        RasterBackend,          //!< QPainter sur le widget
+        OpenGLBackend,          //!< texture OpenGL
+        XShmBackend,            //!< mémoire partagée X11 (MIT-SHM)
+        HeadlessBackend         //!< aucun affichage
+    };
 
     DrawingWindow(ThreadFunction fun,
                   int width_ = DEFAULT_WIDTH, int height_ = DEFAULT_HEIGHT);
@@ -51,9 +94,15 @@ public:
     void setFont(const QFont &font);
 
     void setAntialiasing(bool state);
+    void setSupersampling(int factor);
+    int getSupersampling() const;
 
     void clearGraph();
 
+    void setLayer(int layer);
+    int getLayer() const;
+    void clearLayer();
+
     void drawPoint(int x, int y);
     void drawLine(int x1, int y1, int x2, int y2);
     void drawRect(int x1, int y1, int x2, int y2);
@@ -63,57 +112,210 @@ public:
     void drawTriangle(int x1, int y1, int x2, int y2, int x3, int y3);
     void fillTriangle(int x1, int y1, int x2, int y2, int x3, int y3);
 
+    void drawPointF(double x, double y);
+    void drawLineF(double x1, double y1, double x2, double y2);
+    void drawCircleF(double x, double y, double r);
+    void fillCircleF(double x, double y, double r);
+    void drawTriangleF(double x1, double y1, double x2, double y2,
+                       double x3, double y3);
+    void fillTriangleF(double x1, double y1, double x2, double y2,
+                       double x3, double y3);
+
+    void drawPolyline(const QPoint *points, int n);
+    void drawLines(const QLine *lines, int n);
+    void drawLines(const QLine *lines, const unsigned int *colors, int n);
+
     void drawText(int x, int y, const char *text, int flags = 0);
     void drawText(int x, int y, const std::string &text, int flags = 0);
     void drawTextBg(int x, int y, const char *text, int flags = 0);
     void drawTextBg(int x, int y, const std::string &text, int flags = 0);
 
+    void setWorld(double xmin, double ymin, double xmax, double ymax);
+    void resetWorld();
+    void translateWorld(double dx, double dy);
+    void scaleWorld(double kx, double ky);
+    void pushWorld();
+    void popWorld();
+
+    int worldToX(double x) const;
+    int worldToY(double y) const;
+    double xToWorld(int x) const;
+    double yToWorld(int y) const;
+    void worldToWindow(const double *x, const double *y,
+                       QPoint *points, int n) const;
+
+    void drawWorldPoint(double x, double y);
+    void drawWorldLine(double x1, double y1, double x2, double y2);
+    void drawWorldRect(double x1, double y1, double x2, double y2);
+    void fillWorldRect(double x1, double y1, double x2, double y2);
+    void drawWorldCircle(double x, double y, int r);
+    void fillWorldCircle(double x, double y, int r);
+    void drawWorldTriangle(double x1, double y1, double x2, double y2,
+                           double x3, double y3);
+    void fillWorldTriangle(double x1, double y1, double x2, double y2,
+                           double x3, double y3);
+    void drawWorldPolyline(const double *x, const double *y, int n);
+
     unsigned int getPointColor(int x, int y) const;
 
+    int saveArea(int x1, int y1, int x2, int y2);
+    void restoreArea(int area);
+
+    QFuture<bool> saveImageAsync(const char *fileName,
+                                 const char *format = NULL);
+
+    void drawCanvas(DrawingCanvas &canvas, int x, int y);
+
+    unsigned int *lockPixels();
+    int getPixelStride() const;
+    void unlockPixels();
+    void unlockPixels(int x1, int y1, int x2, int y2);
+
     bool waitMousePress(int &x, int &y, int &button,
                         unsigned long time = ULONG_MAX);
     bool sync(unsigned long time = ULONG_MAX);
 
+    bool waitNextFrame(unsigned long time = ULONG_MAX);
+    double frameTime() const;
+    int frameSteps(double step);
+    void setFrameRate(double fps);
+    double getFrameRate() const;
+
+    double getLatency(double quantile) const;
+    int getLatencyCount() const;
+    void resetLatency();
+    void setLatencyOverlay(bool state);
+
     void closeGraph();
 
     static void sleep(unsigned long secs);
     static void msleep(unsigned long msecs);
     static void usleep(unsigned long usecs);
 
+    static void setSharedMode(bool state, int maxThreads = 0);
+    static bool getSharedMode();
+
+    static void setDefaultBackend(Backend backend);
+    static Backend getDefaultBackend();
+    Backend getBackend() const;
+
+    static bool replay(DrawingWindow &w, const char *fileName,
+                       bool realTime = false);
+    static bool getRecordSize(const char *fileName, int &width, int &height);
+
 protected:
     //! \cond show_protected
     void closeEvent(QCloseEvent *ev);
     void customEvent(QEvent *ev);
     void mousePressEvent(QMouseEvent *ev);
+    void mouseMoveEvent(QMouseEvent *ev);
+    void mouseReleaseEvent(QMouseEvent *ev);
+    void wheelEvent(QWheelEvent *ev);
     void keyPressEvent(QKeyEvent *ev);
     void paintEvent(QPaintEvent *ev);
     void showEvent(QShowEvent *ev);
     void timerEvent(QTimerEvent *ev);
+    QPaintEngine *paintEngine() const;
     //! \endcond
 
 private:
-    //! Intervalle de temps entre deux rendus (ms)
+    //! Intervalle de temps minimal entre deux rendus, par défaut (ms)
     static const int paintInterval = 33;
-
+    //! Délai d'arrêt de la fonction de dessin, avant de tuer son thread (ms)
+    static const int stopTimeout = 250;
+    //! Retard maximal rattrapé par frameSteps (s)
+    static const double maxFrameLag;
+    //! Coordonnée maximale (en valeur absolue) issue du monde
+    static const double maxWindowCoord;
+    //! Agrandissement maximal de la vue
+    static const double maxViewScale;
+    //! Nombre maximal d'enregistrements en cours (saveImageAsync)
+    static const int maxPendingSaves = 4;
+    //! Attente maximale des enregistrements en cours, à la destruction (ms)
+    static const int saveTimeout = 5000;
+
+    static bool sharedMode;
+    static int sharedThreads;
+    static int defaultBackend;
+
+    bool shared;
     QBasicTimer timer;
     QMutex imageMutex;
     QMutex inputMutex;
     QWaitCondition inputCondition;
     QMutex syncMutex;
     QWaitCondition syncCondition;
-    bool terminateThread;
+    QWaitCondition frameCondition;
+    QAtomicInt terminateThread;
     int lockCount;
 
+    QImage *layers[MAX_LAYERS];
+    QPainter *layerPainters[MAX_LAYERS];
+    QRect layerRects[MAX_LAYERS];
+    int layer;
+
+    int supersampling;
+    QImage *resolved[MAX_LAYERS];
+
+    // coordonnées du monde : fenêtre = scale * monde + offset
+    struct WorldTransform {
+        double scaleX, scaleY;
+        double offsetX, offsetY;
+    };
+    WorldTransform world;
+    std::vector<WorldTransform> worldStack;
+    std::vector<QPoint> worldPoints;
+
     QImage *image;
     QPainter *painter;
 
     QPoint mousePos;
     Qt::MouseButton mouseButton;
 
+    // vue, thread graphique seulement : widget = scale * (image - origin)
+    double viewScale;
+    QPointF viewOrigin;
+    bool panning;
+    QPoint panPos;
+
     bool dirtyFlag;
     QRect dirtyRect;
+    qint64 dirtyTime;           // première modification non rendue (ns)
+
+    // latence, thread graphique : date de la plus ancienne
+    // modification passée à backend et pas encore affichée
+    qint64 pendingTime;
+    DrawingLatency *latency;
+    QAtomicInt latencyOverlay;
+    bool overlayShown;
+
+    QElapsedTimer frameClock;
+    qint64 frameTimestamp;
+    QAtomicInt frameInterval;   // intervalle minimal entre deux rendus
+    QAtomicInt presentRequested;
+    qint64 lastPresent;         // date du dernier rendu (ms)
+    double currentFrameTime;
+    double stepTime;
+
+    struct SavedArea {
+        bool used;              // false once restored
+        int layer;
+        QRect rect;
+        std::vector<QRgb> pixels;
+    };
+    std::vector<SavedArea> savedAreas;
+    std::vector<int> freeAreas;
+
+    QSemaphore *saveSlots;
 
     DrawingThread *thread;
+    DrawingTask *task;
+
+    Backend backendType;
+    DrawingBackend *backend;
+
+    DrawingRecorder *recorder;
+    DrawingFrameExport *frameExport;
 
     void initialize(ThreadFunction fun);
 
@@ -121,6 +323,21 @@ private:
     void setBgColor(const QColor &color);
     QColor getColor();
     QColor getBgColor();
+    void setBrush(bool state);
+    void setBgMode(bool state);
+    void recordPixels(const QRect &rect);
+
+    QRgb *scanLine(const QImage *img, int y);
+    static int roundCoord(double v);
+    QRect deviceRect(const QRect &rect) const;
+    const QImage *presentedLayer(int i) const;
+
+    bool isViewZoomed() const;
+    QTransform viewTransform() const;
+    QPoint widgetToImage(const QPoint &pos) const;
+    QRect widgetToImage(const QRect &rect) const;
+    QRect imageToWidget(const QRect &rect) const;
+    void setView(double scale, const QPointF &origin);
 
     void safeLock(QMutex &mutex);
     void safeUnlock(QMutex &mutex);
@@ -129,10 +346,114 @@ private:
     void dirty(int x, int y);
     void dirty(int x1, int y1, int x2, int y2);
     void dirty(const QRect &rect);
+    void dirty(const QRectF &rect);
+
+    static QRect boundingRect(const QPoint *points, int n);
+    static QRect boundingRect(const QLine *lines, int n);
 
+    qint64 clockTime() const;
+    void presented();
+    QRect overlayRect() const;
+    void paintOverlay();
+
+    void requestPresent();
+    void schedulePresent();
     void mayUpdate();
+    void resolve(const QRect &rect);
+    void downsample(const QImage *src, QImage *dest, const QRect &rect);
+    void nextFrame();
+    void stopDrawing();
     void realSync();
     void realDrawText(int x, int y, const char *text, int flags);
+    static bool saveSnapshot(std::vector<QImage> snapshot,
+                             QString fileName, QByteArray format,
+                             QSemaphore *slots);
+
+    friend class DrawingBackend;
+    friend class DrawingCanvas;
+    friend class DrawingPresenter;
+    friend class DrawingTask;
+    friend class DrawingThread;
+};
+
+class DrawingCanvas {
+public:
+    static const int TILE_SIZE = 256;
+
+    DrawingCanvas(int width_, int height_,
+                  unsigned int bgColor_ = 0xffffff, int maxTiles_ = 0);
+    ~DrawingCanvas();
+
+    const int width;
+    const int height;
+
+    void setColor(unsigned int color);
+    void setColor(const char *name);
+    void setColor(float red, float green, float blue);
+
+    void setPenWidth(int width);
+    void setAntialiasing(bool state);
+
+    void clear();
+
+    void drawPoint(int x, int y);
+    void drawLine(int x1, int y1, int x2, int y2);
+    void drawRect(int x1, int y1, int x2, int y2);
+    void fillRect(int x1, int y1, int x2, int y2);
+    void drawCircle(int x, int y, int r);
+    void fillCircle(int x, int y, int r);
+    void drawPolyline(const QPoint *points, int n);
+
+    unsigned int getPointColor(int x, int y) const;
+
+    void setMaxTiles(int n);
+    int getMaxTiles() const;
+    int getAllocatedTiles() const;
+    int getResidentTiles() const;
+
+private:
+    // propriétaire des carreaux et du fichier : pas de copie
+    Q_DISABLE_COPY(DrawingCanvas)
+
+    struct Tile {
+        QImage *image;          // NULL si jamais dessiné, ou évincé
+        qint64 slot;            // place dans le fichier, -1 si aucune
+        unsigned int lastUse;
+        bool modified;          // depuis le dernier enregistrement
+    };
+
+    // Forme à dessiner sur tous les carreaux qu'elle touche
+    struct Shape {
+        enum Kind { Line, Rect, Ellipse, Polyline } kind;
+        QRect bounds;
+        QLine line;
+        QRect rect;
+        const QPoint *points;
+        int n;
+    };
+
+    const int tilesX;
+    const int tilesY;
+    const QRgb bgColor;
+    int maxTiles;
+
+    std::vector<Tile> tiles;
+    std::vector<int> resident;
+    int allocated;
+    unsigned int useClock;
+    qint64 slots;
+    mutable QTemporaryFile *store;
+
+    QPen pen;
+    bool antialiasing;
+    bool filling;
+
+    QImage *tile(int i);
+    void evict();
+    void paint(const Shape &shape);
+    void readTile(int i, QImage &image) const;
+
+    friend class DrawingWindow;
 };
 
 #endif // !DRAWING_WINDOW_H
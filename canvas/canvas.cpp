@@ -0,0 +1,58 @@
+#include <DrawingWindow.h>
+#include <QApplication>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+
+// Taille du canevas : bien plus grand que la fenêtre
+const int largeur = 100000;
+const int hauteur = 2000;
+
+// Trace une courbe sur toute la largeur du canevas, puis fait défiler
+// la fenêtre le long de la courbe.  Seuls les carreaux touchés par la
+// courbe sont alloués, et au plus 64 restent en mémoire.
+void canvas(DrawingWindow &w)
+{
+    DrawingCanvas c(largeur, hauteur, 0x101010, 64);
+
+    // grille
+    c.setColor(0x303030);
+    for (int x = 0; x < largeur; x += 500)
+        c.drawLine(x, 0, x, hauteur - 1);
+    // courbe
+    c.setColor("yellow");
+    c.setPenWidth(2);
+    c.setAntialiasing(true);
+    int py = hauteur / 2;
+    for (int x = 1; x < largeur; x++) {
+        int y = hauteur / 2
+            + int((hauteur / 3) * std::sin(x / 900.0) * std::cos(x / 7100.0));
+        c.drawLine(x - 1, py, x, y);
+        py = y;
+    }
+    std::cerr << "carreaux alloués : " << c.getAllocatedTiles()
+              << " sur " << ((largeur + DrawingCanvas::TILE_SIZE - 1)
+                             / DrawingCanvas::TILE_SIZE)
+        * ((hauteur + DrawingCanvas::TILE_SIZE - 1)
+           / DrawingCanvas::TILE_SIZE)
+              << ", en mémoire : " << c.getResidentTiles() << std::endl;
+
+    // défilement, à 600 pixels par seconde
+    while (w.waitNextFrame()) {
+        int cx = int(600.0 * w.frameTime()) % (largeur - w.width);
+        int cy = c.height / 2 - w.height / 2;
+        w.drawCanvas(c, cx, cy);
+        std::ostringstream os;
+        os << "x = " << cx;
+        w.setColor("white");
+        w.drawText(5, 5, os.str());
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication application(argc, argv);
+    DrawingWindow window(canvas, 640, 480);
+    window.show();
+    return application.exec();
+}
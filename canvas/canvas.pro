@@ -0,0 +1,12 @@
+TEMPLATE = app
+TARGET = canvas
+
+CONFIG += qt
+CONFIG += debug
+
+INCLUDEPATH += ../
+DEPENDPATH += ../
+
+HEADERS += ../DrawingWindow.h
+SOURCES += ../DrawingWindow.cpp \
+           canvas.cpp
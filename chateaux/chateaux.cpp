@@ -1,5 +1,6 @@
 #include <QApplication>
 #include <DrawingWindow.h>
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <ctime>
@@ -33,6 +34,8 @@ const float positionChateau2 = 85.0;
 const float g = 9.81;
 const float k = 0.005;
 const float dt = 0.05;
+// durée réelle d'un pas de simulation (s)
+const float dtReel = 0.01;
 
 int nbJoueurs = 2;
 int score1 = 0;
@@ -60,28 +63,6 @@ float deg2rad(float deg)
     return deg * PI / 180.0;
 }
 
-// conversion coordonnées réelles -> coordonnées fenêtre
-int rtowX(const DrawingWindow& w, float rx)
-{
-    return (int )roundf((w.width - 1) * (rx - rXMin) / (rXMax - rXMin));
-}
-
-int rtowY(const DrawingWindow& w, float ry)
-{
-    return (int )roundf((w.height - 1) * (rYMax - ry) / (rYMax - rYMin));
-}
-
-// conversion coordonnées fenêtre -> coordonnées réelles
-float wtorX(const DrawingWindow& w, int wx)
-{
-    return (rXMax - rXMin) * wx / (w.width - 1) + rXMin;
-}
-
-float wtorY(const DrawingWindow& w, int wy)
-{
-    return -(rYMax - rYMin) * wy / (w.height - 1) + rYMax;
-}
-
 float hauteurMontagne(float largeur, float hauteur, float x)
 {
     float rx = 2.0 * x / largeur;
@@ -90,14 +71,14 @@ float hauteurMontagne(float largeur, float hauteur, float x)
 
 void dessineTerrain(DrawingWindow& w, float largeur, float hauteur)
 {
-    int y0 = rtowY(w, 0) + 1;
-    int xmin = rtowX(w, -largeur / 2.0) - 1;
-    int xmax = rtowX(w, largeur / 2.0) + 1;
+    int y0 = w.worldToY(0) + 1;
+    int xmin = w.worldToX(-largeur / 2.0) - 1;
+    int xmax = w.worldToX(largeur / 2.0) + 1;
     w.setColor("forestgreen");
     for (int x = xmin; x <= xmax; x++) {
-        float rx = wtorX(w, x);
+        float rx = w.xToWorld(x);
         float ry = hauteurMontagne(largeur, hauteur, rx);
-        int y = rtowY(w, ry);
+        int y = w.worldToY(ry);
         if (y <= y0)
             w.drawLine(x, y0, x, y);
     }
@@ -105,36 +86,39 @@ void dessineTerrain(DrawingWindow& w, float largeur, float hauteur)
     w.fillRect(0, y0 + 1, w.width - 1, w.height - 1);
 }
 
+// le château est dessiné dans son propre repère, centré en 0
 void dessineChateau(DrawingWindow& w, float position)
 {
-    w.setColor("black");
+    w.pushWorld();
+    w.translateWorld(position, 0);
     w.setColor("darkslategray");
-    int y1 = rtowY(w, 0);
-    int h0 = rtowY(w, 3);
-    int h1 = rtowY(w, 4);
+    int y1 = w.worldToY(0);
+    int h0 = w.worldToY(3);
+    int h1 = w.worldToY(4);
     for (int i = 0; i < 7; i++) {
         int h = i % 2 ? h0 : h1;
-        int x1 = rtowX(w, position + i - 3.5);
-        int x2 = rtowX(w, position + i - 2.5) - 1;
+        int x1 = w.worldToX(i - 3.5);
+        int x2 = w.worldToX(i - 2.5) - 1;
         w.fillRect(x1, y1, x2, h);
     }
     w.setColor("dimgray");
-    h0 = rtowY(w, 6);
-    h1 = rtowY(w, 7);
+    h0 = w.worldToY(6);
+    h1 = w.worldToY(7);
     for (int i = 0; i < 5; i++) {
         int h = i % 2 ? h0 : h1;
-        int x1 = rtowX(w, position + i - 8.5);
-        int x2 = rtowX(w, position + i - 7.5) - 1;
+        int x1 = w.worldToX(i - 8.5);
+        int x2 = w.worldToX(i - 7.5) - 1;
         w.fillRect(x1, y1, x2, h);
-        x1 = rtowX(w, position + i + 3.5);
-        x2 = rtowX(w, position + i + 4.5) - 1;
+        x1 = w.worldToX(i + 3.5);
+        x2 = w.worldToX(i + 4.5) - 1;
         w.fillRect(x1, y1, x2, h);
     }
+    w.popWorld();
 }
 
 void dessineVent(DrawingWindow &w, float vitesse)
 {
-    int lg = rtowX(w, vitesse) - rtowX(w, 0);
+    int lg = w.worldToX(vitesse) - w.worldToX(0);
     int dir = lg > 0 ? 1 : -1;
     int y = 20;
     w.setColor("black");
@@ -155,27 +139,32 @@ void dessineVent(DrawingWindow &w, float vitesse)
 
 void dessineExplosion(DrawingWindow& w, float rx, float ry)
 {
-    const int maxray = rtowX(w, 2.5) - rtowX(w, 0);
+    const int maxray = w.worldToX(2.5) - w.worldToX(0);
     // 1/2 rouge -> rouge -> jaune
-    const int x = rtowX(w, rx);
-    const int y = rtowY(w, ry);
-    int i;
-    for (i = 0; i <= maxray / 3; i++) {
-        w.setColor(0.5 + 3.0 * i / (2.0 * maxray), 0.0, 0.0);
-        w.drawCircle(x, y, i);
-        w.msleep(20);
-    }
-    for (/* i */; i < maxray; i++) {
-        w.setColor(1.0, 1.5 * i / maxray - 0.5, 0.0);
-        w.drawCircle(x, y, i);
-        w.msleep(20);
-    }
-    w.setColor("skyblue");
-    for (i = 0; i < maxray; i++) {
-        w.drawCircle(x, y, i);
-        w.msleep(10);
+    const int x = w.worldToX(rx);
+    const int y = w.worldToY(ry);
+    // l'explosion est dessinée sur la couche 1, pour ne pas abîmer le décor
+    w.setLayer(1);
+    // le rayon grandit d'un pixel toutes les 20 ms
+    w.waitNextFrame();
+    const double t0 = w.frameTime();
+    int i = 0;
+    while (i < maxray) {
+        int imax = std::min(maxray, (int )((w.frameTime() - t0) / 0.02) + 1);
+        for (/* i */; i < imax; i++) {
+            if (i <= maxray / 3)
+                w.setColor(0.5 + 3.0 * i / (2.0 * maxray), 0.0, 0.0);
+            else
+                w.setColor(1.0, 1.5 * i / maxray - 0.5, 0.0);
+            w.drawCircle(x, y, i);
+        }
+        w.waitNextFrame();
     }
-    //    w.fillCircle(x, y, maxray - 1);
+    const double t1 = w.frameTime();
+    while (w.frameTime() - t1 < 0.01 * maxray)
+        w.waitNextFrame();
+    w.clearLayer();
+    w.setLayer(0);
 }
 
 void dessineFlammes(DrawingWindow& w, float x0, float y0)
@@ -191,12 +180,12 @@ void dessineFlammes(DrawingWindow& w, float x0, float y0)
         float blue = 0;
         w.setColor(red, green, blue);
         while (y >= 0.0) {
-            w.drawPoint(rtowX(w, x), rtowY(w, y));
+            w.drawWorldPoint(x, y);
             x += vx * dt;
             y += vy * dt;
             vy -= 9.81 * dt;
         }
-        w.msleep(30);
+        w.waitNextFrame();
     }
 }
 
@@ -205,6 +194,7 @@ void initialise(DrawingWindow& w)
     largeurMont = frand(largeurMin, largeurMax);
     hauteurMont = frand(hauteurMin, hauteurMax);
     wnd = frand(-ventMax, ventMax);
+    w.setWorld(rXMin, rYMin, rXMax, rYMax);
     w.setBgColor("skyblue");
     w.clearGraph();
     dessineTerrain(w, largeurMont, hauteurMont);
@@ -212,13 +202,13 @@ void initialise(DrawingWindow& w)
     dessineChateau(w, positionChateau1);
     dessineChateau(w, positionChateau2);
     w.setColor("wheat");
-    w.drawText(rtowX(w, positionChateau1), rtowY(w, 0) + 8, "Joueur 1",
+    w.drawText(w.worldToX(positionChateau1), w.worldToY(0) + 8, "Joueur 1",
                Qt::AlignHCenter);
-    w.drawText(rtowX(w, positionChateau2), rtowY(w, 0) + 8, "Joueur 2",
+    w.drawText(w.worldToX(positionChateau2), w.worldToY(0) + 8, "Joueur 2",
                Qt::AlignHCenter);
     std::stringstream s;
     s << score1 << " / " << score2;
-    w.drawText(rtowX(w, 0), rtowY(w, 0) + 8, s.str(),
+    w.drawText(w.worldToX(0), w.worldToY(0) + 8, s.str(),
                Qt::AlignHCenter);
 }
 
@@ -233,44 +223,48 @@ int tir(DrawingWindow& w,
     x = x0;
     y = y0;
     int collision = 0;
+    // le projectile est dessiné sur la couche 1 : il suffit d'effacer
+    // cette couche pour le faire disparaître, sans toucher au décor
+    w.setLayer(1);
+    w.setColor("black");
+    // on oublie le temps écoulé avant le tir
+    w.waitNextFrame();
+    w.frameSteps(dtReel);
     do {
-        int wx = rtowX(w, x);
-        int wy = rtowY(w, y);
-        w.setColor("black");
-        w.fillCircle(wx, wy, 2);
-
-        float vxr = vx - wnd;
-        float kvr = -k * sqrt(vxr * vxr + vy * vy);
-        float ax = kvr * vxr;
-        float ay = kvr * vy - g;
-        x += vx * dt;
-        y += vy * dt;
-        vx += ax * dt;
-        vy += ay * dt;
-
-        w.msleep(10);
-//         w.sync();
-        w.setColor("skyblue");
-        w.fillCircle(wx, wy, 2);
-//         w.setColor("black");
-//         w.drawPoint(wx, wy);
+        w.clearLayer();
+        w.fillWorldCircle(x, y, 2);
+        w.waitNextFrame();
+
+        // avance la simulation jusqu'à la date de la trame
+        for (int n = w.frameSteps(dtReel); n > 0 && !collision; n--) {
+            float vxr = vx - wnd;
+            float kvr = -k * sqrt(vxr * vxr + vy * vy);
+            float ax = kvr * vxr;
+            float ay = kvr * vy - g;
+            x += vx * dt;
+            y += vy * dt;
+            vx += ax * dt;
+            vy += ay * dt;
 
-        if (y <= 0) {
-            collision = 3;
-        } else if (y < hauteurChateau) {
-            if (positionChateau1 - largeurChateau <= x
-                && positionChateau1 + largeurChateau >= x)
-                collision = 1;
-            else if (positionChateau2 - largeurChateau <= x
-                       && positionChateau2 + largeurChateau >= x)
-                collision = 2;
-        }
-        if (!collision) {
-            float h = hauteurMontagne(largeurMont, hauteurMont, x);
-            if (h > 0 && y < h)
+            if (y <= 0) {
                 collision = 3;
+            } else if (y < hauteurChateau) {
+                if (positionChateau1 - largeurChateau <= x
+                    && positionChateau1 + largeurChateau >= x)
+                    collision = 1;
+                else if (positionChateau2 - largeurChateau <= x
+                         && positionChateau2 + largeurChateau >= x)
+                    collision = 2;
+            }
+            if (!collision) {
+                float h = hauteurMontagne(largeurMont, hauteurMont, x);
+                if (h > 0 && y < h)
+                    collision = 3;
+            }
         }
     } while (!collision);
+    w.clearLayer();
+    w.setLayer(0);
     return collision == 3 ? 0 : collision;
 }
 
@@ -4,6 +4,25 @@ TARGET = exemple
 CONFIG += qt
 CONFIG += debug
 
+#CONFIG += drawingwindow_opengl
+#CONFIG += drawingwindow_xshm
+#CONFIG += drawingwindow_shm
+
+drawingwindow_opengl {
+	QT += opengl
+	DEFINES += DRAWINGWINDOW_OPENGL
+}
+
+drawingwindow_xshm {
+	DEFINES += DRAWINGWINDOW_XSHM
+	LIBS += -lXext
+}
+
+drawingwindow_shm {
+	DEFINES += DRAWINGWINDOW_SHM
+	LIBS += -lrt
+}
+
 HEADERS += DrawingWindow.h
 SOURCES += DrawingWindow.cpp
 
@@ -0,0 +1,512 @@
+#include "HashLife.h"
+#include <DrawingWindow.h>
+#include <algorithm>
+
+/*! \class HashLife
+ *  \brief Moteur HashLife pour le jeu de la vie.
+ *
+ * Algorithme de Gosper, pour étudier de très grands motifs sur des
+ * millions de générations.  L'univers, infini, est un quadtree : un
+ * nœud de niveau n représente un carré de 2^n × 2^n cellules, et ses
+ * quatre fils sont les quatre quarts de ce carré.  Les nœuds sont
+ * uniques (hash-consing) : deux carrés identiques, où qu'ils soient
+ * et à quelque génération que ce soit, sont représentés par le même
+ * nœud.
+ *
+ * Pour chaque nœud de niveau n, le résultat (le carré central de
+ * niveau n - 1, 2^min(k, n - 2) générations plus tard) est calculé une
+ * fois pour toutes, puis mémorisé dans le nœud.  Ceci permet
+ * d'avancer de 2^k générations en un seul appel à step, en un temps
+ * qui ne dépend que de la régularité du motif.
+ *
+ * Les nœuds sont rangés dans un tableau, et désignés par leur
+ * indice.  Les nœuds 0 et 1 sont les deux cellules (morte et
+ * vivante).  Lorsque le nombre de nœuds dépasse un seuil, les nœuds
+ * qui ne sont plus utilisés sont récupérés (ramasse-miettes), entre
+ * deux appels à step ou pendant le calcul d'un résultat.  Le seuil
+ * est la limite donnée à la construction, ou le double du nombre de
+ * nœuds conservés par la récupération précédente s'il est plus
+ * grand : un motif qui occupe presque toute la limite ne déclenche
+ * pas une récupération à chaque appel.
+ *
+ * La cellule (0, 0) est au centre de l'univers : la racine de niveau
+ * n couvre les coordonnées -2^(n-1) à 2^(n-1) - 1.
+ */
+
+/*! \var HashLife::DEFAULT_MAX_NODES
+ *  \brief Nombre de nœuds par défaut au-delà duquel on récupère la mémoire.
+ */
+
+const HashLife::index HashLife::NONE;
+
+//! Constructeur.
+/*!
+ * Construit un univers vide.
+ *
+ * \param maxNodes_     nombre de nœuds au-delà duquel les nœuds
+ *                      inutilisés sont récupérés
+ */
+HashLife::HashLife(int maxNodes_)
+    : maxNodes(maxNodes_)
+{
+    clear();
+}
+
+//! Vide l'univers.
+void HashLife::clear()
+{
+    nodes.clear();
+    freeNodes.clear();
+    emptyNodes.clear();
+    pinned.clear();
+    for (int i = 0; i < 2; i++) {
+        Node leaf = { NONE, NONE, NONE, NONE, NONE, NONE, 0, false };
+        nodes.push_back(leaf);
+    }
+    liveNodes = 2;
+    collectThreshold = maxNodes;
+    buckets.assign(1 << 16, NONE);
+    stepLog = 0;
+    generation = 0;
+    root = empty(3);
+}
+
+//! Change l'état d'une cellule.
+/*!
+ * \param x, y          coordonnées de la cellule
+ * \param alive         true pour une cellule vivante
+ */
+void HashLife::setCell(qint64 x, qint64 y, bool alive)
+{
+    for (;;) {
+        qint64 half = Q_INT64_C(1) << (nodes[root].level - 1);
+        if (-half <= x && x < half && -half <= y && y < half) {
+            root = setCell(root, nodes[root].level, x + half, y + half, alive);
+            return;
+        }
+        root = expand(root);
+    }
+}
+
+//! Retourne l'état d'une cellule.
+/*!
+ * \param x, y          coordonnées de la cellule
+ * \return              true si la cellule est vivante
+ */
+bool HashLife::getCell(qint64 x, qint64 y) const
+{
+    qint64 half = Q_INT64_C(1) << (nodes[root].level - 1);
+    if (x < -half || half <= x || y < -half || half <= y)
+        return false;
+    return getCell(root, nodes[root].level, x + half, y + half);
+}
+
+//! Avance de 2^k générations.
+/*!
+ * Les résultats mémorisés ne sont valables que pour une valeur de k :
+ * changer k souvent est donc coûteux.
+ *
+ * \param k             logarithme en base 2 du nombre de générations
+ */
+void HashLife::step(int k)
+{
+    if (k != stepLog) {
+        clearResults();
+        stepLog = k;
+    }
+    // Le motif doit tenir dans le quart central de la racine : il ne
+    // peut pas s'étendre de plus de 2^k cellules dans chaque direction.
+    while (nodes[root].level < k + 3 || !isCentred(root))
+        root = expand(root);
+    pinned.push_back(expand(root));
+    root = result(pinned.back());
+    pinned.pop_back();
+    generation += Q_UINT64_C(1) << k;
+    if (liveNodes > collectThreshold)
+        collect();
+}
+
+//! Retourne le numéro de la génération courante.
+quint64 HashLife::getGeneration() const
+{
+    return generation;
+}
+
+//! Retourne le niveau de la racine.
+/*!
+ * La racine couvre un carré de 2^niveau cellules de côté, centré en
+ * (0, 0).
+ */
+int HashLife::getLevel() const
+{
+    return nodes[root].level;
+}
+
+//! Retourne le nombre de nœuds en mémoire.
+int HashLife::getNodeCount() const
+{
+    return liveNodes;
+}
+
+//! Dessine une partie de l'univers dans une fenêtre.
+/*!
+ * Chaque pixel de la fenêtre représente un carré de 2^zoom × 2^zoom
+ * cellules, dessiné avec la couleur alive s'il contient au moins une
+ * cellule vivante.  Seuls les nœuds non vides et visibles sont
+ * parcourus.
+ *
+ * \param w             fenêtre de dessin
+ * \param x0, y0        coordonnées de la cellule en haut à gauche
+ * \param zoom          logarithme en base 2 du côté d'un pixel
+ * \param alive         couleur des cellules vivantes
+ * \param dead          couleur des cellules mortes
+ */
+void HashLife::draw(DrawingWindow &w, qint64 x0, qint64 y0, int zoom,
+                    unsigned int alive, unsigned int dead)
+{
+    View view;
+    view.zoom = zoom;
+    // aligne la vue sur les pixels, pour qu'un petit nœud ne soit
+    // jamais à cheval sur deux pixels
+    view.x0 = x0 & ~((Q_INT64_C(1) << zoom) - 1);
+    view.y0 = y0 & ~((Q_INT64_C(1) << zoom) - 1);
+    view.x1 = view.x0 + (qint64(w.width) << zoom);
+    view.y1 = view.y0 + (qint64(w.height) << zoom);
+    view.pitch = w.getPixelStride();
+    view.factor = w.getSupersampling();
+    view.alive = alive;
+    view.pixels = w.lockPixels();
+    std::fill(view.pixels,
+              view.pixels + view.factor * w.height * view.pitch, dead);
+    qint64 half = Q_INT64_C(1) << (nodes[root].level - 1);
+    draw(view, root, -half, -half);
+    w.unlockPixels();
+}
+
+//! Fonction de hachage des nœuds.
+quint32 HashLife::hash(index nw, index ne, index sw, index se)
+{
+    quint32 h = nw * 0x9e3779b1U;
+    h = (h ^ (h >> 15)) + ne * 0x85ebca6bU;
+    h = (h ^ (h >> 13)) + sw * 0xc2b2ae35U;
+    h = (h ^ (h >> 16)) + se * 0x27d4eb2fU;
+    return h ^ (h >> 15);
+}
+
+//! Retourne le nœud de fils donnés.
+/*!
+ * Le nœud est créé s'il n'existe pas encore.
+ */
+HashLife::index HashLife::join(index nw, index ne, index sw, index se)
+{
+    index &bucket = buckets[hash(nw, ne, sw, se) & (buckets.size() - 1)];
+    for (index i = bucket; i != NONE; i = nodes[i].next) {
+        const Node &n = nodes[i];
+        if (n.nw == nw && n.ne == ne && n.sw == sw && n.se == se)
+            return i;
+    }
+    Node node = { nw, ne, sw, se, bucket, NONE,
+                  qint8(nodes[nw].level + 1), false };
+    index i;
+    if (freeNodes.empty()) {
+        i = nodes.size();
+        nodes.push_back(node);
+    } else {
+        i = freeNodes.back();
+        freeNodes.pop_back();
+        nodes[i] = node;
+    }
+    bucket = i;
+    if (++liveNodes > 2 * (int )buckets.size())
+        rehash(2 * buckets.size());
+    return i;
+}
+
+//! Retourne le nœud vide de niveau donné.
+HashLife::index HashLife::empty(int level)
+{
+    if (emptyNodes.empty())
+        emptyNodes.push_back(0);
+    while ((int )emptyNodes.size() <= level) {
+        index e = emptyNodes.back();
+        emptyNodes.push_back(join(e, e, e, e));
+    }
+    return emptyNodes[level];
+}
+
+//! Retourne le carré central d'un nœud, sans le faire évoluer.
+HashLife::index HashLife::centre(index n)
+{
+    index nw = nodes[n].nw;
+    index ne = nodes[n].ne;
+    index sw = nodes[n].sw;
+    index se = nodes[n].se;
+    return join(nodes[nw].se, nodes[ne].sw, nodes[sw].ne, nodes[se].nw);
+}
+
+//! Retourne le résultat d'un nœud.
+/*!
+ * C'est le carré central du nœud n, de niveau level - 1, après
+ * 2^min(stepLog, level - 2) générations.  Le nœud doit être au moins
+ * de niveau 2.
+ *
+ * Les nœuds peuvent être récupérés au début de chaque appel : n doit
+ * être dans pinned, ainsi que tous les nœuds que l'appelant utilise
+ * encore après l'appel.
+ */
+HashLife::index HashLife::result(index n)
+{
+    if (nodes[n].result != NONE)
+        return nodes[n].result;
+    if (liveNodes > collectThreshold)
+        collect();
+    int level = nodes[n].level;
+    index r;
+    if (level == 2) {
+        r = base(n);
+    } else {
+        const std::size_t top = pinned.size();
+        const Node a = nodes[nodes[n].nw];
+        const Node b = nodes[nodes[n].ne];
+        const Node c = nodes[nodes[n].sw];
+        const Node d = nodes[nodes[n].se];
+        // les neuf sous-carrés de niveau level - 1, se chevauchant
+        index sub[9] = {
+            nodes[n].nw,
+            join(a.ne, b.nw, a.se, b.sw),
+            nodes[n].ne,
+            join(a.sw, a.se, c.nw, c.ne),
+            join(a.se, b.sw, c.ne, d.nw),
+            join(b.sw, b.se, d.nw, d.ne),
+            nodes[n].sw,
+            join(c.ne, d.nw, c.se, d.sw),
+            nodes[n].se,
+        };
+        // pas complet : deux fois 2^(level - 3) générations ; sinon,
+        // la première moitié se contente de recentrer
+        bool full = stepLog >= level - 2;
+        // join ne récupère jamais de nœuds, mais result peut le
+        // faire : tout nœud encore utile après l'appel est dans pinned
+        pinned.insert(pinned.end(), sub, sub + 9);
+        for (int i = 0; i < 9; i++) {
+            sub[i] = full ? result(sub[i]) : centre(sub[i]);
+            pinned[top + i] = sub[i];
+        }
+        index q[4] = {
+            join(sub[0], sub[1], sub[3], sub[4]),
+            join(sub[1], sub[2], sub[4], sub[5]),
+            join(sub[3], sub[4], sub[6], sub[7]),
+            join(sub[4], sub[5], sub[7], sub[8]),
+        };
+        pinned.resize(top);
+        pinned.insert(pinned.end(), q, q + 4);
+        for (int i = 0; i < 4; i++) {
+            q[i] = result(q[i]);
+            pinned[top + i] = q[i];
+        }
+        pinned.resize(top);
+        r = join(q[0], q[1], q[2], q[3]);
+    }
+    nodes[n].result = r;
+    return r;
+}
+
+//! Résultat d'un nœud de niveau 2 (4 × 4 cellules), par simple calcul.
+HashLife::index HashLife::base(index n)
+{
+    // cellules du carré 4 × 4, une ligne de 4 bits par ligne du carré
+    int bits[4] = { 0, 0, 0, 0 };
+    const index quarter[4] = {
+        nodes[n].nw, nodes[n].ne, nodes[n].sw, nodes[n].se
+    };
+    for (int q = 0; q < 4; q++) {
+        const Node &m = nodes[quarter[q]];
+        int x = 2 * (q % 2);
+        int y = 2 * (q / 2);
+        bits[y] |= (m.nw << x) | (m.ne << (x + 1));
+        bits[y + 1] |= (m.sw << x) | (m.se << (x + 1));
+    }
+    index cell[4];
+    for (int i = 0; i < 4; i++) {
+        int x = 1 + i % 2;
+        int y = 1 + i / 2;
+        int count = 0;
+        for (int dy = -1; dy <= 1; dy++)
+            for (int dx = -1; dx <= 1; dx++)
+                if (dx || dy)
+                    count += (bits[y + dy] >> (x + dx)) & 1;
+        bool alive = (bits[y] >> x) & 1;
+        cell[i] = count == 3 || (count == 2 && alive);
+    }
+    return join(cell[0], cell[1], cell[2], cell[3]);
+}
+
+//! Double la taille d'un nœud, en le plaçant au centre d'un nœud vide.
+HashLife::index HashLife::expand(index n)
+{
+    index e = empty(nodes[n].level - 1);
+    index nw = nodes[n].nw;
+    index ne = nodes[n].ne;
+    index sw = nodes[n].sw;
+    index se = nodes[n].se;
+    return join(join(e, e, e, nw), join(e, e, ne, e),
+                join(e, sw, e, e), join(se, e, e, e));
+}
+
+//! Vrai si les cellules du nœud sont toutes dans sa moitié centrale.
+bool HashLife::isCentred(index n)
+{
+    index e = empty(nodes[n].level - 2);
+    const Node &a = nodes[nodes[n].nw];
+    const Node &b = nodes[nodes[n].ne];
+    const Node &c = nodes[nodes[n].sw];
+    const Node &d = nodes[nodes[n].se];
+    return a.nw == e && a.ne == e && a.sw == e
+        && b.nw == e && b.ne == e && b.se == e
+        && c.nw == e && c.sw == e && c.se == e
+        && d.ne == e && d.sw == e && d.se == e;
+}
+
+//! Change l'état d'une cellule du nœud n, de coin (0, 0).
+HashLife::index HashLife::setCell(index n, int level, qint64 x, qint64 y,
+                                  bool alive)
+{
+    if (level == 0)
+        return alive ? 1 : 0;
+    qint64 half = Q_INT64_C(1) << (level - 1);
+    index nw = nodes[n].nw;
+    index ne = nodes[n].ne;
+    index sw = nodes[n].sw;
+    index se = nodes[n].se;
+    if (y < half) {
+        if (x < half)
+            nw = setCell(nw, level - 1, x, y, alive);
+        else
+            ne = setCell(ne, level - 1, x - half, y, alive);
+    } else {
+        if (x < half)
+            sw = setCell(sw, level - 1, x, y - half, alive);
+        else
+            se = setCell(se, level - 1, x - half, y - half, alive);
+    }
+    return join(nw, ne, sw, se);
+}
+
+//! Retourne l'état d'une cellule du nœud n, de coin (0, 0).
+bool HashLife::getCell(index n, int level, qint64 x, qint64 y) const
+{
+    while (level > 0) {
+        qint64 half = Q_INT64_C(1) << --level;
+        const Node &m = nodes[n];
+        if (y < half)
+            n = x < half ? m.nw : m.ne;
+        else
+            n = x < half ? m.sw : m.se;
+        if (x >= half)
+            x -= half;
+        if (y >= half)
+            y -= half;
+    }
+    return n == 1;
+}
+
+//! Oublie tous les résultats mémorisés.
+void HashLife::clearResults()
+{
+    for (unsigned i = 0; i < nodes.size(); i++)
+        nodes[i].result = NONE;
+}
+
+//! Reconstruit la table de hachage.
+/*!
+ * \param size          nouveau nombre d'entrées (puissance de 2)
+ */
+void HashLife::rehash(int size)
+{
+    buckets.assign(size, NONE);
+    for (unsigned i = 2; i < nodes.size(); i++) {
+        Node &n = nodes[i];
+        if (n.level < 0)
+            continue;
+        index &bucket = buckets[hash(n.nw, n.ne, n.sw, n.se) & (size - 1)];
+        n.next = bucket;
+        bucket = i;
+    }
+}
+
+//! Marque un nœud et ses descendants comme utilisés.
+void HashLife::mark(index n)
+{
+    if (nodes[n].marked)
+        return;
+    nodes[n].marked = true;
+    if (nodes[n].level > 0) {
+        mark(nodes[n].nw);
+        mark(nodes[n].ne);
+        mark(nodes[n].sw);
+        mark(nodes[n].se);
+    }
+}
+
+//! Ramasse-miettes.
+/*!
+ * Seuls sont conservés la racine, les nœuds vides, les nœuds de
+ * pinned (en cours d'utilisation par result), et leurs descendants.
+ * Un résultat mémorisé est gardé si le nœud résultat est conservé.
+ * Le seuil de la récupération suivante est ensuite recalculé.
+ */
+void HashLife::collect()
+{
+    mark(root);
+    for (unsigned i = 0; i < emptyNodes.size(); i++)
+        mark(emptyNodes[i]);
+    for (unsigned i = 0; i < pinned.size(); i++)
+        mark(pinned[i]);
+    // avant d'effacer les marques : un résultat n'est gardé que si
+    // son nœud est conservé
+    for (unsigned i = 0; i < nodes.size(); i++) {
+        Node &n = nodes[i];
+        if (n.result != NONE && !nodes[n.result].marked)
+            n.result = NONE;
+    }
+    freeNodes.clear();
+    liveNodes = 0;
+    for (unsigned i = 0; i < nodes.size(); i++) {
+        Node &n = nodes[i];
+        if (n.marked || i < 2) {
+            n.marked = false;
+            liveNodes++;
+        } else {
+            n.level = -1;
+            freeNodes.push_back(i);
+        }
+    }
+    rehash(buckets.size());
+    collectThreshold = qMax(maxNodes, 2 * liveNodes);
+}
+
+//! Dessine le nœud n, de coin (x, y).
+void HashLife::draw(const View &view, index n, qint64 x, qint64 y)
+{
+    int level = nodes[n].level;
+    qint64 size = Q_INT64_C(1) << level;
+    if (n == empty(level) || x + size <= view.x0 || view.x1 <= x
+        || y + size <= view.y0 || view.y1 <= y)
+        return;
+    if (level <= view.zoom) {
+        int px = (x - view.x0) >> view.zoom;
+        int py = (y - view.y0) >> view.zoom;
+        // un bloc de factor × factor pixels si la fenêtre est
+        // suréchantillonnée
+        unsigned int *p = view.pixels + view.factor * (py * view.pitch + px);
+        for (int j = 0; j < view.factor; j++, p += view.pitch)
+            std::fill(p, p + view.factor, view.alive);
+        return;
+    }
+    qint64 half = size / 2;
+    const Node m = nodes[n];
+    draw(view, m.nw, x, y);
+    draw(view, m.ne, x + half, y);
+    draw(view, m.sw, x, y + half);
+    draw(view, m.se, x + half, y + half);
+}
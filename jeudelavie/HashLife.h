@@ -0,0 +1,86 @@
+#ifndef HASH_LIFE_H
+#define HASH_LIFE_H
+
+#include <QtGlobal>
+#include <vector>
+
+class DrawingWindow;
+
+class HashLife {
+public:
+    static const int DEFAULT_MAX_NODES = 1 << 22;
+
+    HashLife(int maxNodes_ = DEFAULT_MAX_NODES);
+
+    void clear();
+    void setCell(qint64 x, qint64 y, bool alive);
+    bool getCell(qint64 x, qint64 y) const;
+
+    void step(int k);
+    quint64 getGeneration() const;
+    int getLevel() const;
+    int getNodeCount() const;
+
+    void draw(DrawingWindow &w, qint64 x0, qint64 y0, int zoom,
+              unsigned int alive, unsigned int dead);
+
+private:
+    typedef quint32 index;
+    static const index NONE = 0xffffffffU;
+
+    struct Node {
+        index nw, ne, sw, se;   // fils (cellules pour le niveau 0)
+        index next;             // suivant dans la table de hachage
+        index result;           // centre après 2^min(stepLog, level-2) gén.
+        qint8 level;            // -1 pour un nœud libre
+        bool marked;
+    };
+
+    struct View {
+        unsigned int *pixels;
+        int pitch;
+        int factor;
+        qint64 x0, y0, x1, y1;
+        int zoom;
+        unsigned int alive;
+    };
+
+    const int maxNodes;
+
+    std::vector<Node> nodes;
+    std::vector<index> buckets;
+    std::vector<index> freeNodes;
+    std::vector<index> emptyNodes;
+    std::vector<index> pinned;
+    int liveNodes;
+    int collectThreshold;
+
+    index root;
+    int stepLog;
+    quint64 generation;
+
+    static quint32 hash(index nw, index ne, index sw, index se);
+    index join(index nw, index ne, index sw, index se);
+    index empty(int level);
+    index centre(index n);
+    index result(index n);
+    index base(index n);
+    index expand(index n);
+    bool isCentred(index n);
+
+    index setCell(index n, int level, qint64 x, qint64 y, bool alive);
+    bool getCell(index n, int level, qint64 x, qint64 y) const;
+
+    void clearResults();
+    void rehash(int size);
+    void mark(index n);
+    void collect();
+
+    void draw(const View &view, index n, qint64 x, qint64 y);
+};
+
+#endif // !HASH_LIFE_H
+
+// Local variables:
+// mode: c++
+// End:
@@ -0,0 +1,286 @@
+#include "LifeEngine.h"
+#include <DrawingWindow.h>
+#include <QThread>
+#include <QtConcurrentMap>
+#include <algorithm>
+#include <cstring>
+
+/*! \class LifeEngine
+ *  \brief Moteur rapide pour le jeu de la vie.
+ *
+ * L'univers est un tore de width × height cellules.  Chaque cellule
+ * est codée par un bit : une ligne de 64 cellules tient dans un mot
+ * de 64 bits.  Le nombre de voisins vivants est calculé pour 64
+ * cellules à la fois par des additionneurs binaires (opérations bit à
+ * bit), et plusieurs mots sont traités ensemble grâce aux
+ * instructions vectorielles (SSE2, AVX2) quand le compilateur les
+ * utilise.
+ *
+ * Le calcul d'une génération, comme le dessin, est réparti par
+ * bandes de lignes sur tous les processeurs.  Le dessin est écrit
+ * directement dans les pixels de la fenêtre (voir
+ * DrawingWindow::lockPixels).
+ *
+ * Chaque ligne est précédée et suivie d'un mot de bord, et la grille
+ * est entourée d'une ligne de bord en haut et en bas.  Avant chaque
+ * génération, les bords reçoivent une copie des cellules du côté
+ * opposé (voir wrap).  La cellule x d'une ligne est le bit x % 64 du
+ * mot 1 + x / 64.
+ */
+
+// Vecteurs de 4 mots avec AVX2, de 2 mots avec SSE2.
+#if defined(__GNUC__) && defined(__AVX2__)
+#  define LIFE_VECTOR_WORDS 4
+#elif defined(__GNUC__) && defined(__SSE2__)
+#  define LIFE_VECTOR_WORDS 2
+#endif
+#ifdef LIFE_VECTOR_WORDS
+typedef quint64 lifevec
+    __attribute__((vector_size(LIFE_VECTOR_WORDS * sizeof(quint64))));
+#endif
+
+namespace {
+
+    template <typename W>
+    inline W load(const quint64 *p)
+    {
+        W w;
+        std::memcpy(&w, p, sizeof w);
+        return w;
+    }
+
+    template <typename W>
+    inline void store(quint64 *p, const W &w)
+    {
+        std::memcpy(p, &w, sizeof w);
+    }
+
+    // Additionneur complet : s = a + b + c (bit de poids faible), c = retenue.
+    template <typename W>
+    inline void add3(const W &a, const W &b, const W &c, W &s, W &carry)
+    {
+        W t = a ^ b;
+        s = t ^ c;
+        carry = (a & b) | (t & c);
+    }
+
+    // Calcule la génération suivante pour les mots p[0], p[1], ...
+    // (un ou plusieurs selon W) de la ligne row, up et down étant les
+    // lignes du dessus et du dessous.
+    template <typename W>
+    inline W evolve(const quint64 *up, const quint64 *row,
+                    const quint64 *down)
+    {
+        const W u = load<W>(up);
+        const W c = load<W>(row);
+        const W d = load<W>(down);
+        // voisins à gauche (x - 1) et à droite (x + 1), ramenés en x
+        const W uw = (u << 1) | (load<W>(up - 1) >> 63);
+        const W ue = (u >> 1) | (load<W>(up + 1) << 63);
+        const W cw = (c << 1) | (load<W>(row - 1) >> 63);
+        const W ce = (c >> 1) | (load<W>(row + 1) << 63);
+        const W dw = (d << 1) | (load<W>(down - 1) >> 63);
+        const W de = (d >> 1) | (load<W>(down + 1) << 63);
+
+        // somme des 8 voisins, bit à bit : n = 4.b2 + 2.b1 + b0 (mod 8)
+        W s0, c0, s1, c1, b0, c3, t, c4;
+        add3(uw, u, ue, s0, c0);
+        add3(cw, ce, dw, s1, c1);
+        const W s2 = d ^ de;
+        const W c2 = d & de;
+        add3(s0, s1, s2, b0, c3);
+        add3(c0, c1, c2, t, c4);
+        const W b1 = t ^ c3;
+        const W b2 = c4 ^ (t & c3);
+
+        // vivante si n = 3, ou si n = 2 et déjà vivante
+        return b1 & ~b2 & (b0 | c);
+    }
+
+}
+
+//! Constructeur.
+/*!
+ * Construit un univers vide.
+ *
+ * \param width_        largeur de l'univers
+ * \param height_       hauteur de l'univers
+ */
+LifeEngine::LifeEngine(int width_, int height_)
+    : width(width_)
+    , height(height_)
+    , words((width_ + 63) / 64)
+    , stride(words + 2)
+    , lastMask(width_ % 64 ? (word(1) << (width_ % 64)) - 1 : ~word(0))
+    , cells((height_ + 2) * stride)
+    , nextCells((height_ + 2) * stride)
+{
+    // quelques bandes par processeur, pour équilibrer la charge
+    int n = qMin(height, 4 * QThread::idealThreadCount());
+    bands.resize(n);
+    for (int i = 0; i < n; i++) {
+        bands[i].engine = this;
+        bands[i].y1 = i * height / n;
+        bands[i].y2 = (i + 1) * height / n;
+    }
+}
+
+//! Tue toutes les cellules.
+void LifeEngine::clear()
+{
+    std::fill(cells.begin(), cells.end(), 0);
+}
+
+//! Change l'état d'une cellule.
+/*!
+ * \param x, y          coordonnées de la cellule
+ * \param alive         true pour une cellule vivante
+ */
+void LifeEngine::setCell(int x, int y, bool alive)
+{
+    word &w = cells[(y + 1) * stride + 1 + x / 64];
+    word bit = word(1) << (x % 64);
+    if (alive)
+        w |= bit;
+    else
+        w &= ~bit;
+}
+
+//! Retourne l'état d'une cellule.
+/*!
+ * \param x, y          coordonnées de la cellule
+ * \return              true si la cellule est vivante
+ */
+bool LifeEngine::getCell(int x, int y) const
+{
+    return (cells[(y + 1) * stride + 1 + x / 64] >> (x % 64)) & 1;
+}
+
+//! Calcule la génération suivante.
+void LifeEngine::step()
+{
+    wrap();
+    QtConcurrent::blockingMap(bands, stepBand);
+    cells.swap(nextCells);
+}
+
+//! Dessine l'univers dans une fenêtre.
+/*!
+ * La cellule (x, y) est dessinée par le pixel (x, y) de la fenêtre,
+ * qui doit donc être au moins aussi grande que l'univers (par un
+ * bloc de pixels du tampon si elle est suréchantillonnée).
+ *
+ * \param w             fenêtre de dessin
+ * \param alive         couleur des cellules vivantes
+ * \param dead          couleur des cellules mortes
+ */
+void LifeEngine::draw(DrawingWindow &w, unsigned int alive, unsigned int dead)
+{
+    const int f = w.getSupersampling();
+    const int pitch = w.getPixelStride();
+    unsigned int *pixels = w.lockPixels();
+    for (unsigned i = 0; i < bands.size(); i++) {
+        bands[i].pixels = pixels + f * bands[i].y1 * pitch;
+        bands[i].pitch = pitch;
+        bands[i].factor = f;
+        bands[i].alive = alive;
+        bands[i].dead = dead;
+    }
+    QtConcurrent::blockingMap(bands, drawBand);
+    w.unlockPixels(0, 0, width - 1, height - 1);
+}
+
+//! Recopie les bords de l'univers.
+/*!
+ * Pour chaque ligne, le bit 63 du mot de bord gauche reçoit la
+ * dernière cellule de la ligne, et le bit suivant la dernière cellule
+ * reçoit la première.  Les lignes de bord reçoivent ensuite la
+ * dernière et la première ligne.
+ */
+void LifeEngine::wrap()
+{
+    const int last = 64 + width - 1;     // position de la dernière cellule
+    const int after = 64 + width;        // position suivant la dernière
+    for (int y = 1; y <= height; y++) {
+        word *row = &cells[y * stride];
+        row[words] &= lastMask;
+        row[words + 1] = 0;
+        row[0] = ((row[last / 64] >> (last % 64)) & 1) << 63;
+        row[after / 64] |= (row[1] & 1) << (after % 64);
+    }
+    std::memcpy(&cells[0], &cells[height * stride], stride * sizeof(word));
+    std::memcpy(&cells[(height + 1) * stride], &cells[stride],
+                stride * sizeof(word));
+}
+
+//! Calcule la génération suivante pour les lignes y1 à y2 - 1.
+void LifeEngine::stepRows(int y1, int y2)
+{
+    for (int y = y1 + 1; y <= y2; y++) {
+        const word *up = &cells[(y - 1) * stride];
+        const word *row = &cells[y * stride];
+        const word *down = &cells[(y + 1) * stride];
+        word *dest = &nextCells[y * stride];
+        int i = 1;
+#ifdef LIFE_VECTOR_WORDS
+        for (/* i */; i + LIFE_VECTOR_WORDS - 1 <= words;
+             i += LIFE_VECTOR_WORDS)
+            store(dest + i, evolve<lifevec>(up + i, row + i, down + i));
+#endif
+        for (/* i */; i <= words; i++)
+            dest[i] = evolve<word>(up + i, row + i, down + i);
+        dest[words] &= lastMask;
+    }
+}
+
+//! Dessine les lignes y1 à y2 - 1.
+/*!
+ * Si la fenêtre est suréchantillonnée, chaque cellule remplit un bloc
+ * de factor × factor pixels.
+ *
+ * \param pixels        adresse du premier pixel de la ligne y1
+ * \param pitch         nombre de pixels par ligne
+ * \param factor        facteur de suréchantillonnage de la fenêtre
+ * \param y1, y2        lignes à dessiner
+ * \param alive, dead   couleurs des cellules vivantes et mortes
+ */
+void LifeEngine::drawRows(unsigned int *pixels, int pitch, int factor,
+                          int y1, int y2,
+                          unsigned int alive, unsigned int dead) const
+{
+    const unsigned int diff = alive ^ dead;
+    for (int y = y1 + 1; y <= y2; y++) {
+        const word *row = &cells[y * stride + 1];
+        for (int x = 0; x < width; x += 64) {
+            word w = row[x / 64];
+            int n = qMin(64, width - x);
+            for (int i = 0; i < n; i++)
+                pixels[x + i] = dead ^ (diff & -(unsigned int )((w >> i) & 1));
+        }
+        if (factor > 1) {
+            // élargit la ligne sur place, depuis la droite pour ne
+            // rien écraser avant de l'avoir lu, puis la recopie sur
+            // les autres lignes du bloc
+            for (int x = width - 1; x >= 0; x--)
+                for (int j = factor - 1; j >= 0; j--)
+                    pixels[factor * x + j] = pixels[x];
+            for (int j = 1; j < factor; j++)
+                std::memcpy(pixels + j * pitch, pixels,
+                            factor * width * sizeof(unsigned int));
+        }
+        pixels += factor * pitch;
+    }
+}
+
+//! Fonction de calcul d'une bande, pour QtConcurrent.
+void LifeEngine::stepBand(Band &band)
+{
+    band.engine->stepRows(band.y1, band.y2);
+}
+
+//! Fonction de dessin d'une bande, pour QtConcurrent.
+void LifeEngine::drawBand(Band &band)
+{
+    band.engine->drawRows(band.pixels, band.pitch, band.factor,
+                          band.y1, band.y2, band.alive, band.dead);
+}
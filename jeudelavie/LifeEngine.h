@@ -0,0 +1,59 @@
+#ifndef LIFE_ENGINE_H
+#define LIFE_ENGINE_H
+
+#include <QtGlobal>
+#include <vector>
+
+class DrawingWindow;
+
+class LifeEngine {
+public:
+    LifeEngine(int width_, int height_);
+
+    const int width;
+    const int height;
+
+    void clear();
+    void setCell(int x, int y, bool alive);
+    bool getCell(int x, int y) const;
+
+    void step();
+    void draw(DrawingWindow &w, unsigned int alive, unsigned int dead);
+
+private:
+    typedef quint64 word;
+
+    struct Band {
+        LifeEngine *engine;
+        int y1;
+        int y2;
+        unsigned int *pixels;
+        int pitch;
+        int factor;
+        unsigned int alive;
+        unsigned int dead;
+    };
+
+    const int words;            // mots utiles par ligne
+    const int stride;           // mots par ligne, bords compris
+    const word lastMask;        // cellules utiles du dernier mot
+
+    std::vector<word> cells;
+    std::vector<word> nextCells;
+    std::vector<Band> bands;
+
+    void wrap();
+    void stepRows(int y1, int y2);
+    void drawRows(unsigned int *pixels, int pitch, int factor,
+                  int y1, int y2,
+                  unsigned int alive, unsigned int dead) const;
+
+    static void stepBand(Band &band);
+    static void drawBand(Band &band);
+};
+
+#endif // !LIFE_ENGINE_H
+
+// Local variables:
+// mode: c++
+// End:
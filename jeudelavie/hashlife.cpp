@@ -0,0 +1,118 @@
+#include <DrawingWindow.h>
+#include <QApplication>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "HashLife.h"
+
+#define LARGEUR 800
+#define HAUTEUR 800
+
+#define VIVANT   0x000000ffU    // bleu
+#define MORT     0x00ffffffU    // blanc
+
+// Paramètres de la ligne de commande
+const char *fichier = 0;        // motif au format RLE
+int pas = 0;                    // on avance de 2^pas générations à la fois
+
+// Canon de Gosper, utilisé si aucun fichier n'est donné
+const char *canon[] = {
+    "........................O...........",
+    "......................O.O...........",
+    "............OO......OO............OO",
+    "...........O...O....OO............OO",
+    "OO........O.....O...OO..............",
+    "OO........O...O.OO....O.O...........",
+    "..........O.....O.......O...........",
+    "...........O...O....................",
+    "............OO......................",
+};
+
+// Lit un motif au format RLE (b : morte, o : vivante, $ : fin de ligne)
+bool lireRLE(HashLife& life, const char *nom)
+{
+    std::ifstream in(nom);
+    if (!in)
+        return false;
+    std::string ligne;
+    qint64 x = 0, y = 0, n = 0;
+    while (std::getline(in, ligne)) {
+        if (ligne.empty() || ligne[0] == '#' || ligne[0] == 'x')
+            continue;
+        for (unsigned i = 0 ; i < ligne.size() ; ++i) {
+            char c = ligne[i];
+            if (isdigit(c)) {
+                n = 10 * n + (c - '0');
+                continue;
+            }
+            qint64 k = n ? n : 1;
+            n = 0;
+            if (c == '!')
+                return true;
+            else if (c == '$') {
+                y += k;
+                x = 0;
+            } else if (c == 'b' || c == '.') {
+                x += k;
+            } else if (isalpha(c)) {
+                for (/* k */ ; k > 0 ; --k)
+                    life.setCell(x++, y, true);
+            }
+        }
+    }
+    return true;
+}
+
+void init(HashLife& life)
+{
+    if (fichier && lireRLE(life, fichier))
+        return;
+    if (fichier)
+        std::cerr << "impossible de lire " << fichier << std::endl;
+    for (unsigned j = 0 ; j < sizeof canon / sizeof *canon ; ++j)
+        for (int i = 0 ; canon[j][i] ; ++i)
+            if (canon[j][i] == 'O')
+                life.setCell(i, j, true);
+}
+
+// Dessine l'univers, avec un zoom suffisant pour voir tout le motif
+void dessine(DrawingWindow& w, HashLife& life)
+{
+    int zoom = 0;
+    while ((HAUTEUR << zoom) < (Q_INT64_C(1) << (life.getLevel() - 1)))
+        ++zoom;
+    qint64 x0 = -(qint64(LARGEUR) << zoom) / 2;
+    qint64 y0 = -(qint64(HAUTEUR) << zoom) / 2;
+    life.draw(w, x0, y0, zoom, VIVANT, MORT);
+}
+
+void hashlife(DrawingWindow& w)
+{
+    HashLife life;
+    init(life);
+    dessine(w, life);
+    w.sync();
+    for (int i = 0 ; ; ++i) {
+        if (i % 10 == 0)
+            std::cerr << "generation " << life.getGeneration()
+                      << " (" << life.getNodeCount() << " noeuds)"
+                      << std::endl;
+        life.step(pas);
+        dessine(w, life);
+        w.waitNextFrame();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+    if (argc > 1)
+        fichier = argv[1];
+    if (argc > 2)
+        pas = atoi(argv[2]);
+    DrawingWindow win(hashlife, LARGEUR, HAUTEUR);
+    win.show();
+    return app.exec();
+}
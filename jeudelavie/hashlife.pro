@@ -0,0 +1,13 @@
+TEMPLATE = app
+TARGET = hashlife
+CONFIG += qt
+#CONFIG += debug
+
+INCLUDEPATH += ../
+DEPENDPATH += ../
+
+HEADERS += ../DrawingWindow.h
+SOURCES += ../DrawingWindow.cpp
+HEADERS += HashLife.h
+SOURCES += HashLife.cpp
+SOURCES += hashlife.cpp
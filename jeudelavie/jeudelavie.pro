@@ -2,10 +2,17 @@ TEMPLATE = app
 TARGET = jeudelavie
 CONFIG += qt
 #CONFIG += debug
+#CONFIG += native
+
+native {
+	QMAKE_CXXFLAGS += -march=native
+}
 
 INCLUDEPATH += ../
 DEPENDPATH += ../
 
 HEADERS += ../DrawingWindow.h
 SOURCES += ../DrawingWindow.cpp
+HEADERS += LifeEngine.h
+SOURCES += LifeEngine.cpp
 SOURCES += jeudelavie.cpp
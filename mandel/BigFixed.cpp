@@ -0,0 +1,200 @@
+#include "BigFixed.h"
+#include <cmath>
+
+/*! \class BigFixed
+ *  \brief Nombre réel en virgule fixe, de grande précision.
+ *
+ * Utilisé pour le zoom profond sur l'ensemble de Mandelbrot, quand la
+ * précision d'un double ne suffit plus.  Le nombre est un entier en
+ * complément à deux de plusieurs mots de 32 bits : le mot de poids
+ * fort est la partie entière, les autres la partie fractionnaire.  Un
+ * nombre de n mots a donc une précision de 32 (n - 1) bits, et sa
+ * partie entière doit rester entre -2^31 et 2^31 - 1.
+ *
+ * Les deux opérandes d'une opération doivent avoir le même nombre de
+ * mots (voir setLimbs).
+ */
+
+//! Constructeur.
+/*!
+ * \param x             valeur initiale
+ * \param limbs_        nombre de mots (au moins 2)
+ */
+BigFixed::BigFixed(double x, int limbs_)
+    : limbs(limbs_, 0)
+{
+    double m = std::fabs(x);
+    double ip = std::floor(m);
+    limbs.back() = quint32(ip);
+    m -= ip;
+    for (int i = limbs_ - 2; i >= 0 && m != 0.0; i--) {
+        m = std::ldexp(m, 32);
+        ip = std::floor(m);
+        limbs[i] = quint32(ip);
+        m -= ip;
+    }
+    if (x < 0)
+        negate();
+}
+
+//! Lit un nombre en notation décimale, par exemple "-0.743643887037".
+/*!
+ * \param s             chaîne à lire
+ * \param limbs_        nombre de mots
+ */
+BigFixed BigFixed::fromString(const char *s, int limbs_)
+{
+    bool negative = *s == '-';
+    if (*s == '-' || *s == '+')
+        s++;
+    double ip = 0.0;
+    for (/* s */; *s >= '0' && *s <= '9'; s++)
+        ip = 10 * ip + (*s - '0');
+    // partie fractionnaire, du dernier chiffre au premier :
+    // f = (d + f) / 10
+    BigFixed f(0.0, limbs_);
+    if (*s == '.') {
+        const char *first = ++s;
+        while (*s >= '0' && *s <= '9')
+            s++;
+        while (s > first) {
+            f.limbs.back() += *--s - '0';
+            f = f.divide(10);
+        }
+    }
+    f.limbs.back() = quint32(ip);
+    if (negative)
+        f.negate();
+    return f;
+}
+
+//! Retourne le nombre de mots nécessaires pour une précision donnée.
+/*!
+ * \param bits          nombre de bits après la virgule
+ */
+int BigFixed::limbsFor(int bits)
+{
+    return 1 + (qMax(bits, 32) + 31) / 32;
+}
+
+//! Retourne le nombre de mots.
+int BigFixed::getLimbs() const
+{
+    return limbs.size();
+}
+
+//! Change le nombre de mots, en conservant la valeur.
+/*!
+ * Les mots de poids faible sont ajoutés ou supprimés.
+ */
+void BigFixed::setLimbs(int limbs_)
+{
+    int n = limbs.size();
+    if (limbs_ > n)
+        limbs.insert(limbs.begin(), limbs_ - n, 0);
+    else if (limbs_ < n)
+        limbs.erase(limbs.begin(), limbs.begin() + (n - limbs_));
+}
+
+//! Retourne la valeur, arrondie à un double.
+double BigFixed::toDouble() const
+{
+    if (isNegative())
+        return -(-*this).toDouble();
+    int n = limbs.size();
+    int top = n - 1;
+    while (top > 0 && limbs[top] == 0)
+        top--;
+    double x = 0.0;
+    // trois mots suffisent pour les 53 bits d'un double
+    for (int i = top; i >= 0 && i >= top - 2; i--)
+        x += std::ldexp(double(limbs[i]), 32 * (i - (n - 1)));
+    return x;
+}
+
+//! Vrai si le nombre est strictement négatif.
+bool BigFixed::isNegative() const
+{
+    return limbs.back() & 0x80000000U;
+}
+
+//! Addition.
+BigFixed BigFixed::operator+(const BigFixed &other) const
+{
+    BigFixed r(*this);
+    quint64 carry = 0;
+    for (unsigned i = 0; i < limbs.size(); i++) {
+        carry += quint64(limbs[i]) + other.limbs[i];
+        r.limbs[i] = quint32(carry);
+        carry >>= 32;
+    }
+    return r;
+}
+
+//! Soustraction.
+BigFixed BigFixed::operator-(const BigFixed &other) const
+{
+    return *this + -other;
+}
+
+//! Multiplication (tronquée).
+BigFixed BigFixed::operator*(const BigFixed &other) const
+{
+    const bool negative = isNegative() != other.isNegative();
+    const BigFixed a = isNegative() ? -*this : *this;
+    const BigFixed b = other.isNegative() ? -other : other;
+    const int n = limbs.size();
+    // produit complet sur 2n mots, dont on garde les mots n - 1 à 2n - 2
+    std::vector<quint32> p(2 * n, 0);
+    for (int i = 0; i < n; i++) {
+        if (a.limbs[i] == 0)
+            continue;
+        quint64 carry = 0;
+        for (int j = 0; j < n; j++) {
+            carry += quint64(a.limbs[i]) * b.limbs[j] + p[i + j];
+            p[i + j] = quint32(carry);
+            carry >>= 32;
+        }
+        p[i + n] = quint32(carry);
+    }
+    BigFixed r(0.0, n);
+    for (int i = 0; i < n; i++)
+        r.limbs[i] = p[i + n - 1];
+    if (negative)
+        r.negate();
+    return r;
+}
+
+//! Opposé.
+BigFixed BigFixed::operator-() const
+{
+    BigFixed r(*this);
+    r.negate();
+    return r;
+}
+
+//! Division par un petit entier positif (tronquée).
+BigFixed BigFixed::divide(unsigned int d) const
+{
+    if (isNegative())
+        return -(-*this).divide(d);
+    BigFixed r(*this);
+    quint64 rem = 0;
+    for (int i = limbs.size() - 1; i >= 0; i--) {
+        rem = (rem << 32) | limbs[i];
+        r.limbs[i] = quint32(rem / d);
+        rem %= d;
+    }
+    return r;
+}
+
+//! Change le signe, sur place.
+void BigFixed::negate()
+{
+    quint64 carry = 1;
+    for (unsigned i = 0; i < limbs.size(); i++) {
+        carry += quint32(~limbs[i]);
+        limbs[i] = quint32(carry);
+        carry >>= 32;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef BIG_FIXED_H
+#define BIG_FIXED_H
+
+#include <QtGlobal>
+#include <vector>
+
+class BigFixed {
+public:
+    BigFixed(double x = 0.0, int limbs_ = 3);
+
+    static BigFixed fromString(const char *s, int limbs_);
+    static int limbsFor(int bits);
+
+    int getLimbs() const;
+    void setLimbs(int limbs_);
+
+    double toDouble() const;
+    bool isNegative() const;
+
+    BigFixed operator+(const BigFixed &other) const;
+    BigFixed operator-(const BigFixed &other) const;
+    BigFixed operator*(const BigFixed &other) const;
+    BigFixed operator-() const;
+    BigFixed divide(unsigned int d) const;
+
+private:
+    // limbs[0] : poids faible ; limbs.back() : partie entière, signée
+    std::vector<quint32> limbs;
+
+    void negate();
+};
+
+#endif // !BIG_FIXED_H
+
+// Local variables:
+// mode: c++
+// End:
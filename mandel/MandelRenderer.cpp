@@ -0,0 +1,1048 @@
+#include "MandelRenderer.h"
+#include <DrawingWindow.h>
+#include <QFuture>
+#include <QMutexLocker>
+#include <QtConcurrentMap>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+/*! \class MandelRenderer
+ *  \brief Calcul rapide de l'ensemble de Mandelbrot.
+ *
+ * Les lignes de l'image sont calculées en parallèle sur tous les
+ * processeurs.  Dans chaque ligne, plusieurs points sont itérés
+ * ensemble grâce aux instructions vectorielles (2 points avec SSE2, 4
+ * avec AVX, 8 avec AVX-512) quand le compilateur les utilise.
+ *
+ * Les lignes calculées sont rangées dans un tampon, puis recopiées
+ * régulièrement par le thread de dessin directement dans les pixels
+ * de la fenêtre (voir DrawingWindow::lockPixels) : l'image apparaît
+ * au fur et à mesure du calcul.  Un clic de souris interrompt le
+ * calcul (voir render).
+ *
+ * Le nombre d'itérations de chaque pixel est conservé.  Changer de
+ * palette (voir setColouring, cyclePalette) ne demande donc qu'un
+ * passage sur ce tampon, sans rien recalculer.  Pour les points
+ * arrêtés à la limite, la dernière valeur de z est aussi conservée :
+ * si maxiter augmente, seuls ces points sont itérés plus loin.
+ *
+ * Quand les pixels deviennent trop petits pour la précision d'un
+ * double (voir deepScale), le rendu passe en zoom profond, par la
+ * méthode des perturbations : seule l'orbite d'un point de référence
+ * est calculée en haute précision (voir BigFixed), et chaque pixel
+ * est itéré en double, comme un petit écart delta à cette orbite :
+ *
+ *     delta(n+1) = 2 Z(n) delta(n) + delta(n)^2 + dc
+ *
+ * Les premières itérations sont sautées grâce à une approximation en
+ * série de delta, polynôme de degré 3 en dc.  Quand |Z + delta|
+ * devient plus petit que |delta|, ou que l'orbite de référence est
+ * épuisée, le pixel change de référence (rebasage) : delta prend la
+ * valeur Z + delta, et l'orbite de référence est reprise au début.
+ * Ceci évite les erreurs de précision (« glitches ») de la méthode.
+ *
+ * En mode subdivision (voir setSubdivision), l'image est découpée en
+ * carreaux.  Seul le bord de chaque carreau est calculé : s'il est
+ * d'une seule couleur, tout le carreau est rempli (algorithme de
+ * Mariani et Silver), sinon le carreau est coupé en quatre, et ainsi
+ * de suite.  Comme l'ensemble est connexe, le résultat est le même,
+ * mais les grandes zones uniformes, en particulier l'intérieur de
+ * l'ensemble, ne sont pas calculées point par point.
+ *
+ * En mode progressif (voir setProgressive), une nouvelle image est
+ * d'abord calculée grossièrement : un point sur 8 dans chaque
+ * direction, affiché comme un bloc de 8x8 pixels, puis un point sur 2,
+ * et enfin tous les points.  Les points déjà calculés ne le sont pas à
+ * nouveau.  Lors de la deuxième passe, un bloc dont les quatre coins
+ * sont de la même couleur n'est pas calculé : il est seulement rempli,
+ * et ses points sont calculés lors de la dernière passe.  Pour
+ * afficher quelque chose dès le clic, zoomPreview agrandit l'image
+ * précédente.
+ */
+
+// Vecteurs de 8 doubles avec AVX-512, 4 avec AVX, 2 avec SSE2.
+#if defined(__GNUC__) && defined(__AVX512F__)
+#  define MANDEL_VECTOR_SIZE 8
+#elif defined(__GNUC__) && defined(__AVX__)
+#  define MANDEL_VECTOR_SIZE 4
+#elif defined(__GNUC__) && defined(__SSE2__)
+#  define MANDEL_VECTOR_SIZE 2
+#endif
+#ifdef MANDEL_VECTOR_SIZE
+typedef double mandelvec
+    __attribute__((vector_size(MANDEL_VECTOR_SIZE * sizeof(double))));
+typedef qint64 mandelmask
+    __attribute__((vector_size(MANDEL_VECTOR_SIZE * sizeof(qint64))));
+#  define MANDEL_LANES MANDEL_VECTOR_SIZE
+#else
+#  define MANDEL_LANES 1
+#endif
+
+namespace {
+
+    inline double sqr(double x)
+    {
+        return x * x;
+    }
+
+    // Vrai si c est dans la cardioïde principale ou le bulbe de période 2.
+    inline bool inSet(double cr, double ci)
+    {
+        double ci2 = sqr(ci);
+        if (sqr(cr + 1) + ci2 < 1.0 / 16.0)
+            return true;
+        double x4 = cr - 1.0 / 4.0;
+        double q = sqr(x4) + ci2;
+        return q * (q + x4) < ci2 / 4.0;
+    }
+
+    // Division arrondie vers moins l'infini, pour b > 0.
+    inline int floorDiv(int a, int b)
+    {
+        return a >= 0 ? a / b : -((b - 1 - a) / b);
+    }
+
+    // Recopie n pixels de src dans la ligne y de la fenêtre, à partir
+    // de x, dans le tampon dest donné par lockPixels.  Si la fenêtre
+    // est suréchantillonnée, chaque pixel remplit un bloc de f × f.
+    void putRow(const DrawingWindow &w, unsigned int *dest,
+                int x, int y, const unsigned int *src, int n)
+    {
+        const int f = w.getSupersampling();
+        const int stride = w.getPixelStride();
+        unsigned int *d = dest + f * (y * stride + x);
+        if (f == 1) {
+            std::memcpy(d, src, n * sizeof(unsigned int));
+            return;
+        }
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j < f; j++)
+                d[f * i + j] = src[i];
+        for (int j = 1; j < f; j++)
+            std::memcpy(d + j * stride, d, f * n * sizeof(unsigned int));
+    }
+
+    // Points itérés ensemble.
+    struct Lanes {
+        double cr[MANDEL_LANES];
+        double ci[MANDEL_LANES];
+        double zr[MANDEL_LANES];
+        double zi[MANDEL_LANES];
+        qint64 n[MANDEL_LANES];         // itérations faites
+        qint64 active[MANDEL_LANES];    // -1 si le point est à itérer
+    };
+
+#ifdef MANDEL_VECTOR_SIZE
+
+    template <typename V, typename T>
+    inline V load(const T *p)
+    {
+        V v;
+        std::memcpy(&v, p, sizeof v);
+        return v;
+    }
+
+    template <typename V, typename T>
+    inline void store(T *p, const V &v)
+    {
+        std::memcpy(p, &v, sizeof v);
+    }
+
+    template <typename V, typename T>
+    inline V splat(T x)
+    {
+        V v;
+        for (int i = 0; i < MANDEL_VECTOR_SIZE; i++)
+            v[i] = x;
+        return v;
+    }
+
+    inline bool any(const mandelmask &m)
+    {
+        qint64 r = 0;
+        for (int i = 0; i < MANDEL_VECTOR_SIZE; i++)
+            r |= m[i];
+        return r != 0;
+    }
+
+    // Itère les points actifs, partis de from itérations, jusqu'à ce
+    // que |z| dépasse 2 ou que maxiter itérations soient faites.  Les
+    // points qui ont divergé ne sont plus comptés, et le test de sortie
+    // n'est fait que toutes les 8 itérations.
+    void iterate(Lanes &l, int from, int maxiter)
+    {
+        const mandelvec cr = load<mandelvec>(l.cr);
+        const mandelvec ci = load<mandelvec>(l.ci);
+        const mandelvec two = splat<mandelvec>(2.0);
+        const mandelvec four = splat<mandelvec>(4.0);
+        mandelvec zr = load<mandelvec>(l.zr);
+        mandelvec zi = load<mandelvec>(l.zi);
+        mandelmask n = load<mandelmask>(l.n);
+        mandelmask active = load<mandelmask>(l.active);
+        for (int i = from; i < maxiter && any(active); i += 8) {
+            int m = qMin(8, maxiter - i);
+            for (int j = 0; j < m; j++) {
+                const mandelvec zr2 = zr * zr;
+                const mandelvec zi2 = zi * zi;
+                active &= zr2 + zi2 < four;
+                n -= active;
+                zi = two * zr * zi + ci;
+                zr = zr2 - zi2 + cr;
+            }
+        }
+        store(l.zr, zr);
+        store(l.zi, zi);
+        store(l.n, n);
+    }
+
+#else // !MANDEL_VECTOR_SIZE
+
+    void iterate(Lanes &l, int from, int maxiter)
+    {
+        if (!l.active[0])
+            return;
+        const double cr = l.cr[0];
+        const double ci = l.ci[0];
+        double zr = l.zr[0];
+        double zi = l.zi[0];
+        double zr2 = sqr(zr);
+        double zi2 = sqr(zi);
+        int i;
+        for (i = from ; i < maxiter && zr2 + zi2 < 4 ; i++) {
+            zi = 2 * zr * zi + ci;
+            zr = zr2 - zi2 + cr;
+            zr2 = sqr(zr);
+            zi2 = sqr(zi);
+        }
+        l.zr[0] = zr;
+        l.zi[0] = zi;
+        l.n[0] = i;
+    }
+
+#endif // !MANDEL_VECTOR_SIZE
+
+}
+
+const int MandelRenderer::inside = INT_MAX;
+const double MandelRenderer::deepScale = 1e-13;
+
+//! Constructeur.
+/*!
+ * \param width_        largeur de l'image
+ * \param height_       hauteur de l'image
+ */
+MandelRenderer::MandelRenderer(int width_, int height_)
+    : width(width_)
+    , height(height_)
+    , Rmin(0.0)
+    , Imax(0.0)
+    , Rscale(0.0)
+    , Iscale(0.0)
+    , deep(false)
+    , refX(width_ / 2)
+    , refY(height_ / 2)
+    , refLast(0)
+    , skip(1)
+    , colouring(Cyclic)
+    , paletteOffset(0)
+    , counts(width_ * height_)
+    , lastZr(width_ * height_)
+    , lastZi(width_ * height_)
+    , lastRef(width_ * height_)
+    , filled(width_ * height_)
+    , computed(width_ * height_)
+    , computedIter(0)
+    , pass(Compute)
+    , subdivision(false)
+    , progressive(false)
+    , step(1)
+    , previousStep(1)
+    , pixels(width_ * height_)
+{
+    for (int y = 0; y < height; y++) {
+        Task t = { this, 0, y, width - 1, y };
+        rows.push_back(t);
+    }
+    for (int y = 0; y < height; y += tileSize) {
+        for (int x = 0; x < width; x += tileSize) {
+            Task t = { this, x, y, qMin(x + tileSize, width) - 1,
+                       qMin(y + tileSize, height) - 1 };
+            tiles.push_back(t);
+        }
+    }
+    setMaxIter(1000);
+}
+
+//! Change le nombre maximal d'itérations.
+/*!
+ * Si maxiter augmente, le prochain appel à render ne calcule que les
+ * points qui avaient atteint l'ancienne limite.  S'il diminue, les
+ * couleurs sont simplement recalculées.
+ */
+void MandelRenderer::setMaxIter(int maxiter_)
+{
+    maxiter = maxiter_;
+    updatePalette();
+}
+
+//! Retourne le nombre maximal d'itérations.
+int MandelRenderer::getMaxIter() const
+{
+    return maxiter;
+}
+
+//! Change la zone calculée.
+/*!
+ * Le pixel (x, y) correspond au complexe
+ * (Rmin + x * Rscale) + i (Imax - y * Iscale).
+ *
+ * \param Rmin_, Imax_          coin en haut à gauche
+ * \param Rscale_, Iscale_      taille d'un pixel
+ */
+void MandelRenderer::setArea(double Rmin_, double Imax_,
+                             double Rscale_, double Iscale_)
+{
+    Rmin = Rmin_;
+    Imax = Imax_;
+    Rscale = Rscale_;
+    Iscale = Iscale_;
+    Rcentre = BigFixed(Rmin + refX * Rscale);
+    Icentre = BigFixed(Imax - refY * Iscale);
+    deep = false;
+    computedIter = 0;
+}
+
+//! Change la zone calculée, en haute précision.
+/*!
+ * Le pixel (width / 2, height / 2) correspond au complexe
+ * Rcentre + i Icentre, et le pixel (x, y) à
+ * (Rcentre + (x - width / 2) * Rscale)
+ * + i (Icentre - (y - height / 2) * Iscale).
+ *
+ * Si les pixels sont plus petits que deepScale, le rendu se fait en
+ * zoom profond.  La précision de Rcentre et Icentre doit alors être
+ * suffisante : au moins -log2(Rscale) bits.
+ *
+ * \param Rcentre_, Icentre_    centre de l'image
+ * \param Rscale_, Iscale_      taille d'un pixel
+ */
+void MandelRenderer::setArea(const BigFixed &Rcentre_,
+                             const BigFixed &Icentre_,
+                             double Rscale_, double Iscale_)
+{
+    Rcentre = Rcentre_;
+    Icentre = Icentre_;
+    Rscale = Rscale_;
+    Iscale = Iscale_;
+    Rmin = Rcentre.toDouble() - refX * Rscale;
+    Imax = Icentre.toDouble() + refY * Iscale;
+    deep = qMin(Rscale, Iscale) < deepScale;
+    computedIter = 0;
+}
+
+//! Vrai si la zone courante est calculée en zoom profond.
+bool MandelRenderer::isDeep() const
+{
+    return deep;
+}
+
+//! Active ou désactive le mode subdivision.
+/*!
+ * Voir la description de la classe.
+ */
+void MandelRenderer::setSubdivision(bool subdivision_)
+{
+    subdivision = subdivision_;
+}
+
+//! Vrai si le mode subdivision est actif.
+bool MandelRenderer::getSubdivision() const
+{
+    return subdivision;
+}
+
+//! Retourne le nombre de points calculés lors du dernier rendu.
+int MandelRenderer::getEvaluatedPoints() const
+{
+    return evaluatedPoints;
+}
+
+//! Active ou désactive le mode progressif.
+/*!
+ * Voir la description de la classe.  Seul le calcul d'une nouvelle
+ * zone est progressif ; l'augmentation de maxiter ne l'est pas.
+ */
+void MandelRenderer::setProgressive(bool progressive_)
+{
+    progressive = progressive_;
+}
+
+//! Vrai si le mode progressif est actif.
+bool MandelRenderer::getProgressive() const
+{
+    return progressive;
+}
+
+//! Change la façon de colorier les points.
+/*!
+ * Cyclic parcourt le dégradé selon le nombre d'itérations.  Histogram
+ * répartit les couleurs selon l'histogramme des nombres d'itérations
+ * de l'image : chaque couleur couvre à peu près autant de pixels.
+ *
+ * La fenêtre n'est pas mise à jour : voir recolour.
+ */
+void MandelRenderer::setColouring(Colouring colouring_)
+{
+    colouring = colouring_;
+    updatePalette();
+}
+
+//! Retourne la façon de colorier les points.
+MandelRenderer::Colouring MandelRenderer::getColouring() const
+{
+    return colouring;
+}
+
+//! Décale les couleurs du dégradé.
+/*!
+ * La fenêtre n'est pas mise à jour : voir recolour.
+ *
+ * \param step          décalage, en nombre de couleurs
+ */
+void MandelRenderer::cyclePalette(int step)
+{
+    paletteOffset = ((paletteOffset + step) % gradientSize + gradientSize)
+        % gradientSize;
+    updatePalette();
+}
+
+//! Calcule et dessine l'image.
+/*!
+ * Le calcul est fait en parallèle, et les lignes calculées sont
+ * recopiées dans la fenêtre toutes les flushInterval millisecondes.
+ * Si un bouton de la souris est enfoncé pendant le calcul, celui-ci
+ * est abandonné, et la position du clic est retournée comme par
+ * DrawingWindow::waitMousePress.
+ *
+ * Si l'image est déjà calculée pour la zone courante, seuls les
+ * points nécessaires sont calculés.
+ *
+ * \param w             fenêtre de dessin
+ * \param x, y          coordonnées du clic, s'il y en a eu un
+ * \param button        numéro du bouton, s'il y a eu un clic
+ * \return              true si le calcul est allé à son terme, false
+ *                      s'il a été interrompu par un clic
+ */
+bool MandelRenderer::render(DrawingWindow &w, int &x, int &y, int &button)
+{
+    if (computedIter == 0) {
+        pass = Compute;
+    } else if (maxiter > computedIter) {
+        pass = Resume;
+    } else {
+        recolour(w);
+        return true;
+    }
+    if (deep)
+        computeReference();
+    if (pass == Compute)
+        std::fill(computed.begin(), computed.end(), 0);
+    cancelled = 0;
+    evaluatedPoints = 0;
+    finished.clear();
+    // côté des blocs de chaque passe : la dernière calcule tout
+    static const int steps[] = { 8, 2, 1 };
+    const int nsteps = sizeof steps / sizeof steps[0];
+    bool clicked = false;
+    previousStep = 1;
+    for (int s = progressive && pass == Compute ? 0 : nsteps - 1;
+         s < nsteps && !clicked; s++) {
+        step = steps[s];
+        QFuture<void> future =
+            QtConcurrent::map(subdivision && step == 1 ? tiles : rows,
+                              renderTask);
+        while (!clicked && !future.isFinished()) {
+            clicked = w.waitMousePress(x, y, button, flushInterval);
+            flush(w);
+        }
+        if (clicked) {
+            cancelled = 1;
+            future.cancel();
+            future.waitForFinished();
+        }
+        previousStep = step;
+    }
+    if (clicked) {
+        // tampon incomplet, tout sera à recalculer
+        computedIter = 0;
+        flush(w);
+    } else {
+        computedIter = maxiter;
+        flush(w);
+        // l'histogramme n'est connu qu'une fois tous les points calculés
+        if (colouring == Histogram)
+            recolour(w);
+    }
+    return !clicked;
+}
+
+//! Recolorie l'image, sans la recalculer.
+/*!
+ * Utilise le nombre d'itérations conservé pour chaque pixel, avec la
+ * palette courante.
+ *
+ * \param w             fenêtre de dessin
+ */
+void MandelRenderer::recolour(DrawingWindow &w)
+{
+    updatePalette();
+    QtConcurrent::blockingMap(rows, colourTask);
+    const int n = qMin(width, w.width);
+    const int m = qMin(height, w.height);
+    unsigned int *dest = w.lockPixels();
+    for (int y = 0; y < m; y++)
+        putRow(w, dest, 0, y, &pixels[y * width], n);
+    w.unlockPixels(0, 0, n - 1, m - 1);
+}
+
+//! Affiche aussitôt l'image précédente, agrandie.
+/*!
+ * Les pixels de la fenêtre sont agrandis sur place, sans
+ * interpolation, autour du point (x, y) qui devient le centre de
+ * l'image.  À appeler juste avant de changer de zone, pour faire
+ * patienter l'utilisateur jusqu'aux premiers points calculés.
+ *
+ * \param w             fenêtre de dessin
+ * \param x, y          point de l'image précédente, nouveau centre
+ * \param zoom          facteur d'agrandissement
+ */
+void MandelRenderer::zoomPreview(DrawingWindow &w, int x, int y, int zoom)
+{
+    const int n = qMin(width, w.width);
+    const int m = qMin(height, w.height);
+    std::vector<int> sx(n);
+    for (int px = 0; px < n; px++)
+        sx[px] = qBound(0, x + floorDiv(px - width / 2, zoom), n - 1);
+    const int f = w.getSupersampling();
+    const int stride = w.getPixelStride();
+    unsigned int *dest = w.lockPixels();
+    // copie de l'image précédente, un pixel par bloc si la fenêtre
+    // est suréchantillonnée
+    std::vector<unsigned int> src(n * m);
+    for (int py = 0; py < m; py++)
+        for (int px = 0; px < n; px++)
+            src[py * n + px] = dest[f * (py * stride + px)];
+    std::vector<unsigned int> d(n);
+    for (int py = 0; py < m; py++) {
+        const int sy = qBound(0, y + floorDiv(py - height / 2, zoom), m - 1);
+        const unsigned int *line = &src[sy * n];
+        for (int px = 0; px < n; px++)
+            d[px] = line[sx[px]];
+        putRow(w, dest, 0, py, &d[0], n);
+    }
+    w.unlockPixels(0, 0, n - 1, m - 1);
+}
+
+//! Retourne la couleur d'un point.
+/*!
+ * Les points de l'ensemble sont noirs, les autres parcourent un
+ * dégradé vert, bleu, rouge, selon le nombre d'itérations.
+ *
+ * \param i             nombre d'itérations
+ * \param maxiter       nombre maximal d'itérations
+ * \return              couleur, de la forme #RRGGBB
+ */
+unsigned int MandelRenderer::color(int i, int maxiter)
+{
+    if (i >= maxiter)
+        return 0;
+    return gradient((maxiter - 1 - i) % gradientSize);
+}
+
+//! Recalcule la palette : couleur de chaque nombre d'itérations.
+void MandelRenderer::updatePalette()
+{
+    palette.resize(maxiter + 1);
+    palette[maxiter] = 0;
+    if (colouring == Histogram && computedIter > 0) {
+        std::vector<int> histogram(maxiter, 0);
+        int total = 0;
+        for (unsigned i = 0; i < counts.size(); i++) {
+            if (counts[i] < maxiter) {
+                histogram[counts[i]]++;
+                total++;
+            }
+        }
+        // position dans le dégradé : proportion des pixels qui ont
+        // divergé plus tôt
+        qint64 sum = 0;
+        for (int i = 0; i < maxiter; i++) {
+            int ii = sum * (gradientSize - 1) / qMax(total, 1);
+            palette[i] = gradient((ii + paletteOffset) % gradientSize);
+            sum += histogram[i];
+        }
+    } else {
+        for (int i = 0; i < maxiter; i++)
+            palette[i] = gradient((maxiter - 1 - i + paletteOffset)
+                                  % gradientSize);
+    }
+}
+
+//! Retourne la couleur i du dégradé vert, bleu, rouge.
+unsigned int MandelRenderer::gradient(int i)
+{
+    double rouge, vert, bleu;
+    if (i < 32) {
+        // vert -> bleu
+        bleu = i / 32.0;
+        vert = 1.0 - bleu;
+        rouge = 0.0;
+    } else if (i < 64) {
+        // bleu -> rouge
+        rouge = (i - 32) / 32.0;
+        bleu = 1.0 - rouge;
+        vert = 0.0;
+    } else {
+        // rouge -> vert
+        vert = (i - 64) / 32.0;
+        rouge = 1.0 - vert;
+        bleu = 0.0;
+    }
+    return (unsigned(rouge * 255 + 0.5) << 16)
+        | (unsigned(vert * 255 + 0.5) << 8)
+        | unsigned(bleu * 255 + 0.5);
+}
+
+//! Calcule l'orbite de référence, et l'approximation en série.
+/*!
+ * L'orbite Z(0) = 0, Z(k + 1) = Z(k)^2 + C, où C est le centre de
+ * l'image, est calculée en haute précision jusqu'à maxiter + 1 ou
+ * jusqu'à ce qu'elle diverge, puis arrondie en double.
+ *
+ * Les coefficients de delta(k) = A dc + B dc^2 + C dc^3 vérifient
+ * A(1) = 1, B(1) = C(1) = 0, et :
+ *
+ *     A(k+1) = 2 Z(k) A(k) + 1
+ *     B(k+1) = 2 Z(k) B(k) + A(k)^2
+ *     C(k+1) = 2 Z(k) C(k) + 2 A(k) B(k)
+ *
+ * On s'arrête (skip) avant que le terme en dc^3, pour le pixel le
+ * plus éloigné, ne dépasse une fraction de l'écart entre deux pixels,
+ * ou qu'un point puisse avoir divergé.
+ */
+void MandelRenderer::computeReference()
+{
+    const int n = Rcentre.getLimbs();
+    const BigFixed cr = Rcentre;
+    const BigFixed ci = Icentre;
+    BigFixed zr(0.0, n);
+    BigFixed zi(0.0, n);
+    // un point non rebasé est au plus à Z(maxiter) : l'orbite est
+    // calculée un cran plus loin, pour qu'un point arrêté à maxiter ne
+    // soit jamais rebasé à tort (sa reprise perdrait toute précision)
+    refZr.assign(maxiter + 2, 0.0);
+    refZi.assign(maxiter + 2, 0.0);
+    refLast = maxiter + 1;
+    for (int k = 1; k <= maxiter + 1; k++) {
+        BigFixed zri = zr * zi;
+        zr = zr * zr - zi * zi + cr;
+        zi = zri + zri + ci;
+        refZr[k] = zr.toDouble();
+        refZi[k] = zi.toDouble();
+        if (refZr[k] * refZr[k] + refZi[k] * refZi[k] > 4.0) {
+            refLast = k;
+            break;
+        }
+    }
+
+    typedef std::complex<double> complex;
+    const double r = std::sqrt(sqr(qMax(refX, width - 1 - refX) * Rscale)
+                               + sqr(qMax(refY, height - 1 - refY) * Iscale));
+    const double spacing = qMin(Rscale, Iscale);
+    complex a(1.0), b(0.0), c(0.0);
+    skip = 1;
+    for (int k = 1; k < refLast && k < maxiter; k++) {
+        const complex z(refZr[k], refZi[k]);
+        if (std::abs(z) + std::abs(a) * r + std::abs(b) * r * r
+            + std::abs(c) * r * r * r >= 2.0)
+            break;
+        const complex a2 = 2.0 * z * a + 1.0;
+        const complex b2 = 2.0 * z * b + a * a;
+        const complex c2 = 2.0 * z * c + 2.0 * a * b;
+        if (std::abs(c2) * r * r * r > 1e-6 * std::abs(a2) * spacing)
+            break;
+        a = a2;
+        b = b2;
+        c = c2;
+        skip = k + 1;
+    }
+    seriesA = a;
+    seriesB = b;
+    seriesC = c;
+}
+
+//! Vrai si le pixel i doit être calculé lors de ce rendu.
+bool MandelRenderer::needsWork(int i) const
+{
+    return pass == Compute ? !computed[i] : counts[i] == computedIter;
+}
+
+//! Calcule tous les pixels d'un rectangle, bornes comprises.
+/*!
+ * \return              false si le calcul a été interrompu
+ */
+bool MandelRenderer::computeRect(int x1, int y1, int x2, int y2)
+{
+    std::vector<int> points(x2 - x1 + 1);
+    for (int y = y1; y <= y2; y++) {
+        for (int x = x1; x <= x2; x++)
+            points[x - x1] = y * width + x;
+        if (!computePoints(&points[0], points.size()))
+            return false;
+    }
+    return true;
+}
+
+//! Calcule le nombre d'itérations d'une liste de pixels.
+/*!
+ * Selon pass, tous les pixels sont calculés, ou seulement ceux qui
+ * avaient atteint la limite computedIter.  Parmi ces derniers, ceux
+ * qui avaient été remplis par subdivision sont calculés depuis le
+ * début, les autres sont repris où ils en étaient.
+ *
+ * \param points        indices des pixels
+ * \param n             nombre de pixels
+ * \return              false si le calcul a été interrompu
+ */
+bool MandelRenderer::computePoints(const int *points, int n)
+{
+    if (deep) {
+        int evaluated = 0;
+        for (int k = 0; k < n; k++) {
+            if (k % 16 == 0 && cancelled)
+                return false;
+            if (needsWork(points[k])) {
+                computePointDeep(points[k]);
+                evaluated++;
+            }
+        }
+        evaluatedPoints.fetchAndAddRelaxed(evaluated);
+        return true;
+    }
+    return (pass != Resume || computeLanes(points, n, true))
+        && computeLanes(points, n, false);
+}
+
+//! Calcule une liste de pixels, MANDEL_LANES à la fois.
+/*!
+ * \param points        indices des pixels
+ * \param n             nombre de pixels
+ * \param resume        true pour ne reprendre que les pixels dont le
+ *                      calcul s'était arrêté à computedIter, false
+ *                      pour ne calculer que ceux à calculer depuis le
+ *                      début
+ * \return              false si le calcul a été interrompu
+ */
+bool MandelRenderer::computeLanes(const int *points, int n, bool resume)
+{
+    const int from = resume ? computedIter : 0;
+    Lanes l;
+    int pos[MANDEL_LANES];
+    int k = 0;
+    int evaluated = 0;
+    for (int p = 0; p < n || k > 0; p++) {
+        if (p < n) {
+            const int i = points[p];
+            if (!needsWork(i)
+                || resume != (pass == Resume && !filled[i]))
+                continue;
+            const double cr = Rmin + (i % width) * Rscale;
+            const double ci = Imax - (i / width) * Iscale;
+            filled[i] = false;
+            computed[i] = true;
+            if (resume) {
+                l.zr[k] = lastZr[i];
+                l.zi[k] = lastZi[i];
+            } else if (inSet(cr, ci)) {
+                counts[i] = inside;
+                continue;
+            } else {
+                l.zr[k] = cr;
+                l.zi[k] = ci;
+            }
+            l.cr[k] = cr;
+            l.ci[k] = ci;
+            l.n[k] = from;
+            l.active[k] = -1;
+            pos[k++] = i;
+            if (k < MANDEL_LANES)
+                continue;
+        } else {
+            // complète le dernier groupe par des points inactifs
+            for (int j = k; j < MANDEL_LANES; j++) {
+                l.cr[j] = l.ci[j] = l.zr[j] = l.zi[j] = 0.0;
+                l.n[j] = l.active[j] = 0;
+            }
+        }
+        if (cancelled)
+            return false;
+        iterate(l, from, maxiter);
+        for (int j = 0; j < k; j++) {
+            counts[pos[j]] = l.n[j];
+            lastZr[pos[j]] = l.zr[j];
+            lastZi[pos[j]] = l.zi[j];
+        }
+        evaluated += k;
+        k = 0;
+    }
+    evaluatedPoints.fetchAndAddRelaxed(evaluated);
+    return true;
+}
+
+//! Calcule le pixel i en zoom profond, par perturbation.
+/*!
+ * Voir computeReference.
+ */
+void MandelRenderer::computePointDeep(int i)
+{
+    typedef std::complex<double> complex;
+    const double dcr = (i % width - refX) * Rscale;
+    const double dci = (refY - i / width) * Iscale;
+    double dr, di;      // delta
+    int m;              // indice dans l'orbite de référence
+    int n;              // itérations
+    if (pass == Resume && !filled[i]) {
+        dr = lastZr[i];
+        di = lastZi[i];
+        m = lastRef[i];
+        n = computedIter;
+    } else {
+        const complex dc(dcr, dci);
+        const complex d = dc * (seriesA + dc * (seriesB + dc * seriesC));
+        dr = d.real();
+        di = d.imag();
+        m = skip;
+        n = skip - 1;
+    }
+    for (/* n */; n < maxiter; n++) {
+        const double Zr = refZr[m];
+        const double Zi = refZi[m];
+        const double zr = Zr + dr;
+        const double zi = Zi + di;
+        const double mag = zr * zr + zi * zi;
+        if (mag >= 4.0)
+            break;
+        if (mag < dr * dr + di * di || m == refLast) {
+            // rebasage : Z(0) = 0, delta = z
+            dr = zr;
+            di = zi;
+            m = 0;
+        }
+        const double Zr2 = 2 * refZr[m];
+        const double Zi2 = 2 * refZi[m];
+        const double nr = Zr2 * dr - Zi2 * di + dr * dr - di * di + dcr;
+        di = Zr2 * di + Zi2 * dr + 2 * dr * di + dci;
+        dr = nr;
+        m++;
+    }
+    counts[i] = n;
+    lastZr[i] = dr;
+    lastZi[i] = di;
+    lastRef[i] = m;
+    filled[i] = false;
+    computed[i] = true;
+}
+
+//! Calcule une ligne de blocs, lors d'une passe grossière.
+/*!
+ * Seul le coin en haut à gauche de chaque bloc est calculé, si
+ * nécessaire (voir coarseCount), et le bloc prend sa couleur.
+ *
+ * \param t             ligne de l'image, multiple de step
+ * \return              false si le calcul a été interrompu
+ */
+bool MandelRenderer::computeCoarse(const Task &t)
+{
+    const int y = t.y1;
+    const int y2 = qMin(y + step, height) - 1;
+    std::vector<int> points;
+    for (int x = 0; x < width; x += step)
+        if (coarseCount(x, y) < 0)
+            points.push_back(y * width + x);
+    if (!points.empty() && !computePoints(&points[0], points.size()))
+        return false;
+    for (int x = 0; x < width; x += step) {
+        const unsigned int c = palette[coarseCount(x, y)];
+        const int x2 = qMin(x + step, width) - 1;
+        for (int yy = y; yy <= y2; yy++)
+            for (int xx = x; xx <= x2; xx++)
+                pixels[yy * width + xx] = c;
+    }
+    return true;
+}
+
+//! Nombre d'itérations d'un bloc de la passe grossière en cours.
+/*!
+ * C'est celui du point (x, y) s'il est déjà calculé, ou celui des
+ * quatre coins du bloc de la passe précédente qui le contient, s'ils
+ * sont égaux.
+ *
+ * \return              nombre d'itérations, au plus maxiter, ou -1 si
+ *                      le point (x, y) doit être calculé
+ */
+int MandelRenderer::coarseCount(int x, int y) const
+{
+    if (computed[y * width + x])
+        return qMin(counts[y * width + x], maxiter);
+    if (previousStep == 1)
+        return -1;
+    const int s = previousStep;
+    const int x1 = x - x % s;
+    const int y1 = y - y % s;
+    const int x2 = qMin(x1 + s, (width - 1) / s * s);
+    const int y2 = qMin(y1 + s, (height - 1) / s * s);
+    const int corners[4] = { y1 * width + x1, y1 * width + x2,
+                             y2 * width + x1, y2 * width + x2 };
+    int c = -1;
+    for (int k = 0; k < 4; k++) {
+        const int i = corners[k];
+        if (!computed[i] || (c >= 0 && qMin(counts[i], maxiter) != c))
+            return -1;
+        c = qMin(counts[i], maxiter);
+    }
+    return c;
+}
+
+//! Calcule l'intérieur d'un rectangle dont le bord est déjà calculé.
+/*!
+ * Si le bord est uniforme, l'intérieur est rempli avec le même
+ * nombre d'itérations ; sinon, le rectangle est coupé en quatre par
+ * une ligne et une colonne, qui sont calculées, et chaque quart est
+ * traité de la même façon.
+ *
+ * \param x1, y1, x2, y2        rectangle, bornes comprises
+ * \return                      false si le calcul a été interrompu
+ */
+bool MandelRenderer::subdivide(int x1, int y1, int x2, int y2)
+{
+    if (x2 - x1 < 2 || y2 - y1 < 2)
+        return true;
+    const int c = qMin(counts[y1 * width + x1], maxiter);
+    bool uniform = true;
+    for (int x = x1; x <= x2 && uniform; x++)
+        uniform = qMin(counts[y1 * width + x], maxiter) == c
+            && qMin(counts[y2 * width + x], maxiter) == c;
+    for (int y = y1; y <= y2 && uniform; y++)
+        uniform = qMin(counts[y * width + x1], maxiter) == c
+            && qMin(counts[y * width + x2], maxiter) == c;
+    if (uniform) {
+        for (int y = y1 + 1; y < y2; y++) {
+            for (int x = x1 + 1; x < x2; x++) {
+                const int i = y * width + x;
+                if (needsWork(i)) {
+                    counts[i] = c;
+                    filled[i] = true;
+                }
+            }
+        }
+        return true;
+    }
+    if (x2 - x1 <= 4 || y2 - y1 <= 4)
+        return computeRect(x1 + 1, y1 + 1, x2 - 1, y2 - 1);
+    const int xm = (x1 + x2) / 2;
+    const int ym = (y1 + y2) / 2;
+    std::vector<int> points;
+    for (int x = x1 + 1; x < x2; x++)
+        points.push_back(ym * width + x);
+    for (int y = y1 + 1; y < y2; y++)
+        if (y != ym)
+            points.push_back(y * width + xm);
+    return computePoints(&points[0], points.size())
+        && subdivide(x1, y1, xm, ym) && subdivide(xm, y1, x2, ym)
+        && subdivide(x1, ym, xm, y2) && subdivide(xm, ym, x2, y2);
+}
+
+//! Colorie un rectangle avec la palette courante.
+void MandelRenderer::colourRect(const Task &t)
+{
+    for (int y = t.y1; y <= t.y2; y++) {
+        const int *count = &counts[y * width];
+        unsigned int *dest = &pixels[y * width];
+        for (int x = t.x1; x <= t.x2; x++)
+            dest[x] = palette[qMin(count[x], maxiter)];
+    }
+}
+
+//! Recopie dans la fenêtre les rectangles terminés depuis le dernier appel.
+void MandelRenderer::flush(DrawingWindow &w)
+{
+    std::vector<Task> done;
+    finishedMutex.lock();
+    done.swap(finished);
+    finishedMutex.unlock();
+    int xmin = w.width, ymin = w.height;
+    int xmax = -1, ymax = -1;
+    unsigned int *dest = 0;
+    for (unsigned i = 0; i < done.size(); i++) {
+        const int x1 = done[i].x1;
+        const int y1 = done[i].y1;
+        const int x2 = qMin(done[i].x2, w.width - 1);
+        const int y2 = qMin(done[i].y2, w.height - 1);
+        if (x1 > x2 || y1 > y2)
+            continue;
+        if (!dest)
+            dest = w.lockPixels();
+        for (int y = y1; y <= y2; y++)
+            putRow(w, dest, x1, y, &pixels[y * width + x1], x2 - x1 + 1);
+        xmin = qMin(xmin, x1);
+        ymin = qMin(ymin, y1);
+        xmax = qMax(xmax, x2);
+        ymax = qMax(ymax, y2);
+    }
+    if (dest)
+        w.unlockPixels(xmin, ymin, xmax, ymax);
+}
+
+//! Fonction de calcul d'un rectangle, pour QtConcurrent.
+/*!
+ * En mode subdivision, seul le bord est calculé directement.  Lors
+ * d'une passe grossière, seule une ligne sur step est traitée, et la
+ * tâche couvre aussi les lignes suivantes de ses blocs.
+ */
+void MandelRenderer::renderTask(Task &t)
+{
+    MandelRenderer *r = t.renderer;
+    if (r->step > 1) {
+        if (t.y1 % r->step != 0 || !r->computeCoarse(t))
+            return;
+        Task done = { r, 0, t.y1, r->width - 1,
+                      qMin(t.y1 + r->step, r->height) - 1 };
+        QMutexLocker lock(&r->finishedMutex);
+        r->finished.push_back(done);
+        return;
+    }
+    if (r->subdivision) {
+        bool ok = r->computeRect(t.x1, t.y1, t.x2, t.y1)
+            && (t.y2 == t.y1 || r->computeRect(t.x1, t.y2, t.x2, t.y2))
+            && r->computeRect(t.x1, t.y1 + 1, t.x1, t.y2 - 1)
+            && (t.x2 == t.x1
+                || r->computeRect(t.x2, t.y1 + 1, t.x2, t.y2 - 1))
+            && r->subdivide(t.x1, t.y1, t.x2, t.y2);
+        if (!ok)
+            return;
+    } else {
+        if (!r->computeRect(t.x1, t.y1, t.x2, t.y2))
+            return;
+    }
+    r->colourRect(t);
+    QMutexLocker lock(&r->finishedMutex);
+    r->finished.push_back(t);
+}
+
+//! Fonction de coloriage d'un rectangle, pour QtConcurrent.
+void MandelRenderer::colourTask(Task &t)
+{
+    t.renderer->colourRect(t);
+}
@@ -0,0 +1,134 @@
+#ifndef MANDEL_RENDERER_H
+#define MANDEL_RENDERER_H
+
+#include "BigFixed.h"
+#include <QAtomicInt>
+#include <QMutex>
+#include <complex>
+#include <vector>
+
+class DrawingWindow;
+
+class MandelRenderer {
+public:
+    enum Colouring { Cyclic, Histogram };
+
+    MandelRenderer(int width_, int height_);
+
+    const int width;
+    const int height;
+
+    void setMaxIter(int maxiter_);
+    int getMaxIter() const;
+    void setArea(double Rmin_, double Imax_, double Rscale_, double Iscale_);
+    void setArea(const BigFixed &Rcentre_, const BigFixed &Icentre_,
+                 double Rscale_, double Iscale_);
+    bool isDeep() const;
+
+    void setSubdivision(bool subdivision_);
+    bool getSubdivision() const;
+    int getEvaluatedPoints() const;
+    void setProgressive(bool progressive_);
+    bool getProgressive() const;
+
+    void setColouring(Colouring colouring_);
+    Colouring getColouring() const;
+    void cyclePalette(int step);
+
+    bool render(DrawingWindow &w, int &x, int &y, int &button);
+    void recolour(DrawingWindow &w);
+    void zoomPreview(DrawingWindow &w, int x, int y, int zoom);
+    static unsigned int color(int i, int maxiter);
+
+private:
+    // Rectangle de pixels, bornes comprises
+    struct Task {
+        MandelRenderer *renderer;
+        int x1, y1, x2, y2;
+    };
+
+    enum Pass { Compute, Resume, Recolour };
+
+    //! Délai entre deux recopies des lignes calculées (ms)
+    static const int flushInterval = 20;
+    //! Nombre d'itérations des points reconnus comme intérieurs
+    static const int inside;
+    //! Nombre de couleurs du dégradé
+    static const int gradientSize = 96;
+    //! Taille d'un pixel en dessous de laquelle on passe en zoom profond
+    static const double deepScale;
+    //! Côté des carreaux, en mode subdivision
+    static const int tileSize = 32;
+
+    int maxiter;
+    double Rmin;
+    double Imax;
+    double Rscale;
+    double Iscale;
+
+    // zoom profond : point de référence, au pixel (refX, refY)
+    bool deep;
+    BigFixed Rcentre;
+    BigFixed Icentre;
+    int refX;
+    int refY;
+    std::vector<double> refZr;
+    std::vector<double> refZi;
+    int refLast;
+    // approximation en série : delta = A dc + B dc^2 + C dc^3 à skip
+    int skip;
+    std::complex<double> seriesA;
+    std::complex<double> seriesB;
+    std::complex<double> seriesC;
+
+    Colouring colouring;
+    int paletteOffset;
+
+    std::vector<int> counts;
+    std::vector<double> lastZr;
+    std::vector<double> lastZi;
+    std::vector<int> lastRef;
+    std::vector<char> filled;
+    std::vector<char> computed;
+    int computedIter;
+    Pass pass;
+    bool subdivision;
+    bool progressive;
+    // côté des blocs de la passe en cours, et de la précédente
+    int step;
+    int previousStep;
+    QAtomicInt evaluatedPoints;
+
+    std::vector<unsigned int> pixels;
+    std::vector<unsigned int> palette;
+    std::vector<Task> rows;
+    std::vector<Task> tiles;
+
+    QAtomicInt cancelled;
+    QMutex finishedMutex;
+    std::vector<Task> finished;
+
+    void updatePalette();
+    static unsigned int gradient(int i);
+
+    void computeReference();
+    bool needsWork(int i) const;
+    bool computeRect(int x1, int y1, int x2, int y2);
+    bool computePoints(const int *points, int n);
+    bool computeLanes(const int *points, int n, bool resume);
+    void computePointDeep(int i);
+    bool computeCoarse(const Task &t);
+    int coarseCount(int x, int y) const;
+    bool subdivide(int x1, int y1, int x2, int y2);
+    void colourRect(const Task &t);
+    void flush(DrawingWindow &w);
+
+    static void renderTask(Task &t);
+    static void colourTask(Task &t);
+};
+
+#endif // !MANDEL_RENDERER_H
+
+// Local variables:
+// mode: c++
+// End:
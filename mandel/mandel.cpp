@@ -1,6 +1,10 @@
 #include <DrawingWindow.h>
 #include <QApplication>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
+#include "BigFixed.h"
+#include "MandelRenderer.h"
 
 struct parameters {
     // nombre max d'itérations
@@ -25,138 +29,118 @@ const parameters initial_parameters = {
     0.0,                        // Iscale
 };
 
-static inline double sqr(double x)
-{
-    return x * x;
-}
-
-static int check_point(parameters& p, double cr, double ci)
-{
-    double zr2, zi2;
-    zi2 = sqr(ci);
-    if (sqr(cr + 1) + zi2 < 1.0 / 16.0)
-        return p.maxiter;
-    double x4 = cr - 1.0 / 4.0;
-    double q = sqr(x4) + zi2;
-    if (q * (q + x4) < zi2 / 4.0)
-        return p.maxiter;
-    zr2 = sqr(cr);
-    double zr = cr;
-    double zi = ci;
-    int i;
-    for (i = 0 ; i < p.maxiter && zr2 + zi2 < 4 ; i++) {
-        zi = 2 * zr * zi + ci;
-        zr = zr2 - zi2 + cr;
-        zr2 = sqr(zr);
-        zi2 = sqr(zi);
-    }
-    return i;
-}
+// Centre et largeur de la zone initiale, donnés sur la ligne de commande
+const char *centre_r = 0;
+const char *centre_i = 0;
+double largeur = 0.0;
 
-static void set_color(DrawingWindow& w, parameters& p, int i)
+// Nombre de mots nécessaires pour représenter le centre de l'image,
+// pour une taille de pixel donnée
+static int limbs_for_scale(double scale)
 {
-    double rouge, vert, bleu;
-    if (i >= p.maxiter) {
-        rouge = vert = bleu = 0.0;
-    } else {
-        int ii = (p.maxiter - 1 - i) % 96;
-        if (ii < 32) {
-            // vert -> bleu
-            bleu = ii / 32.0;
-            vert = 1.0 - bleu;
-            rouge = 0.0;
-        } else if (ii < 64) {
-            // bleu -> rouge
-            rouge = (ii - 32) / 32.0;
-            bleu = 1.0 - rouge;
-            vert = 0.0;
-        } else {
-            // rouge -> vert
-            vert = (ii - 64) / 32.0;
-            rouge = 1.0 - vert;
-            bleu = 0.0;
-        }
-    }
-    w.setColor(rouge, vert, bleu);
+    int bits = 64;
+    if (scale < 1.0)
+        bits += int(-std::log(scale) / std::log(2.0));
+    return BigFixed::limbsFor(bits);
 }
 
-// Fonction de dessin de l'ensemble de Madelbrot, dans la zone
-// spécifiée, et avec la précision souhgaitée.
-static void do_mandel(DrawingWindow& w, parameters& p)
-{
-    int x, y;                   // le pixel considéré
-    double cr, ci;              // le complexe correspondant
-
-    for (y = 0 ; y < w.height ; y++) {
-        ci = p.Imax - y * p.Iscale;
-        cr = p.Rmin;
-        int x0 = 0;
-        int i0 = check_point(p, cr, ci);
-        for (x = 1 ; x < w.width ; x++) {
-            cr = p.Rmin + x * p.Rscale;
-            int i = check_point(p, cr, ci);
-            if (i != i0) {
-                set_color(w, p, i0);
-                w.drawLine(x0, y, x - 1, y);
-                i0 = i;
-                x0 = x;
-            }
-        }
-        set_color(w, p, i0);
-        w.drawLine(x0, y, w.width - 1, y);
-    }
-}
-    
 // Fonction de dessin principale, calcule la zone d'intérêt, appelle
-// do_mandel(), pour dessiner l'ensemle, et permet le zoom.
+// MandelRenderer::render(), pour dessiner l'ensemble, et permet le
+// zoom.  Un clic pendant le calcul l'interrompt, et zoome aussitôt.
+// Le bouton droit double le nombre d'itérations, le bouton du milieu
+// change la palette : les points déjà calculés ne le sont pas à
+// nouveau.  Le centre de l'image est gardé en haute précision : quand
+// la précision d'un double ne suffit plus, le rendu passe en zoom
+// profond.
 static void mandel(DrawingWindow &w)
 {
     parameters p = initial_parameters;
-    while (1) {
-        p.Rscale = (p.Rmax - p.Rmin) / (w.width - 1);
-        p.Iscale = (p.Imax - p.Imin) / (w.height - 1);
-        do_mandel(w, p);
+    MandelRenderer renderer(w.width, w.height);
+    renderer.setMaxIter(p.maxiter);
+    renderer.setSubdivision(true);
+    renderer.setProgressive(true);
+    bool cycling = false;       // palette animée
 
-        w.setColor("white");
-        w.drawText(5, 5, "Cliquer sur l'image pour zoomer");
+    w.setLayer(1);
+    w.setColor("white");
+    w.drawText(5, 5, "Gauche : zoom, droit : iterations x2, "
+               "milieu : couleurs");
+    w.setLayer(0);
 
+    p.Rscale = (p.Rmax - p.Rmin) / (w.width - 1);
+    p.Iscale = (p.Imax - p.Imin) / (w.height - 1);
+    int limbs = limbs_for_scale(p.Rscale);
+    BigFixed Rc(p.Rmin + w.width / 2 * p.Rscale, limbs);
+    BigFixed Ic(p.Imax - w.height / 2 * p.Iscale, limbs);
+    if (centre_r && centre_i) {
+        if (largeur > 0.0)
+            p.Rscale = p.Iscale = largeur / (w.width - 1);
+        limbs = limbs_for_scale(p.Rscale);
+        Rc = BigFixed::fromString(centre_r, limbs);
+        Ic = BigFixed::fromString(centre_i, limbs);
+    }
+    renderer.setArea(Rc, Ic, p.Rscale, p.Iscale);
+    while (1) {
         int x, y;
         int button;
-        w.waitMousePress(x, y, button);
+        if (renderer.render(w, x, y, button)) {
+            while (!w.waitMousePress(x, y, button, cycling ? 40 : ULONG_MAX)) {
+                if (cycling) {
+                    renderer.cyclePalette(1);
+                    renderer.recolour(w);
+                }
+            }
+        }
 
-        // calcul des coordonnées du point cliqué
-        double Tr = p.Rmin + x * p.Rscale;
-        double Ti = p.Imax - y * p.Rscale;
+        if (button == 2) {
+            p.maxiter *= 2;
+            std::cerr << "maxiter = " << p.maxiter << std::endl;
+            renderer.setMaxIter(p.maxiter);
+            continue;
+        }
+        if (button == 3) {
+            // normale -> histogramme -> animée -> normale...
+            if (renderer.getColouring() == MandelRenderer::Histogram) {
+                renderer.setColouring(MandelRenderer::Cyclic);
+                cycling = true;
+            } else if (cycling) {
+                cycling = false;
+            } else {
+                renderer.setColouring(MandelRenderer::Histogram);
+            }
+            continue;
+        }
 
-        // calcul de la nouvelle zone d'intérêt :
-        // zoom ×2 en direction du point cliqué
+        // calcul de la nouvelle zone d'intérêt : zoom ×2 en direction
+        // du point cliqué, qui devient le centre de l'image
         const int zoom = 2;
-        double Rmin2 = p.Rmin / zoom;
-        double Rmax2 = p.Rmax / zoom;
-        double Imin2 = p.Imin / zoom;
-        double Imax2 = p.Imax / zoom;
-        double Rshift = Tr - (Rmin2 + Rmax2) / 2;
-        double Ishift = Ti - (Imin2 + Imax2) / 2;
-        Rmin2 += Rshift;
-        Rmax2 += Rshift;
-        Imin2 += Ishift;
-        Imax2 += Ishift;
 
-        // affichage d'un rectangle autour de la nouvelle zone d'intérêt
-        w.setColor("white");
-        w.drawRect((Rmin2 - p.Rmin) / p.Rscale, (p.Imax - Imin2) / p.Iscale,
-                   (Rmax2 - p.Rmin) / p.Rscale, (p.Imax - Imax2) / p.Iscale);
+        // affichage immédiat de l'image précédente, agrandie, en
+        // attendant le calcul progressif de la nouvelle
+        renderer.zoomPreview(w, x, y, zoom);
 
-        p.Rmin = Rmin2;
-        p.Rmax = Rmax2;
-        p.Imin = Imin2;
-        p.Imax = Imax2;
+        limbs = limbs_for_scale(p.Rscale / zoom);
+        Rc.setLimbs(limbs);
+        Ic.setLimbs(limbs);
+        Rc = Rc + BigFixed((x - w.width / 2) * p.Rscale, limbs);
+        Ic = Ic - BigFixed((y - w.height / 2) * p.Iscale, limbs);
+        p.Rscale /= zoom;
+        p.Iscale /= zoom;
+        renderer.setArea(Rc, Ic, p.Rscale, p.Iscale);
+        if (renderer.isDeep())
+            std::cerr << "zoom profond, pixel = " << p.Rscale << std::endl;
     }
 }
 
 int main(int argc, char *argv[])
 {
     QApplication app(argc, argv);
+    if (argc > 2) {
+        centre_r = argv[1];
+        centre_i = argv[2];
+    }
+    if (argc > 3)
+        largeur = atof(argv[3]);
     DrawingWindow win(mandel, 800, 800);
     win.show();
     return app.exec();
@@ -2,10 +2,19 @@ TEMPLATE = app
 TARGET = mandel
 CONFIG += qt
 #CONFIG += debug
+#CONFIG += native
+
+native {
+	QMAKE_CXXFLAGS += -march=native
+}
 
 INCLUDEPATH += ../
 DEPENDPATH += ../
 
 HEADERS += ../DrawingWindow.h
 SOURCES += ../DrawingWindow.cpp
+HEADERS += BigFixed.h
+SOURCES += BigFixed.cpp
+HEADERS += MandelRenderer.h
+SOURCES += MandelRenderer.cpp
 SOURCES += mandel.cpp
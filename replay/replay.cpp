@@ -0,0 +1,65 @@
+#include <DrawingWindow.h>
+#include <QApplication>
+#include <QElapsedTimer>
+#include <cstring>
+#include <iostream>
+
+// Rejoue un enregistrement fait par un programme lancé avec la
+// variable d'environnement DRAWINGWINDOW_RECORD=<fichier>.
+//
+//   replay [-realtime] [-headless] <fichier>
+//
+// Par défaut, les appels sont rejoués aussi vite que possible, et la
+// durée totale est affichée : c'est une mesure reproductible du coût
+// du dessin, pour comparer deux versions de DrawingWindow.  Avec
+// -realtime, les dates enregistrées sont respectées.  Avec -headless,
+// la fenêtre n'est pas affichée à l'écran, et se ferme à la fin.
+
+const char *fichier = 0;
+bool tempsReel = false;
+bool invisible = false;
+
+static void rejoue(DrawingWindow &w)
+{
+    QElapsedTimer chrono;
+    chrono.start();
+    bool ok = DrawingWindow::replay(w, fichier, tempsReel);
+    double duree = chrono.nsecsElapsed() / 1e9;
+    if (!ok)
+        std::cerr << fichier << " : enregistrement illisible ou tronqué"
+                  << std::endl;
+    std::cerr << "durée : " << duree << " s" << std::endl;
+    if (invisible)
+        w.closeGraph();
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "-realtime") == 0)
+            tempsReel = true;
+        else if (std::strcmp(argv[i], "-headless") == 0)
+            invisible = true;
+        else
+            fichier = argv[i];
+    }
+    if (!fichier) {
+        std::cerr << "usage : " << argv[0]
+                  << " [-realtime] [-headless] <fichier>" << std::endl;
+        return 1;
+    }
+    int largeur, hauteur;
+    if (!DrawingWindow::getRecordSize(fichier, largeur, hauteur)) {
+        std::cerr << fichier << " : pas un enregistrement" << std::endl;
+        return 1;
+    }
+    // ne pas s'enregistrer soi-même, par dessus le fichier rejoué
+    qputenv("DRAWINGWINDOW_RECORD", "");
+
+    DrawingWindow win(rejoue, largeur, hauteur);
+    if (invisible)
+        win.setAttribute(Qt::WA_DontShowOnScreen);
+    win.show();
+    return app.exec();
+}
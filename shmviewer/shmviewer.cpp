@@ -0,0 +1,148 @@
+#include <DrawingWindow.h>
+#include <QApplication>
+#include <QBasicTimer>
+#include <QImage>
+#include <QPaintEvent>
+#include <QPainter>
+#include <QTimerEvent>
+#include <QWidget>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Affiche, en direct, les trames d'une fenêtre de dessin d'un autre
+// processus.  Ce programme doit avoir été lancé avec la variable
+// d'environnement DRAWINGWINDOW_EXPORT=<nom>, et DrawingWindow
+// compilée avec DRAWINGWINDOW_SHM.
+//
+//   shmviewer <nom>
+//
+// Le protocole est décrit avec DrawingWindow::SharedFrame : à chaque
+// tic, seuls les carreaux modifiés depuis la dernière trame vue sont
+// recopiés, sans jamais bloquer le producteur.
+
+class Viewer: public QWidget {
+public:
+    Viewer(DrawingWindow::SharedFrame *header_);
+
+protected:
+    void paintEvent(QPaintEvent *ev);
+    void timerEvent(QTimerEvent *ev);
+
+private:
+    DrawingWindow::SharedFrame *header;
+    const int *generations;
+    const QRgb *pixels;
+    QImage image;
+    int seen;                   // dernière trame recopiée
+    QBasicTimer timer;
+
+    void poll();
+};
+
+Viewer::Viewer(DrawingWindow::SharedFrame *header_)
+    : header(header_)
+    , generations(reinterpret_cast<const int *>(header + 1))
+    , pixels(reinterpret_cast<const QRgb *>(
+                 reinterpret_cast<const char *>(header) + header->pixelsOffset))
+    , image(header->width, header->height, QImage::Format_RGB32)
+    , seen(0)
+{
+    image.fill(0);
+    setFixedSize(image.size());
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    timer.start(20, this);
+}
+
+void Viewer::paintEvent(QPaintEvent *ev)
+{
+    QPainter painter(this);
+    painter.drawImage(ev->rect(), image, ev->rect());
+}
+
+void Viewer::timerEvent(QTimerEvent *ev)
+{
+    if (ev->timerId() == timer.timerId())
+        poll();
+    else
+        QWidget::timerEvent(ev);
+}
+
+void Viewer::poll()
+{
+    const int s1 = header->sequence.fetchAndAddOrdered(0);
+    if (s1 & 1)
+        return;                 // écriture en cours : au prochain tic
+    const int frame = header->frame.fetchAndAddOrdered(0);
+    if (frame != seen) {
+        const int t = header->tileSize;
+        QRect changed;
+        for (int ty = 0; ty < header->tilesY; ty++) {
+            for (int tx = 0; tx < header->tilesX; tx++) {
+                const int g = generations[ty * header->tilesX + tx];
+                if (int(unsigned(g) - unsigned(seen)) <= 0)
+                    continue;
+                const QRect r = QRect(tx * t, ty * t, t, t) & image.rect();
+                for (int y = r.top(); y <= r.bottom(); y++)
+                    std::memcpy(image.scanLine(y) + r.left() * sizeof(QRgb),
+                                pixels + y * header->width + r.left(),
+                                r.width() * sizeof(QRgb));
+                changed |= r;
+            }
+        }
+        // écriture pendant la copie : tout sera recopié au prochain tic
+        if (header->sequence.fetchAndAddOrdered(0) != s1)
+            return;
+        seen = frame;
+        update(changed);
+    }
+    if (header->closed) {
+        timer.stop();
+        setWindowTitle(windowTitle() + " (fermée)");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+    if (argc != 2) {
+        std::cerr << "usage : " << argv[0] << " <nom>" << std::endl;
+        return 1;
+    }
+    QByteArray name(argv[1]);
+    if (name[0] != '/')
+        name.prepend('/');
+
+    // ouvert en écriture, pour lire les compteurs par fetchAndAddOrdered
+    // (le segment n'est accessible qu'à l'utilisateur qui l'a créé)
+    int fd = shm_open(name.constData(), O_RDWR, 0);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        std::cerr << name.constData() << " : segment introuvable" << std::endl;
+        return 1;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+    close(fd);
+    DrawingWindow::SharedFrame *header =
+        static_cast<DrawingWindow::SharedFrame *>(data);
+    if (data == MAP_FAILED
+        || size_t(st.st_size) < sizeof(DrawingWindow::SharedFrame)
+        || std::memcmp(header->magic, DrawingWindow::sharedFrameMagic,
+                       sizeof header->magic) != 0
+        || header->version != DrawingWindow::sharedFrameVersion
+        || st.st_size < header->pixelsOffset
+                        + qint64(header->width) * header->height * 4) {
+        std::cerr << name.constData() << " : pas un export de DrawingWindow"
+                  << std::endl;
+        return 1;
+    }
+
+    Viewer viewer(header);
+    viewer.setWindowTitle(QString::fromLocal8Bit(name.constData()));
+    viewer.show();
+    return app.exec();
+}
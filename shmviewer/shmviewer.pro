@@ -0,0 +1,14 @@
+TEMPLATE = app
+TARGET = shmviewer
+
+CONFIG += qt
+CONFIG += debug
+
+INCLUDEPATH += ../
+DEPENDPATH += ../
+
+LIBS += -lrt
+
+HEADERS += ../DrawingWindow.h
+SOURCES += ../DrawingWindow.cpp \
+           shmviewer.cpp
@@ -1,38 +1,66 @@
 #include <QApplication>
-#include <DrawingWindow.h>
+#include <QElapsedTimer>
+#define SIMPLEDW_NO_MAIN
+#include <SimpleDW.h>
+#include <cstdlib>
+#include <iostream>
 
 extern void simpleDW_user_main_wrapper();
 
+DrawingWindow *simpleDW_window;
+int simpleDW_argc;
+char **simpleDW_argv;
+unsigned long simpleDW_counts[SDW_PRIMITIVES];
+
 namespace {
-    DrawingWindow *global_w;
-    int global_argc;
-    char **global_argv;
+    const char *const primitive_names[SDW_PRIMITIVES] = {
+        "point", "line", "rect", "circle", "triangle", "polyline", "text",
+        "pixels"
+    };
 
+    // Durée et nombre de primitives, sur une ligne de la sortie
+    // d'erreur, pour l'exécution par lots
+    void report(qint64 nsecs)
+    {
+        unsigned long total = 0;
+        for (int i = 0; i < SDW_PRIMITIVES; i++)
+            total += simpleDW_counts[i];
+        std::cerr << "SimpleDW: " << nsecs / 1e6 << " ms, "
+                  << total << " primitives (";
+        for (int i = 0; i < SDW_PRIMITIVES; i++)
+            std::cerr << (i ? ", " : "") << primitive_names[i] << " "
+                      << simpleDW_counts[i];
+        std::cerr << ")" << std::endl;
+    }
+
+    // Sans affichage, la fenêtre est fermée à la fin du programme, et
+    // le processus se termine
     void drawing_function(DrawingWindow& w)
     {
-        global_w = &w;
+        const bool headless =
+            w.getBackend() == DrawingWindow::HeadlessBackend;
+        simpleDW_window = &w;
+        QElapsedTimer clock;
+        clock.start();
         simpleDW_user_main_wrapper();
+        if (headless || getenv("SIMPLEDW_STATS"))
+            report(clock.nsecsElapsed());
+        if (headless)
+            w.closeGraph();
     }
 }
 
+// Sans affichage si compilé avec SIMPLEDW_HEADLESS, ou si la variable
+// d'environnement DRAWINGWINDOW_BACKEND vaut "headless"
 int main(int argc, char *argv[])
 {
     QApplication application(argc, argv);
-    global_argc = argc;
-    global_argv = argv;
+    simpleDW_argc = argc;
+    simpleDW_argv = argv;
+#ifdef SIMPLEDW_HEADLESS
+    DrawingWindow::setDefaultBackend(DrawingWindow::HeadlessBackend);
+#endif
     DrawingWindow window(drawing_function);
     window.show();
     return application.exec();
 }
-
-#include <SimpleDW.h>
-
-void drawText(int x, int y, const char *text, int flags)
-{
-    global_w->drawText(x, y, text, flags);
-}
-
-void drawText(int x, int y, const std::string &text, int flags)
-{
-    global_w->drawText(x, y, text, flags);
-}
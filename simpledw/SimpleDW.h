@@ -1,10 +1,429 @@
 #ifndef SIMPLE_DW_H
 #define SIMPLE_DW_H
 
+#include <DrawingWindow.h>
 #include <string>
 
-void drawText(int x, int y, const char *text, int flags = 0);
-void drawText(int x, int y, const std::string &text, int flags = 0);
+// Fenêtre de dessin, et arguments du programme
+extern DrawingWindow *simpleDW_window;
+extern int simpleDW_argc;
+extern char **simpleDW_argv;
+
+// Nombre d'appels aux primitives, par catégorie, pour les statistiques
+// affichées à la fin du programme (voir SimpleDW.cpp)
+enum SimpleDWPrimitive {
+    SDW_POINT,
+    SDW_LINE,
+    SDW_RECT,
+    SDW_CIRCLE,
+    SDW_TRIANGLE,
+    SDW_POLYLINE,
+    SDW_TEXT,
+    SDW_PIXELS,
+    SDW_PRIMITIVES              // nombre de catégories
+};
+extern unsigned long simpleDW_counts[SDW_PRIMITIVES];
+
+// Méthodes de DrawingWindow, en fonctions libres sur simpleDW_window.
+// Les fonctions POSIX sync, sleep et usleep gardent leur nom :
+// utiliser syncGraph et msleep.
+
+inline int getWidth()
+{
+    return simpleDW_window->width;
+}
+
+inline int getHeight()
+{
+    return simpleDW_window->height;
+}
+
+inline void setColor(unsigned int color)
+{
+    simpleDW_window->setColor(color);
+}
+
+inline void setColor(const char *name)
+{
+    simpleDW_window->setColor(name);
+}
+
+inline void setColor(float red, float green, float blue)
+{
+    simpleDW_window->setColor(red, green, blue);
+}
+
+inline void setBgColor(unsigned int color)
+{
+    simpleDW_window->setBgColor(color);
+}
+
+inline void setBgColor(const char *name)
+{
+    simpleDW_window->setBgColor(name);
+}
+
+inline void setBgColor(float red, float green, float blue)
+{
+    simpleDW_window->setBgColor(red, green, blue);
+}
+
+inline void setPenWidth(int width)
+{
+    simpleDW_window->setPenWidth(width);
+}
+
+inline void setAntialiasing(bool state)
+{
+    simpleDW_window->setAntialiasing(state);
+}
+
+inline void setSupersampling(int factor)
+{
+    simpleDW_window->setSupersampling(factor);
+}
+
+inline int getSupersampling()
+{
+    return simpleDW_window->getSupersampling();
+}
+
+inline void clearGraph()
+{
+    simpleDW_window->clearGraph();
+}
+
+inline void setLayer(int layer)
+{
+    simpleDW_window->setLayer(layer);
+}
+
+inline int getLayer()
+{
+    return simpleDW_window->getLayer();
+}
+
+inline void clearLayer()
+{
+    simpleDW_window->clearLayer();
+}
+
+inline void drawPoint(int x, int y)
+{
+    ++simpleDW_counts[SDW_POINT];
+    simpleDW_window->drawPoint(x, y);
+}
+
+inline void drawPointF(double x, double y)
+{
+    ++simpleDW_counts[SDW_POINT];
+    simpleDW_window->drawPointF(x, y);
+}
+
+inline void drawLine(int x1, int y1, int x2, int y2)
+{
+    ++simpleDW_counts[SDW_LINE];
+    simpleDW_window->drawLine(x1, y1, x2, y2);
+}
+
+inline void drawLineF(double x1, double y1, double x2, double y2)
+{
+    ++simpleDW_counts[SDW_LINE];
+    simpleDW_window->drawLineF(x1, y1, x2, y2);
+}
+
+inline void drawRect(int x1, int y1, int x2, int y2)
+{
+    ++simpleDW_counts[SDW_RECT];
+    simpleDW_window->drawRect(x1, y1, x2, y2);
+}
+
+inline void fillRect(int x1, int y1, int x2, int y2)
+{
+    ++simpleDW_counts[SDW_RECT];
+    simpleDW_window->fillRect(x1, y1, x2, y2);
+}
+
+inline void drawCircle(int x, int y, int r)
+{
+    ++simpleDW_counts[SDW_CIRCLE];
+    simpleDW_window->drawCircle(x, y, r);
+}
+
+inline void drawCircleF(double x, double y, double r)
+{
+    ++simpleDW_counts[SDW_CIRCLE];
+    simpleDW_window->drawCircleF(x, y, r);
+}
+
+inline void fillCircle(int x, int y, int r)
+{
+    ++simpleDW_counts[SDW_CIRCLE];
+    simpleDW_window->fillCircle(x, y, r);
+}
+
+inline void fillCircleF(double x, double y, double r)
+{
+    ++simpleDW_counts[SDW_CIRCLE];
+    simpleDW_window->fillCircleF(x, y, r);
+}
+
+inline void drawTriangle(int x1, int y1, int x2, int y2, int x3, int y3)
+{
+    ++simpleDW_counts[SDW_TRIANGLE];
+    simpleDW_window->drawTriangle(x1, y1, x2, y2, x3, y3);
+}
+
+inline void drawTriangleF(double x1, double y1, double x2, double y2,
+                          double x3, double y3)
+{
+    ++simpleDW_counts[SDW_TRIANGLE];
+    simpleDW_window->drawTriangleF(x1, y1, x2, y2, x3, y3);
+}
+
+inline void fillTriangle(int x1, int y1, int x2, int y2, int x3, int y3)
+{
+    ++simpleDW_counts[SDW_TRIANGLE];
+    simpleDW_window->fillTriangle(x1, y1, x2, y2, x3, y3);
+}
+
+inline void fillTriangleF(double x1, double y1, double x2, double y2,
+                          double x3, double y3)
+{
+    ++simpleDW_counts[SDW_TRIANGLE];
+    simpleDW_window->fillTriangleF(x1, y1, x2, y2, x3, y3);
+}
+
+inline void drawPolyline(const QPoint *points, int n)
+{
+    ++simpleDW_counts[SDW_POLYLINE];
+    simpleDW_window->drawPolyline(points, n);
+}
+
+inline void drawLines(const QLine *lines, int n)
+{
+    simpleDW_counts[SDW_LINE] += n;
+    simpleDW_window->drawLines(lines, n);
+}
+
+inline void drawLines(const QLine *lines, const unsigned int *colors, int n)
+{
+    simpleDW_counts[SDW_LINE] += n;
+    simpleDW_window->drawLines(lines, colors, n);
+}
+
+inline void drawText(int x, int y, const char *text, int flags = 0)
+{
+    ++simpleDW_counts[SDW_TEXT];
+    simpleDW_window->drawText(x, y, text, flags);
+}
+
+inline void drawText(int x, int y, const std::string &text, int flags = 0)
+{
+    ++simpleDW_counts[SDW_TEXT];
+    simpleDW_window->drawText(x, y, text, flags);
+}
+
+inline void drawTextBg(int x, int y, const char *text, int flags = 0)
+{
+    ++simpleDW_counts[SDW_TEXT];
+    simpleDW_window->drawTextBg(x, y, text, flags);
+}
+
+inline void drawTextBg(int x, int y, const std::string &text, int flags = 0)
+{
+    ++simpleDW_counts[SDW_TEXT];
+    simpleDW_window->drawTextBg(x, y, text, flags);
+}
+
+inline void setWorld(double xmin, double ymin, double xmax, double ymax)
+{
+    simpleDW_window->setWorld(xmin, ymin, xmax, ymax);
+}
+
+inline void resetWorld()
+{
+    simpleDW_window->resetWorld();
+}
+
+inline void translateWorld(double dx, double dy)
+{
+    simpleDW_window->translateWorld(dx, dy);
+}
+
+inline void scaleWorld(double kx, double ky)
+{
+    simpleDW_window->scaleWorld(kx, ky);
+}
+
+inline void pushWorld()
+{
+    simpleDW_window->pushWorld();
+}
+
+inline void popWorld()
+{
+    simpleDW_window->popWorld();
+}
+
+inline int worldToX(double x)
+{
+    return simpleDW_window->worldToX(x);
+}
+
+inline int worldToY(double y)
+{
+    return simpleDW_window->worldToY(y);
+}
+
+inline double xToWorld(int x)
+{
+    return simpleDW_window->xToWorld(x);
+}
+
+inline double yToWorld(int y)
+{
+    return simpleDW_window->yToWorld(y);
+}
+
+inline void drawWorldPoint(double x, double y)
+{
+    ++simpleDW_counts[SDW_POINT];
+    simpleDW_window->drawWorldPoint(x, y);
+}
+
+inline void drawWorldLine(double x1, double y1, double x2, double y2)
+{
+    ++simpleDW_counts[SDW_LINE];
+    simpleDW_window->drawWorldLine(x1, y1, x2, y2);
+}
+
+inline void drawWorldRect(double x1, double y1, double x2, double y2)
+{
+    ++simpleDW_counts[SDW_RECT];
+    simpleDW_window->drawWorldRect(x1, y1, x2, y2);
+}
+
+inline void fillWorldRect(double x1, double y1, double x2, double y2)
+{
+    ++simpleDW_counts[SDW_RECT];
+    simpleDW_window->fillWorldRect(x1, y1, x2, y2);
+}
+
+inline void drawWorldCircle(double x, double y, int r)
+{
+    ++simpleDW_counts[SDW_CIRCLE];
+    simpleDW_window->drawWorldCircle(x, y, r);
+}
+
+inline void fillWorldCircle(double x, double y, int r)
+{
+    ++simpleDW_counts[SDW_CIRCLE];
+    simpleDW_window->fillWorldCircle(x, y, r);
+}
+
+inline void drawWorldTriangle(double x1, double y1, double x2, double y2,
+                              double x3, double y3)
+{
+    ++simpleDW_counts[SDW_TRIANGLE];
+    simpleDW_window->drawWorldTriangle(x1, y1, x2, y2, x3, y3);
+}
+
+inline void fillWorldTriangle(double x1, double y1, double x2, double y2,
+                              double x3, double y3)
+{
+    ++simpleDW_counts[SDW_TRIANGLE];
+    simpleDW_window->fillWorldTriangle(x1, y1, x2, y2, x3, y3);
+}
+
+inline void drawWorldPolyline(const double *x, const double *y, int n)
+{
+    ++simpleDW_counts[SDW_POLYLINE];
+    simpleDW_window->drawWorldPolyline(x, y, n);
+}
+
+inline unsigned int getPointColor(int x, int y)
+{
+    return simpleDW_window->getPointColor(x, y);
+}
+
+inline int saveArea(int x1, int y1, int x2, int y2)
+{
+    return simpleDW_window->saveArea(x1, y1, x2, y2);
+}
+
+inline void restoreArea(int area)
+{
+    simpleDW_window->restoreArea(area);
+}
+
+inline QFuture<bool> saveImageAsync(const char *fileName,
+                                    const char *format = NULL)
+{
+    return simpleDW_window->saveImageAsync(fileName, format);
+}
+
+inline unsigned int *lockPixels()
+{
+    ++simpleDW_counts[SDW_PIXELS];
+    return simpleDW_window->lockPixels();
+}
+
+inline int getPixelStride()
+{
+    return simpleDW_window->getPixelStride();
+}
+
+inline void unlockPixels()
+{
+    simpleDW_window->unlockPixels();
+}
+
+inline void unlockPixels(int x1, int y1, int x2, int y2)
+{
+    simpleDW_window->unlockPixels(x1, y1, x2, y2);
+}
+
+inline bool waitMousePress(int &x, int &y, int &button,
+                           unsigned long time = ULONG_MAX)
+{
+    return simpleDW_window->waitMousePress(x, y, button, time);
+}
+
+inline bool syncGraph(unsigned long time = ULONG_MAX)
+{
+    return simpleDW_window->sync(time);
+}
+
+inline bool waitNextFrame(unsigned long time = ULONG_MAX)
+{
+    return simpleDW_window->waitNextFrame(time);
+}
+
+inline double frameTime()
+{
+    return simpleDW_window->frameTime();
+}
+
+inline int frameSteps(double step)
+{
+    return simpleDW_window->frameSteps(step);
+}
+
+inline void closeGraph()
+{
+    simpleDW_window->closeGraph();
+}
+
+inline void msleep(unsigned long msecs)
+{
+    DrawingWindow::msleep(msecs);
+}
+
+// Le main du programme est renommé, et appelé depuis la fonction de
+// dessin (pas dans SimpleDW.cpp, qui définit le vrai main)
+
+#ifndef SIMPLEDW_NO_MAIN
 
 #define SDW_CHECK_ARGS(A, B, ...) SDW_CHECK_ARGS_(__VA_ARGS__, B, A)
 #define SDW_CHECK_ARGS_(a2, a1, X, ...) X
@@ -13,9 +432,7 @@ void drawText(int x, int y, const std::string &text, int flags = 0);
     simpleDW_user_main()
 
 #define call2()                                         \
-    extern int global_argc;                             \
-    extern char **global_argv;                          \
-    simpleDW_user_main(global_argc, global_argv)
+    simpleDW_user_main(simpleDW_argc, simpleDW_argv)
 
 #define main(...)                                         \
     simpleDW_user_main(__VA_ARGS__);                      \
@@ -25,4 +442,6 @@ void drawText(int x, int y, const std::string &text, int flags = 0);
     }                                                     \
     int simpleDW_user_main(__VA_ARGS__)
 
+#endif // !SIMPLEDW_NO_MAIN
+
 #endif // !SIMPLE_DW_H
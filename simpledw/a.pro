@@ -4,6 +4,12 @@ TARGET = a
 CONFIG += qt
 CONFIG += debug
 
+#CONFIG += simpledw_headless
+
+simpledw_headless {
+	DEFINES += SIMPLEDW_HEADLESS
+}
+
 HEADERS += SimpleDW.h DrawingWindow.h
 SOURCES += SimpleDW.cpp DrawingWindow.cpp
 
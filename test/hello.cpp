@@ -24,6 +24,7 @@
 #include <QApplication>
 #include <DrawingWindow.h>
 
+#include <cstdlib>
 #include <iostream>
 
 void flip(DrawingWindow &w)
@@ -117,21 +118,27 @@ void mandel(DrawingWindow &w)
 
 void lines(DrawingWindow &w)
 {
+    const int batch = 100;
+    QLine segments[batch];
+    unsigned int colors[batch];
     int n = 100000;
     int xmax = w.width;
     int ymax = w.height;
-    while (n-- > 0) {
-        double r = rand() / (float )RAND_MAX;
-        double g = rand() / (float )RAND_MAX;
-        double b = rand() / (float )RAND_MAX;
-        int x1 = rand() % xmax;
-        int y1 = rand() % ymax;
-        int x2 = rand() % xmax;
-        int y2 = rand() % ymax;
-        w.setColor(r, g, b);
-        w.drawLine(x1, y1, x2, y2);
-        //if (n % 100 == 0)
-            w.sync();
+    while (n > 0) {
+        int k;
+        for (k = 0; k < batch && n > 0; k++, n--) {
+            int r = rand() % 256;
+            int g = rand() % 256;
+            int b = rand() % 256;
+            int x1 = rand() % xmax;
+            int y1 = rand() % ymax;
+            int x2 = rand() % xmax;
+            int y2 = rand() % ymax;
+            colors[k] = (r << 16) | (g << 8) | b;
+            segments[k] = QLine(x1, y1, x2, y2);
+        }
+        w.drawLines(segments, colors, k);
+        w.sync();
     }
 }
 
@@ -152,6 +159,10 @@ int main(int argc, char *argv[])
     const int h = 700;
     QApplication application(argc, argv);
 
+    // "hello N" : fenêtres en mode partagé, avec N threads de dessin
+    if (argc > 1)
+        DrawingWindow::setSharedMode(true, atoi(argv[1]));
+
     const int nf = 1;
     const int nm = 1;
     DrawingWindow *dw[nf + nm];
@@ -11,6 +11,25 @@ profile {
 	QMAKE_LFLAGS += -pg
 }
 
+#CONFIG += drawingwindow_opengl
+#CONFIG += drawingwindow_xshm
+#CONFIG += drawingwindow_shm
+
+drawingwindow_opengl {
+	QT += opengl
+	DEFINES += DRAWINGWINDOW_OPENGL
+}
+
+drawingwindow_xshm {
+	DEFINES += DRAWINGWINDOW_XSHM
+	LIBS += -lXext
+}
+
+drawingwindow_shm {
+	DEFINES += DRAWINGWINDOW_SHM
+	LIBS += -lrt
+}
+
 INCLUDEPATH += ../
 DEPENDPATH += ../
 